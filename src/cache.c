@@ -1,20 +1,28 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if !defined(CACHE_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#elif !defined(CACHE_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "cache.h"
 
 
-extern uns64 SWP_CORE0_WAYS; // Input Way partitions for Core 0       
-extern uns64 cycle; // You can use this as timestamp for LRU
+static void         cache_select_engines(Cache *c);
+static void         cache_swp_quota(Cache *c);
 
 ////////////////////////////////////////////////////////////////////
-// ------------- DO NOT MODIFY THE INIT FUNCTION -----------
+// Sets are aligned so each tag array starts on a host cache line
 ////////////////////////////////////////////////////////////////////
 
-Cache  *cache_new(uns64 size, uns64 assoc, uns64 linesize, uns64 repl_policy){
+Cache  *cache_new(SimContext *ctx, uns64 size, uns64 assoc, uns64 linesize, uns64 repl_policy){
 
    Cache *c = (Cache *) calloc (1, sizeof (Cache));
+   c->ctx = ctx;
    c->num_ways = assoc;
    c->repl_policy = repl_policy;
 
@@ -23,13 +31,85 @@ Cache  *cache_new(uns64 size, uns64 assoc, uns64 linesize, uns64 repl_policy){
      exit(-1);
    }
 
+   if(c->repl_policy == REPL_TREE_PLRU && (c->num_ways & (c->num_ways-1))){
+     printf("Tree PLRU needs a power of 2 associativity, got %llu ways\n", c->num_ways);
+     exit(-1);
+   }
+
    // determine num sets, and init the cache
    c->num_sets = size/(linesize*assoc);
-   c->sets  = (Cache_Set *) calloc (c->num_sets, sizeof(Cache_Set));
+   if(posix_memalign((void **) &c->sets, 64, c->num_sets*sizeof(Cache_Set))){
+     printf("Unable to allocate %llu sets\n", c->num_sets);
+     exit(-1);
+   }
+   memset(c->sets, 0, c->num_sets*sizeof(Cache_Set));
+
+   // LRU ranks start out as a permutation; ways past num_ways keep
+   // ranks >= num_ways so they never take part in promotion
+   for(uns64 i = 0; i < c->num_sets; i++)
+     for(uns w = 0; w < MAX_WAYS; w++)
+       c->sets[i].rank[w] = w;
+
+   if(c->repl_policy == REPL_SWP){
+     cache_swp_quota(c);
+   }
+
+   cache_select_engines(c);
 
    return c;
 }
 
+////////////////////////////////////////////////////////////////////
+// Ways per core for static way partitioning: the -SWP_ways list if
+// given (missing cores get 0), else -SWP_core0ways for core 0 and the
+// remaining ways split evenly over the other cores, lower ids first
+////////////////////////////////////////////////////////////////////
+
+static void cache_swp_quota(Cache *c){
+   SimContext *ctx = c->ctx;
+   uns64 num_cores = ctx->num_cores ? ctx->num_cores : 1;
+   uns64 rest, ii;
+
+   c->swp_quota = (uns64 *) calloc (num_cores, sizeof(uns64));
+
+   if(ctx->swp_num_quota){
+     for(ii=0; ii<num_cores && ii<ctx->swp_num_quota; ii++)
+       c->swp_quota[ii] = ctx->swp_quota[ii];
+     return;
+   }
+
+   c->swp_quota[0] = ctx->swp_core0_ways;
+   rest = (c->num_ways > ctx->swp_core0_ways) ? c->num_ways - ctx->swp_core0_ways : 0;
+   for(ii=1; ii<num_cores; ii++)
+     c->swp_quota[ii] = rest/(num_cores-1) + ((ii-1) < rest%(num_cores-1));
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+void cache_free(Cache *c){
+   free(c->mshr);
+   free(c->swp_quota);
+   free(c->sets);
+   free(c);
+}
+
+////////////////////////////////////////////////////////////////////
+// Zero the counters, the tag store stays warm
+////////////////////////////////////////////////////////////////////
+
+void cache_reset_stats(Cache *c){
+  c->stat_read_access  = 0;
+  c->stat_write_access = 0;
+  c->stat_read_miss    = 0;
+  c->stat_write_miss   = 0;
+  c->stat_dirty_evicts = 0;
+  c->stat_mshr_alloc     = 0;
+  c->stat_mshr_merge     = 0;
+  c->stat_mshr_full      = 0;
+  c->stat_mshr_occupancy = 0;
+}
+
 ////////////////////////////////////////////////////////////////////
 // ------------- DO NOT MODIFY THE PRINT STATS FUNCTION -----------
 ////////////////////////////////////////////////////////////////////
@@ -46,52 +126,302 @@ void    cache_print_stats    (Cache *c, char *header){
     write_mr=(double)(c->stat_write_miss)/(double)(c->stat_write_access);
   }
 
-  printf("\n%s_READ_ACCESS    \t\t : %10llu", header, c->stat_read_access);
-  printf("\n%s_WRITE_ACCESS   \t\t : %10llu", header, c->stat_write_access);
-  printf("\n%s_READ_MISS      \t\t : %10llu", header, c->stat_read_miss);
-  printf("\n%s_WRITE_MISS     \t\t : %10llu", header, c->stat_write_miss);
-  printf("\n%s_READ_MISSPERC  \t\t : %10.3f", header, 100*read_mr);
-  printf("\n%s_WRITE_MISSPERC \t\t : %10.3f", header, 100*write_mr);
-  printf("\n%s_DIRTY_EVICTS   \t\t : %10llu", header, c->stat_dirty_evicts);
+  fprintf(c->ctx->out, "\n%s_READ_ACCESS    \t\t : %10llu", header, c->stat_read_access);
+  fprintf(c->ctx->out, "\n%s_WRITE_ACCESS   \t\t : %10llu", header, c->stat_write_access);
+  fprintf(c->ctx->out, "\n%s_READ_MISS      \t\t : %10llu", header, c->stat_read_miss);
+  fprintf(c->ctx->out, "\n%s_WRITE_MISS     \t\t : %10llu", header, c->stat_write_miss);
+  fprintf(c->ctx->out, "\n%s_READ_MISSPERC  \t\t : %10.3f", header, 100*read_mr);
+  fprintf(c->ctx->out, "\n%s_WRITE_MISSPERC \t\t : %10.3f", header, 100*write_mr);
+  fprintf(c->ctx->out, "\n%s_DIRTY_EVICTS   \t\t : %10llu", header, c->stat_dirty_evicts);
 
-  printf("\n");
+  fprintf(c->ctx->out, "\n");
 }
 
 
 
 ////////////////////////////////////////////////////////////////////
-// Note: the system provides the cache with the line address
-// Return HIT if access hits in the cache, MISS otherwise 
-// Also if is_write is TRUE, then mark the resident line as dirty
-// Update appropriate stats
+// Miss status holding registers (-L1mshrs, -L2mshrs), used by memsys
+// for the timing only: cache_access_install() still puts a missing
+// line in the tags at once. A miss takes an MSHR until its fill
+// arrives, so a later access that hits a line whose fill is still on
+// its way is a secondary miss and merges into that MSHR. With every
+// MSHR busy the next miss waits for the earliest fill.
 ////////////////////////////////////////////////////////////////////
 
-Flag cache_access(Cache *c, Addr lineaddr, uns is_write, uns core_id){
+void cache_mshr_init(Cache *c, uns64 num_mshrs){
+  free(c->mshr);
+  c->mshr      = num_mshrs ? (Cache_MSHR *) calloc (num_mshrs, sizeof(Cache_MSHR)) : NULL;
+  c->num_mshrs = num_mshrs;
+}
+
+// Cycle at which the fill of lineaddr arrives if it is still on its
+// way at cycle (a merge), else 0
+uns64 cache_mshr_find(Cache *c, Addr lineaddr, uns64 cycle){
+  for(uns64 ii=0; ii<c->num_mshrs; ii++){
+    if(c->mshr[ii].lineaddr == lineaddr && c->mshr[ii].ready_cycle > cycle){
+      c->stat_mshr_merge++;
+      return c->mshr[ii].ready_cycle;
+    }
+  }
+  return 0;
+}
+
+// First cycle at or after cycle with a free MSHR
+uns64 cache_mshr_free_cycle(Cache *c, uns64 cycle){
+  uns64 free_cycle = c->num_mshrs ? c->mshr[0].ready_cycle : 0;
+
+  for(uns64 ii=1; ii<c->num_mshrs; ii++){
+    if(c->mshr[ii].ready_cycle < free_cycle){
+      free_cycle = c->mshr[ii].ready_cycle;
+    }
+  }
+  return (free_cycle > cycle) ? free_cycle : cycle;
+}
+
+// Cycle at which a miss found at cycle can leave for the next level
+uns64 cache_mshr_issue(Cache *c, uns64 cycle){
+  uns64 issue = cache_mshr_free_cycle(c, cycle);
+
+  c->stat_mshr_full += (issue > cycle);
+  return issue;
+}
+
+// Take a free MSHR at cycle (from cache_mshr_issue) for a fill that
+// arrives at ready_cycle
+void cache_mshr_fill(Cache *c, Addr lineaddr, uns64 cycle, uns64 ready_cycle){
+  uns64 busy = 0, pick = 0;
+
+  if(!c->num_mshrs){
+    return;
+  }
+  for(uns64 ii=0; ii<c->num_mshrs; ii++){
+    busy += (c->mshr[ii].ready_cycle > cycle);
+    if(c->mshr[ii].ready_cycle < c->mshr[pick].ready_cycle){
+      pick = ii;
+    }
+  }
+
+  c->mshr[pick].lineaddr    = lineaddr;
+  c->mshr[pick].ready_cycle = ready_cycle;
+  c->stat_mshr_alloc++;
+  c->stat_mshr_occupancy += busy;
+}
+
+void cache_print_mshr_stats(Cache *c, char *header){
+  if(!c->num_mshrs){
+    return;
+  }
+  fprintf(c->ctx->out, "%s_MSHR_MISSES    \t\t : %10llu", header, c->stat_mshr_alloc);
+  fprintf(c->ctx->out, "\n%s_MSHR_MERGES    \t\t : %10llu", header, c->stat_mshr_merge);
+  fprintf(c->ctx->out, "\n%s_MSHR_FULL      \t\t : %10llu", header, c->stat_mshr_full);
+  fprintf(c->ctx->out, "\n%s_MSHR_OCC_AVG   \t\t : %10.3f", header,
+	  c->stat_mshr_alloc ? (double)(c->stat_mshr_occupancy)/(double)(c->stat_mshr_alloc) : 0);
+  fprintf(c->ctx->out, "\n");
+}
+
+////////////////////////////////////////////////////////////////////
+// The lookup/replacement code below is written once as always-inline
+// kernels that take the geometry (num_sets, num_ways) and repl policy
+// as arguments. The generic engine passes the runtime values from the
+// Cache; the specialized engines at the end of the file pass literals,
+// so the set index becomes a mask/shift, the way loops unroll and the
+// policy switch folds away. cache_new() picks the engine.
+////////////////////////////////////////////////////////////////////
+
+#define CACHE_INLINE static inline __attribute__((always_inline))
+
+////////////////////////////////////////////////////////////////////
+// Returns a mask with bit i set if tag[i] of the set equals tag.
+// Valid bits and core ids are not checked here. All ways are compared
+// at once with AVX2 or SSE2 where available; build with -DCACHE_NO_SIMD
+// to use the scalar loop, which gives identical results.
+////////////////////////////////////////////////////////////////////
+
+CACHE_INLINE uns32 cache_match_kernel(Cache_Set *set, Addr tag, uns num_ways){
+    uns32 match = 0;
+#if !defined(CACHE_NO_SIMD) && defined(__AVX2__)
+    __m256i key = _mm256_set1_epi64x((long long) tag);
+    for(uns i = 0; i < num_ways; i += 4) {
+        __m256i ways = _mm256_load_si256((__m256i *) &set->tag[i]);
+        __m256i eq   = _mm256_cmpeq_epi64(ways, key);
+        match |= (uns32) _mm256_movemask_pd(_mm256_castsi256_pd(eq)) << i;
+    }
+#elif !defined(CACHE_NO_SIMD) && defined(__SSE2__)
+    // SSE2 has no 64-bit compare: a way matches if both 32-bit halves do
+    __m128i key = _mm_set1_epi64x((long long) tag);
+    for(uns i = 0; i < num_ways; i += 2) {
+        __m128i ways = _mm_load_si128((__m128i *) &set->tag[i]);
+        uns32 m = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ways, key)));
+        m &= m >> 1;
+        match |= ((m & 1) | ((m >> 1) & 2)) << i;
+    }
+#else
+    for(uns i = 0; i < num_ways; i++) {
+        if(set->tag[i] == tag)
+            match |= 1u << i;
+    }
+#endif
+    return match & (uns32)((1ULL << num_ways) - 1);
+}
+
+uns32 cache_match_tags(Cache_Set *set, Addr tag, uns num_ways){
+    return cache_match_kernel(set, tag, num_ways);
+}
+
+uns32 cache_match_tags_scalar(Cache_Set *set, Addr tag, uns num_ways){
+    uns32 match = 0;
+    for(uns i = 0; i < num_ways; i++) {
+        if(set->tag[i] == tag)
+            match |= 1u << i;
+    }
+    return match;
+}
+
+////////////////////////////////////////////////////////////////////
+// Recency metadata. Every policy promotes and picks a victim in
+// constant time for a given associativity:
+//  - LRU keeps a packed rank per way; promoting way w ages every way
+//    younger than w by one (one SIMD compare/subtract) and the victim
+//    is the way whose rank is num_ways-1.
+//  - Tree PLRU keeps num_ways-1 node bits, heap ordered from node 1;
+//    a set bit means the right subtree is the less recent one.
+//  - Bit PLRU keeps an MRU bit per way and clears all the others once
+//    every way is marked; the victim is the first way without its bit.
+////////////////////////////////////////////////////////////////////
+
+CACHE_INLINE void cache_lru_promote(Cache_Set *s, uns way){
+#if !defined(CACHE_NO_SIMD) && defined(__SSE2__)
+    __m128i rank  = _mm_load_si128((__m128i *) s->rank);
+    __m128i older = _mm_set1_epi8((char) s->rank[way]);
+    // younger lanes compare to -1, so subtracting ages them by one
+    rank = _mm_sub_epi8(rank, _mm_cmplt_epi8(rank, older));
+    _mm_store_si128((__m128i *) s->rank, rank);
+#else
+    uns8 older = s->rank[way];
+    for(uns i = 0; i < MAX_WAYS; i++) {
+        if(s->rank[i] < older)
+            s->rank[i]++;
+    }
+#endif
+    s->rank[way] = 0;
+}
+
+CACHE_INLINE uns cache_lru_victim(Cache_Set *s, uns num_ways){
+#if !defined(CACHE_NO_SIMD) && defined(__SSE2__)
+    __m128i rank = _mm_load_si128((__m128i *) s->rank);
+    __m128i lru  = _mm_cmpeq_epi8(rank, _mm_set1_epi8((char)(num_ways - 1)));
+    return __builtin_ctz((uns32) _mm_movemask_epi8(lru));
+#else
+    for(uns i = 0; i < num_ways; i++) {
+        if(s->rank[i] == num_ways - 1)
+            return i;
+    }
+    return 0;
+#endif
+}
+
+CACHE_INLINE void cache_tree_plru_promote(Cache_Set *s, uns way, uns num_ways){
+    uns node = way + num_ways;
+    while(node > 1) {
+        uns parent = node >> 1;
+        // point the parent away from the subtree just used
+        if(node & 1)
+            s->plru &= ~(1u << parent);
+        else
+            s->plru |= 1u << parent;
+        node = parent;
+    }
+}
+
+CACHE_INLINE uns cache_tree_plru_victim(Cache_Set *s, uns num_ways){
+    uns node = 1;
+    while(node < num_ways)
+        node = 2*node + ((s->plru >> node) & 1);
+    return node - num_ways;
+}
+
+CACHE_INLINE void cache_bit_plru_promote(Cache_Set *s, uns way, uns num_ways){
+    uns32 all_ways = (uns32)((1ULL << num_ways) - 1);
+    s->plru |= 1u << way;
+    if((s->plru & all_ways) == all_ways)
+        s->plru = 1u << way;
+}
+
+CACHE_INLINE void cache_touch(Cache_Set *s, uns way, uns num_ways, uns64 repl_policy){
+    switch(repl_policy){
+        case REPL_LRU:
+        case REPL_SWP:
+            cache_lru_promote(s, way);
+            break;
+        case REPL_TREE_PLRU:
+            cache_tree_plru_promote(s, way, num_ways);
+            break;
+        case REPL_BIT_PLRU:
+            cache_bit_plru_promote(s, way, num_ways);
+            break;
+        default:
+            break;
+    }
+}
+
+// Way victim goes from its core (if valid) to core_id: move it between
+// the two cores' counts in one pass over the set
+CACHE_INLINE void cache_swp_count(Cache_Set *s, uns victim, uns core_id, uns num_ways){
+    uns32 others = s->valid & ~(1u << victim);
+    uns old_core = s->core_id[victim];
+    Flag was_valid = (s->valid >> victim) & 1;
+    uns8 n = 1;
+
+    for(uns i = 0; i < num_ways; i++) {
+        if(!((others >> i) & 1))
+            continue;
+        if(was_valid && s->core_id[i] == old_core)
+            s->owned[i]--;
+        if(s->core_id[i] == core_id)
+            n = ++s->owned[i];
+    }
+    s->owned[victim] = n;
+}
+
+////////////////////////////////////////////////////////////////////
+// Look up tag in set s, mark the line dirty/recent on a hit and
+// update the access/miss stats. Shared by all lookup entry points.
+// The kernels below leave the stats and timestamps alone unless
+// timed is set (see cache_access_install_functional).
+////////////////////////////////////////////////////////////////////
+
+CACHE_INLINE Flag cache_probe_kernel(Cache *c, Cache_Set *s, Addr tag, uns is_write, uns core_id,
+                                     uns num_ways, uns64 repl_policy, Flag timed){
     Flag outcome=MISS;
 
-    int set = lineaddr % c->num_sets;
-    lineaddr /= c->num_sets;
-    // Your Code Goes Here
-    Cache_Line* line;
-    for(uns i = 0; i < c->num_ways; i++) {
-        line = &c->sets[set].line[i];
-        if (!line->valid) continue;
-        if(line->tag == lineaddr && line->core_id == core_id){
+    if(timed)
+        c->ffwd_valid = FALSE;
+
+    uns32 hits = cache_match_kernel(s, tag, num_ways) & s->valid;
+    uns way = 0;
+    // Lowest matching way that also belongs to this core
+    while(hits) {
+        way = __builtin_ctz(hits);
+        if(s->core_id[way] == core_id){
             outcome = HIT;
             break;
         }
+        hits &= hits - 1;
     }
 
     // If a line was found, check if write and mark as dirty
-    // Set line last access time
+    // Update the line's recency
     if(outcome == HIT){
         if (is_write == TRUE) {
-            line->dirty = TRUE;
-            ++c->stat_write_access;
-        } else
+            s->dirty |= 1u << way;
+            if(timed)
+                ++c->stat_write_access;
+        } else if(timed)
             ++c->stat_read_access;
-        line->last_access_time = cycle;
-    } else {
+        if(timed)
+            s->last_access_time[way] = c->ctx->cycle;
+        cache_touch(s, way, num_ways, repl_policy);
+    } else if(timed) {
         if (is_write == TRUE) {
             ++c->stat_write_miss;
             ++c->stat_write_access;
@@ -104,97 +434,278 @@ Flag cache_access(Cache *c, Addr lineaddr, uns is_write, uns core_id){
     return outcome;
 }
 
-////////////////////////////////////////////////////////////////////
-// Note: the system provides the cache with the line address
-// Install the line: determine victim using repl policy (LRU/RAND)
-// copy victim into last_evicted_line for tracking writebacks
-////////////////////////////////////////////////////////////////////
-
-void cache_install(Cache *c, Addr lineaddr, uns is_write, uns core_id){
-    int set = lineaddr % c->num_sets;
-    lineaddr /= c->num_sets;
-    // Find victim using cache_find_victim
-    uns victim = cache_find_victim(c, set, core_id); 
-    // Initialize the evicted entry
-    c->last_evicted_line = c->sets[set].line[victim];
-    c->last_evicted_line.tag = (c->last_evicted_line.tag * c->num_sets) + set;
-    // Initialize the victime entry
-    Cache_Line newLine;
-    newLine.core_id = core_id;
-    newLine.dirty = is_write;
-    newLine.tag = lineaddr;
-    newLine.valid = TRUE;
-    newLine.last_access_time = cycle;
-    c->sets[set].line[victim] = newLine;
-}
-
 ////////////////////////////////////////////////////////////////////
 // You may find it useful to split victim selection from install
 ////////////////////////////////////////////////////////////////////
 
-
-uns cache_find_victim(Cache *c, uns set_index, uns core_id){
+CACHE_INLINE uns cache_victim_kernel(Cache *c, Cache_Set *s, uns core_id,
+                                     uns num_ways, uns64 repl_policy, Flag timed){
     uns victim=0;
-    uns minAccessTime = 0xFFFFFFFF;
+    uns32 all_ways = (uns32)((1ULL << num_ways) - 1);
 
     // If there is space in the cache, don't need to
     // replace
-    Cache_Line* line;
-    for(uns i = 0; i < c->num_ways; i++) {
-        line = &c->sets[set_index].line[i];    
-        if(!line->valid)
-            return i;
-    }
+    if(s->valid != all_ways)
+        return __builtin_ctz(~s->valid & all_ways);
 
     // Get victim based on policy
-    switch(c->repl_policy){
-        case 0:    // LRU
-            for(uns i = 0; i < c->num_ways; i++) {
-                line = &c->sets[set_index].line[i];
-                if(line->last_access_time < minAccessTime) {
-                    victim = i;
-                    minAccessTime = line->last_access_time;
-                }
-            }
+    switch(repl_policy){
+        case REPL_LRU:
+            victim = cache_lru_victim(s, num_ways);
             break;
-        case 1:    // RAND
-            victim = rand() % c->num_ways;
+        case REPL_RAND:
+            victim = simctx_rand(c->ctx) % num_ways;
             break;
-        case 2: ;    // Static Way Partitioning
-            uns64 core0_entries = 0;
-            uns64 core1_entries = 0;
-            // Count entries for each way
-            for(uns i = 0; i < c->num_ways; i++) {
-                uns id = c->sets[set_index].line[i].core_id;
-                if(id == 0) { ++core0_entries; }
-                else { ++core1_entries; }
+        case REPL_SWP: {    // Static Way Partitioning
+            // A core under its quota takes a line from a core over its
+            // own, otherwise it replaces one of its own lines
+            uns32 own = 0, over = 0, candidates;
+            for(uns i = 0; i < num_ways; i++) {
+                if(s->core_id[i] == core_id)
+                    own |= 1u << i;
+                else if(s->owned[i] > c->swp_quota[s->core_id[i]])
+                    over |= 1u << i;
             }
-            // If one has too many allocated, choose victim from that set
-            // Calculate which core will have entry removed
-            uns victim_core = core_id;
-            uns64 SWP_CORE1_WAYS = c->num_ways - SWP_CORE0_WAYS;
-            // If a core has more entries than its quotia, choose victim from its set
-            if(core0_entries < SWP_CORE0_WAYS){
-                victim_core = 1;
-            } else if(core1_entries < SWP_CORE1_WAYS) {
-                victim_core = 0;
-            }
-            // LRU replacement
-            for(uns i = 0; i < c->num_ways; i++) {
-                line = &c->sets[set_index].line[i];
-                if(line->last_access_time < minAccessTime && line->core_id == victim_core) {
+            candidates = ((uns64) __builtin_popcount(own) < c->swp_quota[core_id]) ? over : own;
+            if(!candidates)
+                candidates = all_ways;
+            // LRU replacement among the candidates
+            int maxRank = -1;
+            for(uns i = 0; i < num_ways; i++) {
+                if(s->rank[i] > maxRank && (candidates & (1u << i))) {
                     victim = i;
-                    minAccessTime = line->last_access_time;
+                    maxRank = s->rank[i];
                 }
             }
             break;
+        }
+        case REPL_TREE_PLRU:
+            victim = cache_tree_plru_victim(s, num_ways);
+            break;
+        case REPL_BIT_PLRU:
+            victim = __builtin_ctz(~s->plru & all_ways);
+            break;
         default:
             break;
     }
 
     // Update stats
-    if(c->sets[set_index].line[victim].dirty)
+    if(timed && (s->dirty & (1u << victim)))
         ++c->stat_dirty_evicts;
     return victim;
 }
 
+////////////////////////////////////////////////////////////////////
+// Pick a victim in the set, hand the old contents back through evicted
+// (with the tag turned back into a line address) and install the line.
+////////////////////////////////////////////////////////////////////
+
+CACHE_INLINE void cache_fill_kernel(Cache *c, uns set, Addr tag, uns is_write, uns core_id,
+                                    Cache_Line *evicted,
+                                    uns64 num_sets, uns num_ways, uns64 repl_policy, Flag timed){
+    Cache_Set* s = &c->sets[set];
+    uns victim = cache_victim_kernel(c, s, core_id, num_ways, repl_policy, timed);
+    if(timed)
+        c->ffwd_valid = FALSE;
+    uns32 bit = 1u << victim;
+    // Initialize the evicted entry
+    evicted->valid = (s->valid & bit) != 0;
+    evicted->dirty = (s->dirty & bit) != 0;
+    evicted->tag = (s->tag[victim] * num_sets) + set;
+    evicted->core_id = s->core_id[victim];
+    evicted->last_access_time = timed ? s->last_access_time[victim] : 0;
+    // Initialize the victim entry
+    if(repl_policy == REPL_SWP)
+        cache_swp_count(s, victim, core_id, num_ways);
+    s->tag[victim] = tag;
+    s->core_id[victim] = core_id;
+    s->valid |= bit;
+    if(timed)
+        s->last_access_time[victim] = c->ctx->cycle;
+    cache_touch(s, victim, num_ways, repl_policy);
+    if(is_write)
+        s->dirty |= bit;
+    else
+        s->dirty &= ~bit;
+}
+
+////////////////////////////////////////////////////////////////////
+// Body of every cache_access_install() engine
+////////////////////////////////////////////////////////////////////
+
+CACHE_INLINE Flag cache_engine_kernel(Cache *c, Addr lineaddr, uns is_write, uns core_id,
+                                      Cache_Line *evicted,
+                                      uns64 num_sets, uns num_ways, uns64 repl_policy, Flag timed){
+    uns set = lineaddr % num_sets;
+    Addr tag = lineaddr / num_sets;
+
+    if(cache_probe_kernel(c, &c->sets[set], tag, is_write, core_id, num_ways, repl_policy, timed) == HIT){
+        evicted->valid = FALSE;
+        return HIT;
+    }
+
+    cache_fill_kernel(c, set, tag, is_write, core_id, evicted, num_sets, num_ways, repl_policy, timed);
+    return MISS;
+}
+
+////////////////////////////////////////////////////////////////////
+// Note: the system provides the cache with the line address
+// Return HIT if access hits in the cache, MISS otherwise 
+// Also if is_write is TRUE, then mark the resident line as dirty
+// Update appropriate stats
+////////////////////////////////////////////////////////////////////
+
+Flag cache_access(Cache *c, Addr lineaddr, uns is_write, uns core_id){
+    uns set = lineaddr % c->num_sets;
+    return cache_probe_kernel(c, &c->sets[set], lineaddr / c->num_sets, is_write, core_id,
+                              c->num_ways, c->repl_policy, TRUE);
+}
+
+////////////////////////////////////////////////////////////////////
+// Whether the core's line is in the cache (or on its way, as the tag
+// goes in at the miss). Neither the stats nor the recency change.
+////////////////////////////////////////////////////////////////////
+
+Flag cache_holds(Cache *c, Addr lineaddr, uns core_id){
+    Cache_Set *s = &c->sets[lineaddr % c->num_sets];
+    uns32 hits = cache_match_tags(s, lineaddr / c->num_sets, c->num_ways) & s->valid;
+
+    while(hits){
+        if(s->core_id[__builtin_ctz(hits)] == core_id){
+            return TRUE;
+        }
+        hits &= hits - 1;
+    }
+    return FALSE;
+}
+
+////////////////////////////////////////////////////////////////////
+// Note: the system provides the cache with the line address
+// Install the line: determine victim using repl policy (LRU/RAND)
+// copy victim into evicted for tracking writebacks
+////////////////////////////////////////////////////////////////////
+
+void cache_install(Cache *c, Addr lineaddr, uns is_write, uns core_id, Cache_Line *evicted){
+    uns set = lineaddr % c->num_sets;
+    cache_fill_kernel(c, set, lineaddr / c->num_sets, is_write, core_id, evicted,
+                      c->num_sets, c->num_ways, c->repl_policy, TRUE);
+}
+
+////////////////////////////////////////////////////////////////////
+// cache_access followed by cache_install on a miss, with the set
+// index and tag computed once. evicted->valid is FALSE on a hit or
+// when the line went into an empty way.
+////////////////////////////////////////////////////////////////////
+
+Flag cache_access_install(Cache *c, Addr lineaddr, uns is_write, uns core_id, Cache_Line *evicted){
+    return c->engine(c, lineaddr, is_write, core_id, evicted);
+}
+
+////////////////////////////////////////////////////////////////////
+// Same tag, dirty and replacement state changes as
+// cache_access_install, for functional fast-forward: no stats, no
+// timestamps, and evicted->last_access_time is 0. Touching the line
+// this path touched last again changes nothing (it is already the most
+// recent one under every policy), so that is a hit without a lookup
+// unless it is the first write to the line.
+////////////////////////////////////////////////////////////////////
+
+Flag cache_access_install_functional(Cache *c, Addr lineaddr, uns is_write, uns core_id, Cache_Line *evicted){
+    if(c->ffwd_valid && c->ffwd_lineaddr == lineaddr && c->ffwd_core_id == core_id &&
+       (c->ffwd_dirty || !is_write)){
+        evicted->valid = FALSE;
+        return HIT;
+    }
+
+    Flag result = c->engine_functional(c, lineaddr, is_write, core_id, evicted);
+    c->ffwd_valid    = TRUE;
+    c->ffwd_dirty    = is_write;
+    c->ffwd_lineaddr = lineaddr;
+    c->ffwd_core_id  = core_id;
+    return result;
+}
+
+uns cache_find_victim(Cache *c, uns set_index, uns core_id){
+    return cache_victim_kernel(c, &c->sets[set_index], core_id, c->num_ways, c->repl_policy, TRUE);
+}
+
+////////////////////////////////////////////////////////////////////
+// Engines: the generic one reads the geometry from the Cache, the
+// others are instantiated for the common L1 (32KB/8-way) and L2
+// (512KB-8MB/16-way) shapes at 64B lines, for each implemented policy.
+// Each comes as a timed engine and a functional one (_f).
+////////////////////////////////////////////////////////////////////
+
+static Flag cache_engine_generic(Cache *c, Addr lineaddr, uns is_write, uns core_id,
+                                 Cache_Line *evicted){
+    return cache_engine_kernel(c, lineaddr, is_write, core_id, evicted,
+                               c->num_sets, c->num_ways, c->repl_policy, TRUE);
+}
+
+static Flag cache_engine_generic_f(Cache *c, Addr lineaddr, uns is_write, uns core_id,
+                                   Cache_Line *evicted){
+    return cache_engine_kernel(c, lineaddr, is_write, core_id, evicted,
+                               c->num_sets, c->num_ways, c->repl_policy, FALSE);
+}
+
+#define CACHE_ENGINE(SETS, WAYS, POLICY)                                               \
+static Flag cache_engine_##SETS##x##WAYS##_##POLICY(Cache *c, Addr lineaddr, uns is_write, \
+                                                    uns core_id, Cache_Line *evicted){   \
+    return cache_engine_kernel(c, lineaddr, is_write, core_id, evicted, SETS, WAYS, POLICY, TRUE); \
+}                                                                                        \
+static Flag cache_engine_##SETS##x##WAYS##_##POLICY##_f(Cache *c, Addr lineaddr, uns is_write, \
+                                                        uns core_id, Cache_Line *evicted){ \
+    return cache_engine_kernel(c, lineaddr, is_write, core_id, evicted, SETS, WAYS, POLICY, FALSE); \
+}
+
+#define CACHE_ENGINES(SETS, WAYS) \
+    CACHE_ENGINE(SETS, WAYS, 0)   \
+    CACHE_ENGINE(SETS, WAYS, 1)   \
+    CACHE_ENGINE(SETS, WAYS, 2)   \
+    CACHE_ENGINE(SETS, WAYS, 4)   \
+    CACHE_ENGINE(SETS, WAYS, 5)
+
+#define CACHE_ENGINE_ENTRIES(SETS, WAYS)            \
+    { SETS, WAYS, 0, cache_engine_##SETS##x##WAYS##_0, cache_engine_##SETS##x##WAYS##_0_f }, \
+    { SETS, WAYS, 1, cache_engine_##SETS##x##WAYS##_1, cache_engine_##SETS##x##WAYS##_1_f }, \
+    { SETS, WAYS, 2, cache_engine_##SETS##x##WAYS##_2, cache_engine_##SETS##x##WAYS##_2_f }, \
+    { SETS, WAYS, 4, cache_engine_##SETS##x##WAYS##_4, cache_engine_##SETS##x##WAYS##_4_f }, \
+    { SETS, WAYS, 5, cache_engine_##SETS##x##WAYS##_5, cache_engine_##SETS##x##WAYS##_5_f },
+
+CACHE_ENGINES(64, 8)     // 32KB L1
+CACHE_ENGINES(256, 16)   // 1MB L2 in 4 slices
+CACHE_ENGINES(512, 16)   // 512KB L2
+CACHE_ENGINES(1024, 16)  // 1MB L2
+CACHE_ENGINES(2048, 16)  // 2MB L2
+CACHE_ENGINES(4096, 16)  // 4MB L2
+CACHE_ENGINES(8192, 16)  // 8MB L2
+
+static const struct {
+    uns64        num_sets;
+    uns64        num_ways;
+    uns64        repl_policy;
+    Cache_Engine engine;
+    Cache_Engine engine_functional;
+} cache_engines[] = {
+    CACHE_ENGINE_ENTRIES(64, 8)
+    CACHE_ENGINE_ENTRIES(256, 16)
+    CACHE_ENGINE_ENTRIES(512, 16)
+    CACHE_ENGINE_ENTRIES(1024, 16)
+    CACHE_ENGINE_ENTRIES(2048, 16)
+    CACHE_ENGINE_ENTRIES(4096, 16)
+    CACHE_ENGINE_ENTRIES(8192, 16)
+};
+
+static void cache_select_engines(Cache *c){
+    for(uns i = 0; i < sizeof(cache_engines)/sizeof(cache_engines[0]); i++) {
+        if(cache_engines[i].num_sets == c->num_sets &&
+           cache_engines[i].num_ways == c->num_ways &&
+           cache_engines[i].repl_policy == c->repl_policy) {
+            c->engine            = cache_engines[i].engine;
+            c->engine_functional = cache_engines[i].engine_functional;
+            return;
+        }
+    }
+    c->engine            = cache_engine_generic;
+    c->engine_functional = cache_engine_generic_f;
+}
@@ -2,39 +2,83 @@
 #define CACHE_H
 
 #include "types.h"
+#include "simctx.h"
 
 #define MAX_WAYS 16
 
+// Replacement policies, values as given to -repl and -L2repl
+typedef enum Repl_Policy_Enum {
+    REPL_LRU=0,        // true LRU from a per-set rank vector
+    REPL_RAND=1,
+    REPL_SWP=2,        // static way partitioning, LRU within the quota
+    REPL_UCP=3,        // reserved for Part F
+    REPL_TREE_PLRU=4,  // binary tree pseudo-LRU, power-of-2 ways only
+    REPL_BIT_PLRU=5,   // one MRU bit per way
+} Repl_Policy;
+
 typedef struct Cache_Line Cache_Line;
 typedef struct Cache_Set Cache_Set;
+typedef struct Cache_MSHR Cache_MSHR;
 typedef struct Cache Cache;
 
+// One cache_access_install() implementation, see cache_select_engines()
+typedef Flag (*Cache_Engine)(Cache *c, Addr lineaddr, uns is_write, uns core_id, Cache_Line *evicted);
+
 //////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////
 
 
+// Unpacked view of one way, used to hand evicted lines back to memsys
 struct Cache_Line {
     Flag    valid;
     Flag    dirty;
     Addr    tag;
     uns     core_id;
-    uns    last_access_time; // for LRU
+    uns64   last_access_time;
    // Note: No data as we are only estimating hit/miss 
 };
 
 
+// Tag store is kept as structure-of-arrays so that a lookup compares
+// all ways of a set against the tag at once (see cache_match_tags)
 struct Cache_Set {
-    Cache_Line line[MAX_WAYS];
+    Addr    tag[MAX_WAYS];
+    uns     core_id[MAX_WAYS];
+    uns64   last_access_time[MAX_WAYS];
+    uns8    rank[MAX_WAYS]; // REPL_LRU/SWP: 0 is MRU, num_ways-1 is LRU
+    uns8    owned[MAX_WAYS]; // REPL_SWP: valid ways of the set held by this way's core
+    uns32   plru;  // REPL_TREE_PLRU: node bits, REPL_BIT_PLRU: MRU bits
+    uns32   valid; // bit i set if way i holds a line
+    uns32   dirty; // bit i set if way i has been written
+} __attribute__((aligned(64)));
+
+
+// Miss status holding register: a line on its way in, see cache_mshr_issue()
+struct Cache_MSHR {
+    Addr    lineaddr;
+    uns64   ready_cycle; // the fill arrives, the entry is free from then on
 };
 
 
 struct Cache{
+  SimContext *ctx; // clock for LRU timestamps, RAND state, SWP quota
   uns64 num_sets;
   uns64 num_ways;
   uns64 repl_policy;
   
   Cache_Set *sets;
-  Cache_Line last_evicted_line; // for checking writebacks
+  Cache_Engine engine; // geometry/policy specialized lookup-or-install
+  Cache_Engine engine_functional; // same, without stats or timestamps
+  uns64 *swp_quota;    // REPL_SWP: ways each core may fill, see cache_swp_quota
+  Cache_MSHR *mshr;    // num_mshrs, none for a blocking cache
+  uns64 num_mshrs;
+
+  // the line the functional path touched last, valid until any timed
+  // access (see cache_access_install_functional)
+  Flag  ffwd_valid;
+  Flag  ffwd_dirty;
+  Addr  ffwd_lineaddr;
+  uns   ffwd_core_id;
 
   //stats
   uns64 stat_read_access; 
@@ -42,19 +86,38 @@ struct Cache{
   uns64 stat_read_miss; 
   uns64 stat_write_miss; 
   uns64 stat_dirty_evicts; // how many dirty lines were evicted?
+  uns64 stat_mshr_alloc;   // primary misses
+  uns64 stat_mshr_merge;   // secondary misses to a line already in an MSHR
+  uns64 stat_mshr_full;    // primary misses that waited for a free MSHR
+  uns64 stat_mshr_occupancy; // busy MSHRs summed over the primary misses
 };
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////
 
-Cache  *cache_new(uns64 size, uns64 assocs, uns64 linesize, uns64 repl_policy);
+Cache  *cache_new(SimContext *ctx, uns64 size, uns64 assocs, uns64 linesize, uns64 repl_policy);
+void    cache_free(Cache *c);
+void    cache_reset_stats(Cache *c);
 Flag    cache_access         (Cache *c, Addr lineaddr, uns is_write, uns core_id);
-void    cache_install        (Cache *c, Addr lineaddr, uns is_write, uns core_id);
+Flag    cache_holds          (Cache *c, Addr lineaddr, uns core_id);
+void    cache_install        (Cache *c, Addr lineaddr, uns is_write, uns core_id, Cache_Line *evicted);
+Flag    cache_access_install (Cache *c, Addr lineaddr, uns is_write, uns core_id, Cache_Line *evicted);
+Flag    cache_access_install_functional(Cache *c, Addr lineaddr, uns is_write, uns core_id, Cache_Line *evicted);
 void    cache_print_stats    (Cache *c, char *header);
 
+void    cache_mshr_init      (Cache *c, uns64 num_mshrs);
+uns64   cache_mshr_find      (Cache *c, Addr lineaddr, uns64 cycle);
+uns64   cache_mshr_free_cycle(Cache *c, uns64 cycle);
+uns64   cache_mshr_issue     (Cache *c, uns64 cycle);
+void    cache_mshr_fill      (Cache *c, Addr lineaddr, uns64 cycle, uns64 ready_cycle);
+void    cache_print_mshr_stats(Cache *c, char *header);
+
 uns     cache_find_victim    (Cache *c, uns set_index, uns core_id);
 
+uns32   cache_match_tags       (Cache_Set *set, Addr tag, uns num_ways);
+uns32   cache_match_tags_scalar(Cache_Set *set, Addr tag, uns num_ways);
+
 //////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////
 
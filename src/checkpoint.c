@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+
+#define CKPT_MAX_CACHES  (2 + MAX_L2_SLICES + 2*MAX_CORES)
+
+typedef struct Ckpt_Memsys Ckpt_Memsys;
+typedef struct Ckpt_Cache  Ckpt_Cache;
+typedef struct Ckpt_Dram   Ckpt_Dram;
+typedef struct Ckpt_Core   Ckpt_Core;
+typedef struct Ckpt_Slice  Ckpt_Slice;
+
+struct Ckpt_Memsys {
+  uns64 stat_ifetch_access;
+  uns64 stat_load_access;
+  uns64 stat_store_access;
+  uns64 stat_ifetch_delay;
+  uns64 stat_load_delay;
+  uns64 stat_store_delay;
+};
+
+struct Ckpt_Core {
+  uns64 done;
+  uns64 trace_inst_addr;
+  uns64 trace_inst_type;
+  uns64 trace_ldst_addr;
+  uns64 trace_num_read;
+  uns64 snooze_end_cycle;
+  uns64 inst_count;
+  uns64 done_inst_count;
+  uns64 done_cycle_count;
+  uns64 load_ready[MAX_LOAD_DEP];
+  uns64 load_pos;
+  uns64 stat_mshr_stall;
+  uns64 stat_dep_stall;
+  uns64 rob_head;
+  uns64 rob_count;
+  uns64 lq_count;
+  uns64 sq_count;
+  uns64 pending_loads;
+  uns64 next_seq;
+  uns64 load_seq[MAX_LOAD_DEP];
+  uns64 fetch_resume;
+  uns64 fetch_done;
+  uns64 last_cycle;
+  uns64 dispatch_stall;
+  uns64 stat_stall[NUM_CORE_STALLS];
+  uns64 ffwd_inst_count;
+};
+
+// followed by the row buffers, the banks and the channels
+struct Ckpt_Dram {
+  Dram_Ctrl ctrl;
+  uns64 stat_read_access;
+  uns64 stat_write_access;
+  uns64 stat_read_delay;
+  uns64 stat_write_delay;
+  uns64 stat_row_state[2][NUM_DRAM_ROW_STATES];
+};
+
+struct Ckpt_Slice {
+  uns64 port_free;
+  uns64 last_arrival;
+  uns64 stat_access;
+  uns64 stat_hops;
+  uns64 stat_conflicts;
+  uns64 stat_queue_delay;
+};
+
+struct Ckpt_Cache {
+  uns64 num_sets;
+  uns64 num_ways;
+  uns64 repl_policy;
+  uns64 stat_read_access;
+  uns64 stat_write_access;
+  uns64 stat_read_miss;
+  uns64 stat_write_miss;
+  uns64 stat_dirty_evicts;
+  uns64 num_mshrs;
+  uns64 stat_mshr_alloc;
+  uns64 stat_mshr_merge;
+  uns64 stat_mshr_full;
+  uns64 stat_mshr_occupancy;
+};
+
+static uns   ckpt_caches(Memsys *sys, Cache **cache);
+static void  ckpt_put(FILE *fp, void *data, uns64 size, uns64 *pos);
+static void *ckpt_get(uns8 *map, uns64 map_size, uns64 size, uns64 *pos);
+static void  ckpt_check_config(SimContext *ctx, SimContext *saved);
+
+
+////////////////////////////////////////////////////////////////////
+// Sections follow the header in a fixed order, each padded to
+// CKPT_ALIGN: context, memsys stats, caches, L2 slice ports, DRAM,
+// cores.
+////////////////////////////////////////////////////////////////////
+
+void sim_checkpoint(Sim *sim, char *fname)
+{
+  Memsys     *sys = sim->memsys;
+  Cache      *cache[CKPT_MAX_CACHES];
+  Ckpt_Header hdr;
+  uns64       pos = 0;
+  uns         num_caches = ckpt_caches(sys, cache);
+  uns         ii;
+  FILE       *fp;
+
+  if ((fp = fopen(fname, "wb")) == NULL){
+    die_message("Unable to create the checkpoint file");
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic               = CKPT_MAGIC;
+  hdr.version             = CKPT_VERSION;
+  hdr.sizeof_ctx          = sizeof(SimContext);
+  hdr.sizeof_cache_set    = sizeof(Cache_Set);
+  hdr.num_caches          = num_caches;
+  hdr.last_printdot_cycle = sim->last_printdot_cycle;
+  ckpt_put(fp, &hdr, sizeof(hdr), &pos);
+
+  ckpt_put(fp, &sim->ctx, sizeof(SimContext), &pos);
+  {
+    Ckpt_Memsys cm = { sys->stat_ifetch_access, sys->stat_load_access, sys->stat_store_access,
+		       sys->stat_ifetch_delay, sys->stat_load_delay, sys->stat_store_delay };
+    ckpt_put(fp, &cm, sizeof(cm), &pos);
+  }
+
+  for(ii=0; ii<num_caches; ii++){
+    Cache     *c = cache[ii];
+    Ckpt_Cache cc = { c->num_sets, c->num_ways, c->repl_policy,
+		      c->stat_read_access, c->stat_write_access, c->stat_read_miss,
+		      c->stat_write_miss, c->stat_dirty_evicts, c->num_mshrs,
+		      c->stat_mshr_alloc, c->stat_mshr_merge, c->stat_mshr_full,
+		      c->stat_mshr_occupancy };
+    ckpt_put(fp, &cc, sizeof(cc), &pos);
+    ckpt_put(fp, c->sets, c->num_sets * sizeof(Cache_Set), &pos);
+    ckpt_put(fp, c->mshr, c->num_mshrs * sizeof(Cache_MSHR), &pos);
+  }
+
+  for(ii=0; ii<sys->num_l2_slices; ii++){
+    L2_Slice  *s = &sys->l2slice[ii];
+    Ckpt_Slice cs = { s->port_free, s->last_arrival, s->stat_access,
+		      s->stat_hops, s->stat_conflicts, s->stat_queue_delay };
+    ckpt_put(fp, &cs, sizeof(cs), &pos);
+  }
+
+  if(sys->dram){
+    DRAM     *dram = sys->dram;
+    Ckpt_Dram cd;
+    cd.ctrl              = dram->ctrl;
+    cd.stat_read_access  = dram->stat_read_access;
+    cd.stat_write_access = dram->stat_write_access;
+    cd.stat_read_delay   = dram->stat_read_delay;
+    cd.stat_write_delay  = dram->stat_write_delay;
+    memcpy(cd.stat_row_state, dram->stat_row_state, sizeof(cd.stat_row_state));
+    ckpt_put(fp, &cd, sizeof(cd), &pos);
+    ckpt_put(fp, dram->perbank_row_buf, dram->num_banks * sizeof(Rowbuf_Entry), &pos);
+    ckpt_put(fp, dram->ctrl.bank, dram->num_banks * sizeof(Dram_Bank), &pos);
+    ckpt_put(fp, dram->ctrl.rank, dram->num_banks / sim->ctx.dram_banks * sizeof(Dram_Rank), &pos);
+    ckpt_put(fp, dram->ctrl.channel, sim->ctx.dram_channels * sizeof(Dram_Channel), &pos);
+  }
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    Core     *c = sim->core[ii];
+    Ckpt_Core cc = { c->done, c->trace_inst_addr, c->trace_inst_type, c->trace_ldst_addr,
+		     c->trace->num_read, c->snooze_end_cycle, c->inst_count,
+		     c->done_inst_count, c->done_cycle_count, {0}, c->load_pos,
+		     c->stat_mshr_stall, c->stat_dep_stall, c->rob_head, c->rob_count,
+		     c->lq_count, c->sq_count, c->pending_loads, c->next_seq, {0},
+		     c->fetch_resume, c->fetch_done, c->last_cycle, c->dispatch_stall, {0},
+		     c->ffwd_inst_count };
+    memcpy(cc.load_ready, c->load_ready, sizeof(cc.load_ready));
+    memcpy(cc.load_seq, c->load_seq, sizeof(cc.load_seq));
+    memcpy(cc.stat_stall, c->stat_stall, sizeof(cc.stat_stall));
+    ckpt_put(fp, &cc, sizeof(cc), &pos);
+    if(c->rob){
+      ckpt_put(fp, c->rob, sim->ctx.rob_size * sizeof(Rob_Entry), &pos);
+    }
+  }
+
+  // patch the size in, so a truncated file is caught on restore
+  hdr.file_size = pos;
+  if(fseek(fp, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, fp) != 1 || fclose(fp)){
+    die_message("Unable to write the checkpoint file");
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// The Sim must come from sim_new with the checkpoint's geometry and
+// traces and must not have stepped yet. The whole file is mapped
+// once and copied into place section by section.
+////////////////////////////////////////////////////////////////////
+
+void sim_restore(Sim *sim, char *fname)
+{
+  Memsys      *sys = sim->memsys;
+  Cache       *cache[CKPT_MAX_CACHES];
+  Ckpt_Header *hdr;
+  SimContext  *saved;
+  uns64        pos = 0;
+  Ckpt_Memsys *cm;
+  uns          num_caches = ckpt_caches(sys, cache);
+  uns          ii;
+  struct stat  st;
+  uns8        *map;
+  int          fd;
+
+  if((fd = open(fname, O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    die_message("Unable to open the checkpoint file");
+  }
+  map = (uns8 *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED){
+    die_message("Unable to mmap the checkpoint file");
+  }
+
+  hdr = (Ckpt_Header *) ckpt_get(map, st.st_size, sizeof(Ckpt_Header), &pos);
+  if(hdr->magic != CKPT_MAGIC || hdr->version != CKPT_VERSION ||
+     hdr->sizeof_ctx != sizeof(SimContext) || hdr->sizeof_cache_set != sizeof(Cache_Set)){
+    die_message("Checkpoint was written by an incompatible simulator");
+  }
+  if(hdr->file_size != (uns64) st.st_size || hdr->num_caches != num_caches){
+    die_message("Checkpoint is truncated or does not match this memory system");
+  }
+
+  saved = (SimContext *) ckpt_get(map, st.st_size, sizeof(SimContext), &pos);
+  ckpt_check_config(&sim->ctx, saved);
+  sim->ctx.cycle      = saved->cycle;
+  sim->ctx.stat_cycle = saved->stat_cycle;
+  sim->ctx.rand_pos   = saved->rand_pos;
+  memcpy(sim->ctx.rand_state, saved->rand_state, sizeof(saved->rand_state));
+  sim->last_printdot_cycle = hdr->last_printdot_cycle;
+
+  cm = (Ckpt_Memsys *) ckpt_get(map, st.st_size, sizeof(Ckpt_Memsys), &pos);
+  sys->stat_ifetch_access = cm->stat_ifetch_access;
+  sys->stat_load_access   = cm->stat_load_access;
+  sys->stat_store_access  = cm->stat_store_access;
+  sys->stat_ifetch_delay  = cm->stat_ifetch_delay;
+  sys->stat_load_delay    = cm->stat_load_delay;
+  sys->stat_store_delay   = cm->stat_store_delay;
+
+  for(ii=0; ii<num_caches; ii++){
+    Cache      *c  = cache[ii];
+    Ckpt_Cache *cc = (Ckpt_Cache *) ckpt_get(map, st.st_size, sizeof(Ckpt_Cache), &pos);
+    if(cc->num_sets != c->num_sets || cc->num_ways != c->num_ways || cc->num_mshrs != c->num_mshrs){
+      die_message("Checkpoint cache geometry does not match");
+    }
+    c->stat_read_access  = cc->stat_read_access;
+    c->stat_write_access = cc->stat_write_access;
+    c->stat_read_miss    = cc->stat_read_miss;
+    c->stat_write_miss   = cc->stat_write_miss;
+    c->stat_dirty_evicts = cc->stat_dirty_evicts;
+    c->stat_mshr_alloc     = cc->stat_mshr_alloc;
+    c->stat_mshr_merge     = cc->stat_mshr_merge;
+    c->stat_mshr_full      = cc->stat_mshr_full;
+    c->stat_mshr_occupancy = cc->stat_mshr_occupancy;
+    memcpy(c->sets, ckpt_get(map, st.st_size, c->num_sets * sizeof(Cache_Set), &pos),
+	   c->num_sets * sizeof(Cache_Set));
+    c->ffwd_valid = FALSE;
+    if(c->num_mshrs){
+      memcpy(c->mshr, ckpt_get(map, st.st_size, c->num_mshrs * sizeof(Cache_MSHR), &pos),
+	     c->num_mshrs * sizeof(Cache_MSHR));
+    }
+  }
+
+  for(ii=0; ii<sys->num_l2_slices; ii++){
+    L2_Slice   *s  = &sys->l2slice[ii];
+    Ckpt_Slice *cs = (Ckpt_Slice *) ckpt_get(map, st.st_size, sizeof(Ckpt_Slice), &pos);
+    s->port_free        = cs->port_free;
+    s->last_arrival     = cs->last_arrival;
+    s->stat_access      = cs->stat_access;
+    s->stat_hops        = cs->stat_hops;
+    s->stat_conflicts   = cs->stat_conflicts;
+    s->stat_queue_delay = cs->stat_queue_delay;
+  }
+
+  if(sys->dram){
+    DRAM         *dram    = sys->dram;
+    Dram_Bank    *bank    = dram->ctrl.bank;
+    Dram_Rank    *rank    = dram->ctrl.rank;
+    Dram_Channel *channel = dram->ctrl.channel;
+    Ckpt_Dram    *cd      = (Ckpt_Dram *) ckpt_get(map, st.st_size, sizeof(Ckpt_Dram), &pos);
+    dram->ctrl              = cd->ctrl;
+    dram->ctrl.bank         = bank;
+    dram->ctrl.rank         = rank;
+    dram->ctrl.channel      = channel;
+    dram->stat_read_access  = cd->stat_read_access;
+    dram->stat_write_access = cd->stat_write_access;
+    dram->stat_read_delay   = cd->stat_read_delay;
+    dram->stat_write_delay  = cd->stat_write_delay;
+    memcpy(dram->stat_row_state, cd->stat_row_state, sizeof(cd->stat_row_state));
+    memcpy(dram->perbank_row_buf, ckpt_get(map, st.st_size, dram->num_banks * sizeof(Rowbuf_Entry), &pos),
+	   dram->num_banks * sizeof(Rowbuf_Entry));
+    memcpy(bank, ckpt_get(map, st.st_size, dram->num_banks * sizeof(Dram_Bank), &pos),
+	   dram->num_banks * sizeof(Dram_Bank));
+    memcpy(rank, ckpt_get(map, st.st_size, dram->num_banks / sim->ctx.dram_banks * sizeof(Dram_Rank), &pos),
+	   dram->num_banks / sim->ctx.dram_banks * sizeof(Dram_Rank));
+    memcpy(channel, ckpt_get(map, st.st_size, sim->ctx.dram_channels * sizeof(Dram_Channel), &pos),
+	   sim->ctx.dram_channels * sizeof(Dram_Channel));
+  }
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    Core      *c  = sim->core[ii];
+    Ckpt_Core *cc = (Ckpt_Core *) ckpt_get(map, st.st_size, sizeof(Ckpt_Core), &pos);
+
+    if(c->trace->num_read > cc->trace_num_read){
+      die_message("Checkpoint can only be restored into a Sim that has not run");
+    }
+    trace_skip(c->trace, cc->trace_num_read - c->trace->num_read);
+    if(c->trace->num_read != cc->trace_num_read){
+      die_message("Trace ends before the checkpoint position");
+    }
+    c->done             = cc->done;
+    c->trace_inst_addr  = cc->trace_inst_addr;
+    c->trace_inst_type  = cc->trace_inst_type;
+    c->trace_ldst_addr  = cc->trace_ldst_addr;
+    c->snooze_end_cycle = cc->snooze_end_cycle;
+    c->inst_count       = cc->inst_count;
+    c->ffwd_inst_count  = cc->ffwd_inst_count;
+    c->done_inst_count  = cc->done_inst_count;
+    c->done_cycle_count = cc->done_cycle_count;
+    c->load_pos         = cc->load_pos;
+    c->stat_mshr_stall  = cc->stat_mshr_stall;
+    c->stat_dep_stall   = cc->stat_dep_stall;
+    memcpy(c->load_ready, cc->load_ready, sizeof(c->load_ready));
+    c->rob_head         = cc->rob_head;
+    c->rob_count        = cc->rob_count;
+    c->lq_count         = cc->lq_count;
+    c->sq_count         = cc->sq_count;
+    c->pending_loads    = cc->pending_loads;
+    c->next_seq         = cc->next_seq;
+    c->fetch_resume     = cc->fetch_resume;
+    c->fetch_done       = cc->fetch_done;
+    c->last_cycle       = cc->last_cycle;
+    c->dispatch_stall   = cc->dispatch_stall;
+    memcpy(c->load_seq, cc->load_seq, sizeof(c->load_seq));
+    memcpy(c->stat_stall, cc->stat_stall, sizeof(c->stat_stall));
+    if(c->rob){
+      memcpy(c->rob, ckpt_get(map, st.st_size, sim->ctx.rob_size * sizeof(Rob_Entry), &pos),
+	     sim->ctx.rob_size * sizeof(Rob_Entry));
+    }
+  }
+
+  // a checkpoint taken on the last cycle must not step again
+  sim->done = TRUE;
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    sim->done &= sim->core[ii]->done;
+  }
+
+  munmap(map, st.st_size);
+}
+
+////////////////////////////////////////////////////////////////////
+// Every cache of the memory system, in a fixed order
+////////////////////////////////////////////////////////////////////
+
+static uns ckpt_caches(Memsys *sys, Cache **cache)
+{
+  uns num = 0;
+  uns ii;
+
+  if(sys->dcache)  cache[num++] = sys->dcache;
+  if(sys->icache)  cache[num++] = sys->icache;
+
+  for(ii=0; ii<sys->num_l2_slices; ii++){
+    cache[num++] = sys->l2slice[ii].cache;
+  }
+
+  for(ii=0; ii<sys->ctx->num_cores && sys->dcache_coreid; ii++){
+    cache[num++] = sys->dcache_coreid[ii];
+    cache[num++] = sys->icache_coreid[ii];
+  }
+
+  return num;
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+static void ckpt_put(FILE *fp, void *data, uns64 size, uns64 *pos)
+{
+  static const uns8 zero[CKPT_ALIGN] = {0};
+  uns64 pad = (CKPT_ALIGN - (size % CKPT_ALIGN)) % CKPT_ALIGN;
+
+  if(fwrite(data, 1, size, fp) != size || fwrite(zero, 1, pad, fp) != pad){
+    die_message("Unable to write the checkpoint file");
+  }
+  *pos += size + pad;
+}
+
+static void *ckpt_get(uns8 *map, uns64 map_size, uns64 size, uns64 *pos)
+{
+  uns64 pad = (CKPT_ALIGN - (size % CKPT_ALIGN)) % CKPT_ALIGN;
+  void *data = map + *pos;
+
+  if(*pos + size > map_size){
+    die_message("Checkpoint is truncated");
+  }
+  *pos += size + pad;
+  return data;
+}
+
+////////////////////////////////////////////////////////////////////
+// Options that shape the state must match the checkpoint. The rest
+// (SWP quota, idle skipping, output) may differ between experiments
+// forked from the same checkpoint.
+////////////////////////////////////////////////////////////////////
+
+static void ckpt_check_config(SimContext *ctx, SimContext *saved)
+{
+  if(ctx->sim_mode       != saved->sim_mode       ||
+     ctx->cache_linesize != saved->cache_linesize ||
+     ctx->repl_policy    != saved->repl_policy    ||
+     ctx->dcache_size    != saved->dcache_size    ||
+     ctx->dcache_assoc   != saved->dcache_assoc   ||
+     ctx->icache_size    != saved->icache_size    ||
+     ctx->icache_assoc   != saved->icache_assoc   ||
+     ctx->l2cache_size   != saved->l2cache_size   ||
+     ctx->l2cache_assoc  != saved->l2cache_assoc  ||
+     ctx->l2cache_repl   != saved->l2cache_repl   ||
+     ctx->l2_slices      != saved->l2_slices      ||
+     ctx->dram_channels  != saved->dram_channels  ||
+     ctx->dram_ranks     != saved->dram_ranks     ||
+     ctx->dram_banks     != saved->dram_banks     ||
+     ctx->dram_rowbuf_size != saved->dram_rowbuf_size ||
+     memcmp(ctx->dram_map, saved->dram_map, sizeof(ctx->dram_map)) ||
+     ctx->dram_xor       != saved->dram_xor       ||
+     ctx->num_cores      != saved->num_cores      ||
+     ctx->core_model     != saved->core_model     ||
+     (ctx->core_model && ctx->rob_size != saved->rob_size)){
+    die_message("Checkpoint was taken with a different mode, cache or DRAM geometry or core model");
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "types.h"
+#include "memsim.h"
+
+#define CKPT_MAGIC    0x54504b43  // "CKPT" on disk
+#define CKPT_VERSION  12
+#define CKPT_ALIGN    64          // every section starts on this boundary
+
+//////////////////////////////////////////////////////////////////
+// Snapshot of a Sim between two steps: configuration, clock and
+// random state, every cache set array with its stats, the DRAM row
+// buffers, the memsys and core counters and how far each core has
+// read its trace. Restoring into a Sim built with the same geometry
+// continues exactly where the checkpointed run was.
+//////////////////////////////////////////////////////////////////
+
+typedef struct Ckpt_Header Ckpt_Header;
+
+struct Ckpt_Header {
+  uns32 magic;
+  uns32 version;
+  uns64 file_size;
+  uns64 sizeof_ctx;       // layout checks, the file is only read back
+  uns64 sizeof_cache_set; // by a build with the same structures
+  uns64 num_caches;
+  uns64 last_printdot_cycle;
+};
+
+//////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+void   sim_checkpoint(Sim *sim, char *fname);
+void   sim_restore   (Sim *sim, char *fname);
+
+//////////////////////////////////////////////////////////////////
+
+#endif // CHECKPOINT_H
@@ -7,20 +7,27 @@
 
 #include "core.h"
 
-extern uns64 cycle;
-
 extern void die_message(const char * msg);
 
+static void core_init_model(Core *c);
+static Flag core_load_wait(Core *c);
+static void core_cycle_ooo(Core *c);
+static void core_finish(Core *c);
+static void core_ooo_ffwd_head(Core *c);
+
 
 ////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////
 
-Core *core_new(Memsys *memsys, char *trace_fname, uns core_id)
+Core *core_new(SimContext *ctx, Memsys *memsys, char *trace_fname, uns core_id)
 {
   Core *c = (Core *) calloc (1, sizeof (Core));
+  c->ctx     = ctx;
   c->core_id = core_id;
   c->memsys  = memsys;
 
+  core_init_model(c);
+
   strcpy(c->trace_fname, trace_fname);
   core_init_trace(c);
   core_read_trace(c);
@@ -28,19 +35,60 @@ Core *core_new(Memsys *memsys, char *trace_fname, uns core_id)
   return c;
 }
 
+////////////////////////////////////////////////////////////////////
+// Same as core_new, but reads an already opened trace (e.g. a clone
+// of a trace shared between several simulations). The core owns it.
+////////////////////////////////////////////////////////////////////
+
+Core *core_new_from_trace(SimContext *ctx, Memsys *memsys, Trace *trace, uns core_id)
+{
+  Core *c = (Core *) calloc (1, sizeof (Core));
+  c->ctx     = ctx;
+  c->core_id = core_id;
+  c->memsys  = memsys;
+
+  core_init_model(c);
+
+  c->trace = trace;
+  core_read_trace(c);
+
+  return c;
+}
 
 ////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////
-void core_init_trace(Core *c)
+
+void core_free(Core *c)
 {
-  char  command_string[512];
-  
-  sprintf(command_string,"gunzip -c %s", c->trace_fname);
-  if ((c->trace = popen(command_string, "r")) == NULL){
-    printf("Command string is %s\n", command_string);
-    die_message("Unable to open the file with gzip option \n");
+  trace_close(c->trace);
+  free(c->rob);
+  free(c);
+}
+
+////////////////////////////////////////////////////////////////////
+// The out-of-order model gets its ROB. It needs the L1 MSHRs: they
+// make a load to a line whose fill is on its way wait for it and
+// bound the misses in flight. Without them the tag is in at the miss,
+// so such a load would hit, and any number of misses would overlap.
+////////////////////////////////////////////////////////////////////
+
+static void core_init_model(Core *c)
+{
+  c->retire_limit = CORE_NEVER;
+  if(c->ctx->core_model){
+    if(!c->ctx->l1_mshrs || c->ctx->sim_mode==SIM_MODE_A){
+      die_message("-core 1 needs -L1mshrs, in modes B to F");
+    }
+    c->rob = (Rob_Entry *) calloc (c->ctx->rob_size, sizeof (Rob_Entry));
   }
-  
+}
+
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+void core_init_trace(Core *c)
+{
+  c->trace = trace_open(c->trace_fname, c->ctx->trace_prefetch);
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -53,7 +101,16 @@ void core_cycle (Core *c)
   }
 
   // if core is snoozing on DRAM hits, return ..
-  if(cycle <= c->snooze_end_cycle){
+  if(c->ctx->cycle <= c->snooze_end_cycle){
+      return;
+  }
+
+  if(c->ctx->core_model){
+      core_cycle_ooo(c);
+      return;
+  }
+
+  if(c->ctx->l1_mshrs && c->trace_inst_type==INST_TYPE_LOAD && core_load_wait(c)){
       return;
   }
 
@@ -69,7 +126,12 @@ void core_cycle (Core *c)
   if(c->trace_inst_type==INST_TYPE_LOAD){
     ld_delay = memsys_access(c->memsys, c->trace_ldst_addr, ACCESS_TYPE_LOAD, c->core_id);
   }
-  if(ld_delay>1){
+  if(c->ctx->l1_mshrs && c->trace_inst_type==INST_TYPE_LOAD){
+    // non-blocking: the core goes on, later loads may need the data
+    c->load_ready[c->load_pos] = c->ctx->cycle + ld_delay;
+    c->load_pos = (c->load_pos + 1) % MAX_LOAD_DEP;
+  }
+  else if(ld_delay>1){
     bubble_cycles += (ld_delay-1);
   }
   
@@ -80,7 +142,269 @@ void core_cycle (Core *c)
 
 
   if(bubble_cycles){
-    c->snooze_end_cycle = (cycle+bubble_cycles);
+    c->snooze_end_cycle = (c->ctx->cycle+bubble_cycles);
+  }
+
+  core_read_trace(c);
+}
+
+////////////////////////////////////////////////////////////////////
+// Out-of-order model (-core 1). Every cycle the core retires up to
+// -width finished instructions from the head of the ROB, in order,
+// then dispatches up to -width new ones from the trace while the ROB,
+// load queue and store queue have room. A load goes to the memory
+// system when it is dispatched, or with -load_dep once the load it
+// depends on has its data, so independent loads in the window overlap
+// their latencies (bounded by the MSHRs with -L1mshrs). Stores write
+// the cache when they retire. An instruction cache miss stops the
+// dispatch until the line is back. When nothing can happen before a
+// known cycle the core snoozes until then.
+////////////////////////////////////////////////////////////////////
+
+// Cycle at which the load seq has its data: loads that left the ROB
+// have it, loads not issued yet never
+static uns64 core_ooo_data_ready(Core *c, uns64 seq)
+{
+  uns64 head_seq;
+
+  if(!seq || !c->rob_count){
+    return 0;
+  }
+  head_seq = c->rob[c->rob_head].seq;
+  if(seq < head_seq){
+    return 0;
+  }
+  return c->rob[(c->rob_head + (seq - head_seq)) % c->ctx->rob_size].ready_cycle;
+}
+
+static void core_ooo_issue(Core *c, Rob_Entry *e)
+{
+  uns64 ready = c->ctx->cycle + memsys_access(c->memsys, e->ldst_addr, ACCESS_TYPE_LOAD, c->core_id);
+
+  if(!e->issued || ready > e->ready_cycle){
+    e->ready_cycle = ready;
+  }
+  e->issued = TRUE;
+}
+
+// Loads whose producer has its data go now, *wake gets the earliest
+// cycle at which one of the others can
+static void core_ooo_issue_pending(Core *c, uns64 *wake)
+{
+  uns ii;
+
+  for(ii=0; ii<c->rob_count && c->pending_loads; ii++){
+    Rob_Entry *e = &c->rob[(c->rob_head + ii) % c->ctx->rob_size];
+    if(e->issued){
+      continue;
+    }
+    uns64 dep = core_ooo_data_ready(c, e->dep_seq);
+    if(dep <= c->ctx->cycle){
+      core_ooo_issue(c, e);
+      c->pending_loads--;
+    }
+    else if(dep < *wake){
+      *wake = dep;
+    }
+  }
+}
+
+static Core_Stall core_ooo_dispatch(Core *c)
+{
+  SimContext *ctx = c->ctx;
+  uns ii;
+
+  for(ii=0; ii<ctx->core_width && !c->fetch_done; ii++){
+    if(ctx->cycle < c->fetch_resume)                                      return CORE_STALL_FETCH;
+    if(c->rob_count == ctx->rob_size)                                     return CORE_STALL_ROB;
+    if(c->trace_inst_type==INST_TYPE_LOAD  && c->lq_count == ctx->lq_size) return CORE_STALL_LQ;
+    if(c->trace_inst_type==INST_TYPE_STORE && c->sq_count == ctx->sq_size) return CORE_STALL_SQ;
+
+    uns64 ifetch_delay = memsys_access(c->memsys, c->trace_inst_addr, ACCESS_TYPE_IFETCH, c->core_id);
+    Rob_Entry *e = &c->rob[(c->rob_head + c->rob_count) % ctx->rob_size];
+    c->rob_count++;
+
+    e->seq         = ++c->next_seq;
+    e->inst_type   = c->trace_inst_type;
+    e->ldst_addr   = c->trace_ldst_addr;
+    e->ready_cycle = ctx->cycle + (ifetch_delay ? ifetch_delay : 1);
+    e->dep_seq     = 0;
+    e->issued      = TRUE;
+
+    if(e->inst_type==INST_TYPE_LOAD){
+      c->lq_count++;
+      if(ctx->load_dep){
+	e->dep_seq = c->load_seq[(c->load_pos + MAX_LOAD_DEP - ctx->load_dep) % MAX_LOAD_DEP];
+      }
+      c->load_seq[c->load_pos] = e->seq;
+      c->load_pos = (c->load_pos + 1) % MAX_LOAD_DEP;
+
+      if(core_ooo_data_ready(c, e->dep_seq) <= ctx->cycle){
+	core_ooo_issue(c, e);
+      }
+      else{
+	e->issued      = FALSE;
+	e->ready_cycle = CORE_NEVER;
+	c->pending_loads++;
+      }
+    }
+    if(e->inst_type==INST_TYPE_STORE){
+      c->sq_count++;
+    }
+
+    Trace_Rec rec;
+    if(trace_read(c->trace, &rec)){
+      c->trace_inst_addr = rec.inst_addr;
+      c->trace_inst_type = rec.inst_type;
+      c->trace_ldst_addr = rec.ldst_addr;
+    }
+    else{
+      c->fetch_done = TRUE;
+    }
+
+    if(ifetch_delay > 1){
+      c->fetch_resume = ctx->cycle + ifetch_delay;
+      return CORE_STALL_FETCH;
+    }
+  }
+  return CORE_STALL_NONE;
+}
+
+static void core_cycle_ooo(Core *c)
+{
+  SimContext *ctx = c->ctx;
+  uns64 wake = CORE_NEVER;
+  uns ii;
+
+  // the cycles slept through since the last call had the same stall
+  c->stat_stall[c->dispatch_stall] += ctx->cycle - c->last_cycle;
+  c->last_cycle = ctx->cycle;
+
+  for(ii=0; ii<ctx->core_width && c->rob_count; ii++){
+    Rob_Entry *e = &c->rob[c->rob_head];
+    if(e->ready_cycle > ctx->cycle || c->inst_count >= c->retire_limit){
+      break;
+    }
+    if(e->inst_type==INST_TYPE_LOAD){
+      c->lq_count--;
+    }
+    if(e->inst_type==INST_TYPE_STORE){
+      memsys_access(c->memsys, e->ldst_addr, ACCESS_TYPE_STORE, c->core_id);
+      c->sq_count--;
+    }
+    c->rob_head = (c->rob_head + 1) % ctx->rob_size;
+    c->rob_count--;
+    c->inst_count++;
+  }
+
+  if(c->fetch_done && !c->rob_count){
+    core_finish(c);
+    return;
+  }
+
+  if(c->pending_loads){
+    core_ooo_issue_pending(c, &wake);
+  }
+  c->dispatch_stall = core_ooo_dispatch(c);
+
+  // next cycle at which the head can retire or the dispatch go on
+  if(c->rob_count && c->rob[c->rob_head].ready_cycle < wake){
+    wake = c->rob[c->rob_head].ready_cycle;
+  }
+  if(c->dispatch_stall == CORE_STALL_NONE && !c->fetch_done){
+    wake = ctx->cycle + 1;
+  }
+  if(c->dispatch_stall == CORE_STALL_FETCH && c->fetch_resume < wake){
+    wake = c->fetch_resume;
+  }
+  if(wake > ctx->cycle + 1 && wake != CORE_NEVER){
+    c->snooze_end_cycle = wake - 1;
+  }
+}
+
+// Fast-forward the oldest instruction of the window: it retires at
+// once, and a load that never issued or a store reaches the caches
+// functionally. What is left of the window stays valid.
+static void core_ooo_ffwd_head(Core *c)
+{
+  Rob_Entry *e = &c->rob[c->rob_head];
+
+  if(e->inst_type==INST_TYPE_LOAD){
+    if(!e->issued){
+      memsys_access_functional(c->memsys, e->ldst_addr, ACCESS_TYPE_LOAD, c->core_id);
+      c->pending_loads--;
+    }
+    c->lq_count--;
+  }
+  if(e->inst_type==INST_TYPE_STORE){
+    memsys_access_functional(c->memsys, e->ldst_addr, ACCESS_TYPE_STORE, c->core_id);
+    c->sq_count--;
+  }
+  c->rob_head = (c->rob_head + 1) % c->ctx->rob_size;
+  c->rob_count--;
+  c->inst_count++;
+  c->ffwd_inst_count++;
+
+  if(c->fetch_done && !c->rob_count){
+    core_finish(c);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// With non-blocking loads a load only waits, before it issues, for a
+// free MSHR in the data cache if it is a primary miss and, with
+// -load_dep, for the data of the load it depends on. Returns TRUE (and snoozes) if it has to wait.
+////////////////////////////////////////////////////////////////////
+
+static Flag core_load_wait(Core *c)
+{
+  uns64 now  = c->ctx->cycle;
+  uns64 dep  = now;
+  uns64 mshr = memsys_mshr_free_cycle(c->memsys, c->trace_ldst_addr, c->core_id);
+
+  if(c->ctx->load_dep){
+    uns64 ready = c->load_ready[(c->load_pos + MAX_LOAD_DEP - c->ctx->load_dep) % MAX_LOAD_DEP];
+    dep = (ready > now) ? ready : now;
+  }
+  if(dep == now && mshr == now){
+    return FALSE;
+  }
+
+  c->stat_dep_stall  += dep - now;
+  c->stat_mshr_stall += (mshr > dep) ? mshr - dep : 0;
+  c->snooze_end_cycle = ((mshr > dep) ? mshr : dep) - 1;
+  return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////
+// Run one instruction without timing: its accesses only update the
+// cache tags (see memsys_access_functional) and the clock stays put.
+////////////////////////////////////////////////////////////////////
+
+void core_ffwd (Core *c)
+{
+  if(c->done){
+    return;
+  }
+
+  // the instructions in the out-of-order window are older than the
+  // trace record, they go first
+  if(c->rob_count){
+    core_ooo_ffwd_head(c);
+    return;
+  }
+
+  c->inst_count++;
+  c->ffwd_inst_count++;
+
+  memsys_access_functional(c->memsys, c->trace_inst_addr, ACCESS_TYPE_IFETCH, c->core_id);
+
+  if(c->trace_inst_type==INST_TYPE_LOAD){
+    memsys_access_functional(c->memsys, c->trace_ldst_addr, ACCESS_TYPE_LOAD, c->core_id);
+  }
+
+  if(c->trace_inst_type==INST_TYPE_STORE){
+    memsys_access_functional(c->memsys, c->trace_ldst_addr, ACCESS_TYPE_STORE, c->core_id);
   }
 
   core_read_trace(c);
@@ -91,17 +415,39 @@ void core_cycle (Core *c)
 ////////////////////////////////////////////////////////////////////
 
 void core_read_trace (Core *c){
-  uns tmp;
-  tmp = fread (&c->trace_inst_addr, 4, 1, c->trace);
-  tmp = fread (&c->trace_inst_type, 1, 1, c->trace);
-  tmp = fread (&c->trace_ldst_addr, 4, 1, c->trace);
-  
-  if(feof(c->trace)){
-    c->done=TRUE;
-    c->done_inst_count  = c->inst_count;
-    c->done_cycle_count = cycle;
+  Trace_Rec rec;
+
+  if(!trace_read(c->trace, &rec)){
+    core_finish(c);
+    return;
   }
-  
+
+  c->trace_inst_addr = rec.inst_addr;
+  c->trace_inst_type = rec.inst_type;
+  c->trace_ldst_addr = rec.ldst_addr;
+}
+
+static void core_finish(Core *c)
+{
+  c->done=TRUE;
+  c->done_inst_count  = c->inst_count - c->ffwd_inst_count;
+  c->done_cycle_count = c->ctx->cycle - c->ctx->stat_cycle;
+}
+
+////////////////////////////////////////////////////////////
+// Start counting again from the current instruction
+////////////////////////////////////////////////////////////
+
+void core_reset_stats(Core *c)
+{
+  c->inst_count       = 0;
+  c->ffwd_inst_count  = 0;
+  c->done_inst_count  = 0;
+  c->done_cycle_count = 0;
+  c->stat_mshr_stall  = 0;
+  c->stat_dep_stall   = 0;
+  c->last_cycle       = c->ctx->cycle;
+  memset(c->stat_stall, 0, sizeof(c->stat_stall));
 }
 
 ////////////////////////////////////////////////////////////
@@ -113,12 +459,21 @@ void core_print_stats(Core *c)
   double ipc = (double)(c->done_inst_count)/(double)(c->done_cycle_count);
   sprintf(header, "CORE_%01d", c->core_id);
   
-  printf("\n");
-  printf("\n%s_INST         \t\t : %10llu", header,  c->done_inst_count);
-  printf("\n%s_CYCLES       \t\t : %10llu", header,  c->done_cycle_count);
-  printf("\n%s_IPC          \t\t : %10.3f", header,  ipc);
-
-  pclose(c->trace);
+  fprintf(c->ctx->out, "\n");
+  fprintf(c->ctx->out, "\n%s_INST         \t\t : %10llu", header,  c->done_inst_count);
+  fprintf(c->ctx->out, "\n%s_CYCLES       \t\t : %10llu", header,  c->done_cycle_count);
+  fprintf(c->ctx->out, "\n%s_IPC          \t\t : %10.3f", header,  ipc);
+  // the out-of-order core issues around these waits, see its stall counts
+  if(c->ctx->l1_mshrs && !c->ctx->core_model){
+    fprintf(c->ctx->out, "\n%s_MSHR_STALL   \t\t : %10llu", header,  c->stat_mshr_stall);
+    fprintf(c->ctx->out, "\n%s_DEP_STALL    \t\t : %10llu", header,  c->stat_dep_stall);
+  }
+  if(c->ctx->core_model){
+    fprintf(c->ctx->out, "\n%s_ROB_FULL     \t\t : %10llu", header,  c->stat_stall[CORE_STALL_ROB]);
+    fprintf(c->ctx->out, "\n%s_LQ_FULL      \t\t : %10llu", header,  c->stat_stall[CORE_STALL_LQ]);
+    fprintf(c->ctx->out, "\n%s_SQ_FULL      \t\t : %10llu", header,  c->stat_stall[CORE_STALL_SQ]);
+    fprintf(c->ctx->out, "\n%s_FETCH_STALL  \t\t : %10llu", header,  c->stat_stall[CORE_STALL_FETCH]);
+  }
 }
 
 
@@ -3,8 +3,22 @@
 
 #include "types.h"
 #include "memsys.h"
+#include "trace.h"
+
+#define CORE_NEVER ((uns64)(-1))
+
+// What stopped the out-of-order dispatch in a cycle
+typedef enum Core_Stall_Enum {
+    CORE_STALL_NONE=0,
+    CORE_STALL_ROB,      // reorder buffer full
+    CORE_STALL_LQ,       // load queue full
+    CORE_STALL_SQ,       // store queue full
+    CORE_STALL_FETCH,    // instruction cache miss
+    NUM_CORE_STALLS
+} Core_Stall;
 
 typedef struct Core Core;
+typedef struct Rob_Entry Rob_Entry;
 
 
 
@@ -12,13 +26,25 @@ typedef struct Core Core;
 ////////////////////////////////////////////////////////////////////////////
 
 
+// One instruction in the out-of-order window (-core 1)
+struct Rob_Entry {
+  uns64 seq;           // dispatch order, from 1
+  uns64 inst_type;
+  uns64 ldst_addr;
+  uns64 ready_cycle;   // the result is there, the entry may retire
+  uns64 dep_seq;       // loads with -load_dep: the load it waits for, 0 is none
+  Flag  issued;        // loads: the access went to the memory system
+};
+
 struct Core {
   uns   core_id;
 
+  SimContext *ctx;
+
   Memsys *memsys;
     
   char  trace_fname[1024];
-  FILE *trace;
+  Trace *trace;
     
   uns   done;
 
@@ -28,9 +54,32 @@ struct Core {
   
   uns64 snooze_end_cycle; // when waiting for data to return
 
+  // non-blocking loads (-L1mshrs): when the data of the last loads arrives
+  uns64 load_ready[MAX_LOAD_DEP];
+  uns   load_pos;
+
+  // out-of-order model (-core 1)
+  Rob_Entry *rob;         // ctx->rob_size entries, a ring starting at rob_head
+  uns   rob_head;
+  uns   rob_count;
+  uns   lq_count;         // loads in the ROB
+  uns   sq_count;         // stores in the ROB
+  uns   pending_loads;    // loads waiting for the load they depend on
+  uns64 next_seq;
+  uns64 load_seq[MAX_LOAD_DEP]; // seq of the last loads, for -load_dep
+  uns64 fetch_resume;     // the front end waits for an instruction cache miss
+  Flag  fetch_done;       // the trace is over, the ROB drains
+  uns64 last_cycle;       // last cycle core_cycle_ooo ran
+  uns   dispatch_stall;   // why dispatch stopped then, a Core_Stall
+  uns64 retire_limit;     // stop retiring at this inst_count, CORE_NEVER:none (see sim_step_inst)
+
   uns64 inst_count;
+  uns64 ffwd_inst_count;  // of inst_count, run functionally: not in the stats
   uns64 done_inst_count;
   uns64 done_cycle_count;
+  uns64 stat_mshr_stall;  // in-order: cycles a load waited for a free MSHR
+  uns64 stat_dep_stall;   // in-order: cycles a load waited for the load it depends on
+  uns64 stat_stall[NUM_CORE_STALLS]; // out-of-order: cycles dispatch was stopped
 };
 
 
@@ -38,8 +87,12 @@ struct Core {
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
-Core  *core_new(Memsys *memsys, char *trace_fname, uns core_id);
+Core  *core_new(SimContext *ctx, Memsys *memsys, char *trace_fname, uns core_id);
+Core  *core_new_from_trace(SimContext *ctx, Memsys *memsys, Trace *trace, uns core_id);
+void   core_free(Core *c);
 void   core_cycle(Core *core);
+void   core_ffwd(Core *core);
+void   core_reset_stats(Core *c);
 void   core_print_stats(Core *c);
 void   core_read_trace(Core *c);
 void   core_init_trace(Core *c);
@@ -1,37 +1,216 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
 
 #include "dram.h"
 
-#define ROWBUF_SIZE         1024
-#define DRAM_BANKS          16
-
 //---- Latency for Part B ------
 
 #define DRAM_LATENCY_FIXED  100
 
-//---- Latencies for Part C ------
+//---- Timing for Part C, in ns (-dram_timing) ------
+
+typedef struct Dram_Timing_Ns {
+  const char *name;
+  double t_cl, t_rcd, t_rp, t_ras, t_rrd, t_faw, t_wtr, t_rtw, t_refi, t_rfc, t_burst;
+} Dram_Timing_Ns;
+
+static const Dram_Timing_Ns dram_presets[] = {
+  // "base" is the original 45/45/45 cycle ACT/CAS/PRE and 10 cycle bus
+  // at 3.2 GHz, without the other constraints
+  // name          tCL      tRCD     tRP      tRAS tRRD  tFAW   tWTR  tRTW  tREFI   tRFC   tBURST
+  { "base",        14.0625, 14.0625, 14.0625, 0,   0,    0,     0,    0,    0,      0,     3.125 },
+  { "DDR4-2400",   14.16,   14.16,   14.16,   32,  3.3,  21,    7.5,  9.2,  7800,   350,   3.33  },
+  { "DDR4-3200",   13.75,   13.75,   13.75,   32,  2.5,  21,    7.5,  7.5,  7800,   350,   2.5   },
+  { "DDR5-4800",   16.67,   16.25,   16.25,   32,  3.33, 13.33, 10,   5,    3900,   295,   3.33  },
+};
+
+// Parameter names of a -dram_timing file
+static const struct { const char *name; size_t offset; } dram_timing_fields[] = {
+  { "tCL",    offsetof(Dram_Timing_Ns, t_cl)    },
+  { "tRCD",   offsetof(Dram_Timing_Ns, t_rcd)   },
+  { "tRP",    offsetof(Dram_Timing_Ns, t_rp)    },
+  { "tRAS",   offsetof(Dram_Timing_Ns, t_ras)   },
+  { "tRRD",   offsetof(Dram_Timing_Ns, t_rrd)   },
+  { "tFAW",   offsetof(Dram_Timing_Ns, t_faw)   },
+  { "tWTR",   offsetof(Dram_Timing_Ns, t_wtr)   },
+  { "tRTW",   offsetof(Dram_Timing_Ns, t_rtw)   },
+  { "tREFI",  offsetof(Dram_Timing_Ns, t_refi)  },
+  { "tRFC",   offsetof(Dram_Timing_Ns, t_rfc)   },
+  { "tBURST", offsetof(Dram_Timing_Ns, t_burst) },
+};
 
-#define DRAM_T_ACT         45
-#define DRAM_T_CAS         45
-#define DRAM_T_PRE         45
-#define DRAM_T_BUS         10
+//---- Memory controller (-dram_ctrl) ------
 
+#define DRAM_WQ_HIGH       48   // queued writebacks that start a drain
+#define DRAM_WQ_LOW        16   // a drain stops at this many
 
-extern MODE   SIM_MODE;
-extern uns64  CACHE_LINESIZE;
+static void  dram_check_config(SimContext *ctx);
+static void  dram_timing_load(SimContext *ctx, Dram_Timing *timing);
+static void  dram_map(DRAM *dram, Addr lineaddr, uns64 *bank, uns64 *row, uns64 *channel);
+static Dram_Row_State dram_row_state(DRAM *dram, uns64 bank, uns64 row);
+static uns64 dram_row_latency(DRAM *dram, uns64 bank, uns64 row);
+static void  dram_page_policy(DRAM *dram, Rowbuf_Entry *bank_buf, uns64 row);
+static uns64 dram_ctrl_access(DRAM *dram, Addr lineaddr, Flag is_dram_write, uns64 cycle);
 
 
 ///////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////
 
-DRAM   *dram_new(){
+DRAM   *dram_new(SimContext *ctx){
   DRAM *dram = (DRAM *) calloc (1, sizeof (DRAM));
-  assert(DRAM_BANKS <= MAX_DRAM_BANKS);
+  dram->ctx = ctx;
+  dram_check_config(ctx);
+  dram_timing_load(ctx, &dram->timing);
+
+  dram->num_banks       = ctx->dram_channels * ctx->dram_ranks * ctx->dram_banks;
+  dram->perbank_row_buf = (Rowbuf_Entry *) calloc (dram->num_banks, sizeof (Rowbuf_Entry));
+  dram->ctrl.bank       = (Dram_Bank *) calloc (dram->num_banks, sizeof (Dram_Bank));
+  dram->ctrl.rank       = (Dram_Rank *) calloc (ctx->dram_channels * ctx->dram_ranks, sizeof (Dram_Rank));
+  dram->ctrl.channel    = (Dram_Channel *) calloc (ctx->dram_channels, sizeof (Dram_Channel));
   return dram;
 }
 
+///////////////////////////////////////////////////////////////////
+// The geometry and -dram_map must describe every line address
+///////////////////////////////////////////////////////////////////
+
+static void dram_check_config(SimContext *ctx){
+  uns seen = 0, ii;
+
+  for(ii=0; ii<DRAM_MAP_FIELDS; ii++){
+    if(ctx->dram_map[ii] < DRAM_MAP_FIELDS){
+      seen |= 1u << ctx->dram_map[ii];
+    }
+  }
+
+  if(seen != (1u << DRAM_MAP_FIELDS) - 1 || ctx->dram_map[DRAM_MAP_FIELDS-1] != DRAM_FIELD_ROW){
+    printf("-dram_map needs each of row, rank, bank, channel and column once, row first\n");
+    exit(-1);
+  }
+
+  if(!ctx->dram_channels || !ctx->dram_ranks || !ctx->dram_banks ||
+     ctx->dram_rowbuf_size < ctx->cache_linesize){
+    printf("DRAM needs at least one channel, rank and bank and a row of at least one line\n");
+    exit(-1);
+  }
+
+  if(!(ctx->core_ghz > 0)){
+    printf("-core_ghz must be positive\n");
+    exit(-1);
+  }
+}
+
+///////////////////////////////////////////////////////////////////
+// -dram_timing is a preset name or a file of "<param> <ns>" lines
+// (# starts a comment) that override the base preset, e.g. "tRAS 32".
+// Each time is rounded up to whole cycles of the -core_ghz clock.
+///////////////////////////////////////////////////////////////////
+
+static void dram_timing_load(SimContext *ctx, Dram_Timing *timing){
+  Dram_Timing_Ns ns = dram_presets[0];
+  uns ii, found = FALSE;
+
+  for(ii=0; ii<sizeof(dram_presets)/sizeof(dram_presets[0]); ii++){
+    if(!strcmp(ctx->dram_timing, dram_presets[ii].name)){
+      ns = dram_presets[ii];
+      found = TRUE;
+    }
+  }
+
+  if(!found){
+    FILE *fp = fopen(ctx->dram_timing, "r");
+    char line[256], name[64];
+    double value;
+
+    if(!fp){
+      printf("-dram_timing %s is neither a preset (base, DDR4-2400, DDR4-3200, DDR5-4800) nor a file\n",
+	     ctx->dram_timing);
+      exit(-1);
+    }
+    while(fgets(line, sizeof(line), fp)){
+      line[strcspn(line, "#\n")] = 0;
+      int num = sscanf(line, "%63s %lf", name, &value);
+      if(num <= 0){
+	continue;
+      }
+      for(ii=0; ii<sizeof(dram_timing_fields)/sizeof(dram_timing_fields[0]); ii++){
+	if(!strcmp(name, dram_timing_fields[ii].name)){
+	  break;
+	}
+      }
+      if(num != 2 || value < 0 || ii == sizeof(dram_timing_fields)/sizeof(dram_timing_fields[0])){
+	printf("%s: bad DRAM timing line: %s\n", ctx->dram_timing, line);
+	exit(-1);
+      }
+      *(double *)((char *)&ns + dram_timing_fields[ii].offset) = value;
+    }
+    fclose(fp);
+  }
+
+  // the epsilon keeps exact multiples (14.0625 ns at 3.2 GHz) exact
+#define DRAM_NS_TO_CYCLES(t)  ((uns64) ceil((t) * ctx->core_ghz - 1e-6))
+  timing->t_cl    = DRAM_NS_TO_CYCLES(ns.t_cl);
+  timing->t_rcd   = DRAM_NS_TO_CYCLES(ns.t_rcd);
+  timing->t_rp    = DRAM_NS_TO_CYCLES(ns.t_rp);
+  timing->t_ras   = DRAM_NS_TO_CYCLES(ns.t_ras);
+  timing->t_rrd   = DRAM_NS_TO_CYCLES(ns.t_rrd);
+  timing->t_faw   = DRAM_NS_TO_CYCLES(ns.t_faw);
+  timing->t_wtr   = DRAM_NS_TO_CYCLES(ns.t_wtr);
+  timing->t_rtw   = DRAM_NS_TO_CYCLES(ns.t_rtw);
+  timing->t_refi  = DRAM_NS_TO_CYCLES(ns.t_refi);
+  timing->t_rfc   = DRAM_NS_TO_CYCLES(ns.t_rfc);
+  timing->t_burst = DRAM_NS_TO_CYCLES(ns.t_burst);
+#undef DRAM_NS_TO_CYCLES
+
+  if(!timing->t_burst || (timing->t_refi && timing->t_rfc >= timing->t_refi)){
+    printf("DRAM timing %s needs tBURST > 0 and tRFC < tREFI\n", ctx->dram_timing);
+    exit(-1);
+  }
+}
+
+///////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////
+
+void    dram_free(DRAM *dram){
+  free(dram->perbank_row_buf);
+  free(dram->ctrl.bank);
+  free(dram->ctrl.rank);
+  free(dram->ctrl.channel);
+  free(dram);
+}
+
+///////////////////////////////////////////////////////////////////
+// Zero the counters, open rows are kept
+///////////////////////////////////////////////////////////////////
+
+void    dram_reset_stats(DRAM *dram){
+  dram->stat_read_access  = 0;
+  dram->stat_write_access = 0;
+  dram->stat_read_delay   = 0;
+  dram->stat_write_delay  = 0;
+  memset(dram->stat_row_state, 0, sizeof(dram->stat_row_state));
+
+  dram->ctrl.stat_read_queue_delay = 0;
+  dram->ctrl.stat_write_drains     = 0;
+  dram->ctrl.stat_write_idle       = 0;
+  dram->ctrl.stat_refresh_stall    = 0;
+  dram->ctrl.stat_act_stall        = 0;
+  dram->ctrl.stat_turn_stall       = 0;
+
+  for(uns64 ii=0; ii<dram->num_banks; ii++){
+    dram->ctrl.bank[ii].stat_access = 0;
+    dram->ctrl.bank[ii].stat_busy   = 0;
+  }
+  for(uns64 ii=0; ii<dram->ctx->dram_channels; ii++){
+    dram->ctrl.channel[ii].stat_access = 0;
+    dram->ctrl.channel[ii].stat_busy   = 0;
+  }
+}
+
 ///////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////
 
@@ -49,11 +228,49 @@ void    dram_print_stats(DRAM *dram){
     wrdelay_avg=(double)(dram->stat_write_delay)/(double)(dram->stat_write_access);
   }
 
-  printf("\n%s_READ_ACCESS\t\t : %10llu", header, dram->stat_read_access);
-  printf("\n%s_WRITE_ACCESS\t\t : %10llu", header, dram->stat_write_access);
-  printf("\n%s_READ_DELAY_AVG\t\t : %10.3f", header, rddelay_avg);
-  printf("\n%s_WRITE_DELAY_AVG\t\t : %10.3f", header, wrdelay_avg);
+  fprintf(dram->ctx->out, "\n%s_READ_ACCESS\t\t : %10llu", header, dram->stat_read_access);
+  fprintf(dram->ctx->out, "\n%s_WRITE_ACCESS\t\t : %10llu", header, dram->stat_write_access);
+  fprintf(dram->ctx->out, "\n%s_READ_DELAY_AVG\t\t : %10.3f", header, rddelay_avg);
+  fprintf(dram->ctx->out, "\n%s_WRITE_DELAY_AVG\t\t : %10.3f", header, wrdelay_avg);
 
+  if(dram->ctx->sim_mode!=SIM_MODE_B){
+    static const char *policy[] = { "OPEN", "CLOSED", "ADAPTIVE" };
+    fprintf(dram->ctx->out, "\n%s_PAGE_POLICY\t\t : %10s", header,
+	    dram->ctx->dram_page_policy <= DRAM_PAGE_ADAPTIVE ? policy[dram->ctx->dram_page_policy] : "?");
+    fprintf(dram->ctx->out, "\n%s_TIMING\t\t\t : %10s", header, dram->ctx->dram_timing);
+    fprintf(dram->ctx->out, "\n%s_READ_ROW_HIT\t\t : %10llu", header, dram->stat_row_state[0][DRAM_ROW_HIT]);
+    fprintf(dram->ctx->out, "\n%s_READ_ROW_EMPTY\t\t : %10llu", header, dram->stat_row_state[0][DRAM_ROW_EMPTY]);
+    fprintf(dram->ctx->out, "\n%s_READ_ROW_CONFLICT\t\t : %10llu", header, dram->stat_row_state[0][DRAM_ROW_CONFLICT]);
+    fprintf(dram->ctx->out, "\n%s_WRITE_ROW_HIT\t\t : %10llu", header, dram->stat_row_state[1][DRAM_ROW_HIT]);
+    fprintf(dram->ctx->out, "\n%s_WRITE_ROW_EMPTY\t\t : %10llu", header, dram->stat_row_state[1][DRAM_ROW_EMPTY]);
+    fprintf(dram->ctx->out, "\n%s_WRITE_ROW_CONFLICT\t\t : %10llu", header, dram->stat_row_state[1][DRAM_ROW_CONFLICT]);
+  }
+
+  if(dram->ctx->dram_ctrl && dram->ctx->sim_mode!=SIM_MODE_B){
+    Dram_Ctrl *ctrl = &dram->ctrl;
+    fprintf(dram->ctx->out, "\n%s_READ_QUEUE_AVG\t\t : %10.3f", header,
+	    dram->stat_read_access ? (double)(ctrl->stat_read_queue_delay)/(double)(dram->stat_read_access) : 0);
+    fprintf(dram->ctx->out, "\n%s_WRITE_DRAINS\t\t : %10llu", header, ctrl->stat_write_drains);
+    fprintf(dram->ctx->out, "\n%s_WRITE_IDLE\t\t : %10llu", header, ctrl->stat_write_idle);
+    fprintf(dram->ctx->out, "\n%s_WRITE_QUEUED\t\t : %10u", header, ctrl->wq_total);
+    fprintf(dram->ctx->out, "\n%s_REFRESH_STALL\t\t : %10llu", header, ctrl->stat_refresh_stall);
+    fprintf(dram->ctx->out, "\n%s_ACT_STALL\t\t : %10llu", header, ctrl->stat_act_stall);
+    fprintf(dram->ctx->out, "\n%s_TURNAROUND_STALL\t : %10llu", header, ctrl->stat_turn_stall);
+
+    // utilization over the measured cycles
+    uns64 cycles = dram->ctx->cycle - dram->ctx->stat_cycle;
+    uns64 ii;
+    for(ii=0; ii<dram->ctx->dram_channels; ii++){
+      fprintf(dram->ctx->out, "\n%s_CH%llu_ACCESS\t\t : %10llu", header, ii, ctrl->channel[ii].stat_access);
+      fprintf(dram->ctx->out, "\n%s_CH%llu_BUS_UTIL\t\t : %10.3f", header, ii,
+	      cycles ? (double)(ctrl->channel[ii].stat_busy)/(double)cycles : 0);
+    }
+    for(ii=0; ii<dram->num_banks; ii++){
+      fprintf(dram->ctx->out, "\n%s_BANK%llu_ACCESS\t\t : %10llu", header, ii, ctrl->bank[ii].stat_access);
+      fprintf(dram->ctx->out, "\n%s_BANK%llu_UTIL\t\t : %10.3f", header, ii,
+	      cycles ? (double)(ctrl->bank[ii].stat_busy)/(double)cycles : 0);
+    }
+  }
 
 }
 
@@ -61,9 +278,20 @@ void    dram_print_stats(DRAM *dram){
 ///////////////////////////////////////////////////////////////////
 
 uns64   dram_access(DRAM *dram,Addr lineaddr, Flag is_dram_write){
+  return dram_access_at(dram, lineaddr, is_dram_write, dram->ctx->cycle);
+}
+
+///////////////////////////////////////////////////////////////////
+// Same, for a request that reaches the DRAM at the given cycle
+///////////////////////////////////////////////////////////////////
+
+uns64   dram_access_at(DRAM *dram, Addr lineaddr, Flag is_dram_write, uns64 cycle){
   uns64 delay=DRAM_LATENCY_FIXED;
 
-  if(SIM_MODE!=SIM_MODE_B){
+  if(dram->ctx->sim_mode!=SIM_MODE_B){
+    if(dram->ctx->dram_ctrl){
+      return dram_ctrl_access(dram, lineaddr, is_dram_write, cycle);
+    }
     delay = dram_access_sim_rowbuf(dram, lineaddr, is_dram_write);
   }
 
@@ -85,38 +313,657 @@ uns64   dram_access(DRAM *dram,Addr lineaddr, Flag is_dram_write){
 ///////////////////////////////////////////////////////////////////
 
 uns64   dram_access_sim_rowbuf(DRAM *dram,Addr lineaddr, Flag is_dram_write){
-    uns64 delay = DRAM_T_CAS + DRAM_T_BUS;
     uns64 bank_idx = 0;
     uns64 row = 0;
-    // Assume a mapping with consecutive lines in the same row
-    // Assume a mapping with consecutive rowbufs in consecutive rows
+    uns64 channel = 0;
+    // Bank and row come from the -dram_map address mapping
     // You need to write this fuction to track open rows 
     // You will need to compute delay based on row hit/miss/empty
+    dram_map(dram, lineaddr, &bank_idx, &row, &channel);
 
-    // Reveal bits used for bank indexing
-    bank_idx = (lineaddr / (ROWBUF_SIZE / CACHE_LINESIZE));
-    // Use modulo to find the bank index
-    bank_idx %= DRAM_BANKS;
-
-    // Reveal bits used for row indexing
-    row = lineaddr / (ROWBUF_SIZE / CACHE_LINESIZE);
-    // Use division to find row index (upper bits of addr)
-    row /= DRAM_BANKS;
+    uns64 delay = dram_row_latency(dram, bank_idx, row);
+    dram->stat_row_state[is_dram_write != 0][dram_row_state(dram, bank_idx, row)]++;
+    dram->ctrl.bank[bank_idx].stat_access++;
+    dram->ctrl.channel[channel].stat_access++;
 
-    // Check if row buffer is empty or doesn't contain the row we seek
+    // Update rowid and validity of row, then let the policy close it
     Rowbuf_Entry* bank_buf = &dram->perbank_row_buf[bank_idx];
-    
-    if(!bank_buf->valid || bank_buf->rowid != row || is_dram_write) {
-        // precharge (close row and prepare bank for access)
-        delay += DRAM_T_PRE;
-        // activate (opens row and places into row buffer)
-        delay += DRAM_T_ACT;
-    }
-    
-    // Update rowid and validity of row
+    dram_page_policy(dram, bank_buf, row);
     bank_buf->rowid = row;
-    bank_buf->valid = TRUE;
+    bank_buf->valid = !bank_buf->closed;
+
+    return delay;
+}
+
+///////////////////////////////////////////////////////////////////
+// Decide whether the row just accessed stays open (-dram_page). The
+// adaptive policy learns per bank whether the next access goes to
+// the same row: an open row that hits or a closed row that would have
+// hit count up, a conflict or a closed row that would have conflicted
+// count down. Rows are closed (precharged in the background) when
+// the counter is below 2.
+///////////////////////////////////////////////////////////////////
+
+static void dram_page_policy(DRAM *dram, Rowbuf_Entry *bank_buf, uns64 row){
+    switch(dram->ctx->dram_page_policy){
+    case DRAM_PAGE_CLOSED:
+      bank_buf->closed = TRUE;
+      break;
+
+    case DRAM_PAGE_ADAPTIVE:
+      if(bank_buf->valid || bank_buf->closed){
+	if(bank_buf->rowid == row){
+	  bank_buf->keep_open += (bank_buf->keep_open < 3);
+	}
+	else{
+	  bank_buf->keep_open -= (bank_buf->keep_open > 0);
+	}
+      }
+      else{
+	bank_buf->keep_open = 2;
+      }
+      bank_buf->closed = (bank_buf->keep_open < 2);
+      break;
+
+    default:
+      bank_buf->closed = FALSE;
+      break;
+    }
+}
+
+///////////////////////////////////////////////////////////////////
+// Bank (numbered over all channels and ranks), row and channel of a
+// line. The line address is split into the -dram_map fields, lowest
+// first, each taking as many values as there are columns (lines per
+// row), channels, banks or ranks; the row gets what is left. The
+// default row:rank:bank:channel:column with one channel and rank is
+// the original mapping: consecutive lines share a row and
+// consecutive rows go to consecutive banks.
+//
+// -dram_xor permutes the banks of a rank by the low row bits (XOR for
+// a power of 2 banks, else a rotation), so rows a power-of-two stride
+// apart, which would share one bank, spread over all of them.
+///////////////////////////////////////////////////////////////////
+
+static void dram_map(DRAM *dram, Addr lineaddr, uns64 *bank, uns64 *row, uns64 *channel){
+    SimContext *ctx = dram->ctx;
+    uns64 value[DRAM_MAP_FIELDS];
+    uns64 radix[DRAM_MAP_FIELDS];
+    uns   ii;
+
+    radix[DRAM_FIELD_COLUMN]  = ctx->dram_rowbuf_size / ctx->cache_linesize;
+    radix[DRAM_FIELD_CHANNEL] = ctx->dram_channels;
+    radix[DRAM_FIELD_BANK]    = ctx->dram_banks;
+    radix[DRAM_FIELD_RANK]    = ctx->dram_ranks;
+
+    for(ii=0; ii<DRAM_MAP_FIELDS-1; ii++){
+      Dram_Field f = (Dram_Field) ctx->dram_map[ii];
+      value[f]  = lineaddr % radix[f];
+      lineaddr /= radix[f];
+    }
+    value[DRAM_FIELD_ROW] = lineaddr;
+
+    if(ctx->dram_xor){
+      if(!(ctx->dram_banks & (ctx->dram_banks-1)))
+	value[DRAM_FIELD_BANK] ^= value[DRAM_FIELD_ROW] & (ctx->dram_banks-1);
+      else
+	value[DRAM_FIELD_BANK] = (value[DRAM_FIELD_BANK] + value[DRAM_FIELD_ROW]) % ctx->dram_banks;
+    }
+
+    *channel = value[DRAM_FIELD_CHANNEL];
+    *row     = value[DRAM_FIELD_ROW];
+    *bank    = (value[DRAM_FIELD_CHANNEL] * ctx->dram_ranks + value[DRAM_FIELD_RANK]) * ctx->dram_banks
+               + value[DRAM_FIELD_BANK];
+}
+
+///////////////////////////////////////////////////////////////////
+// Row buffer state an access to row would find, reads and writes
+// alike
+///////////////////////////////////////////////////////////////////
+
+static Dram_Row_State dram_row_state(DRAM *dram, uns64 bank, uns64 row){
+    Rowbuf_Entry* bank_buf = &dram->perbank_row_buf[bank];
+
+    if(!bank_buf->valid){
+      return DRAM_ROW_EMPTY;
+    }
+    return (bank_buf->rowid == row) ? DRAM_ROW_HIT : DRAM_ROW_CONFLICT;
+}
+
+///////////////////////////////////////////////////////////////////
+// Latency of an access to an idle bank given its open row, the row
+// buffer is not changed
+///////////////////////////////////////////////////////////////////
+
+static uns64 dram_row_latency(DRAM *dram, uns64 bank, uns64 row){
+    uns64 delay = dram->timing.t_cl + dram->timing.t_burst;
+
+    switch(dram_row_state(dram, bank, row)){
+    case DRAM_ROW_CONFLICT:
+      // precharge (close row and prepare bank for access)
+      delay += dram->timing.t_rp;
+      // fall through
+    case DRAM_ROW_EMPTY:
+      // activate (opens row and places into row buffer)
+      delay += dram->timing.t_rcd;
+      break;
+    default:
+      break;
+    }
+
+    return delay;
+}
+
+///////////////////////////////////////////////////////////////////
+// Memory controller (-dram_ctrl 1). Each bank keeps the accesses
+// scheduled on it (req, in the order of their first command) and each
+// channel the bursts on its data bus. A request is placed by its own
+// arrival cycle. It may be handed over after requests that arrive
+// later, as when an MSHR frees up or a slice port was busy.
+//
+// An access pays the row buffer latency of the row the access before
+// it leaves behind: CAS for a hit, ACT and CAS for an empty bank, and
+// PRE, ACT and CAS for a conflict. Its CAS then waits for a slot on
+// the data bus of its channel, which every burst holds for tBURST.
+// The bank can take its next command once the data is on the bus, or
+// tRP later if the page policy closes the row.
+//
+// Commands also wait for the -dram_timing constraints between them:
+// a PRE for tRAS after its row's ACT, an ACT for tRRD after the last
+// ACT of the rank and for tFAW after the DRAM_FAW_ACTS-th last and,
+// when the data bus of the channel changes direction, a read CAS for
+// tWTR after the write data and a write CAS for tRTW after the read
+// CAS. Every tREFI each rank is refreshed for tRFC, staggered over
+// the ranks: commands wait the blackout out and the rows it closed
+// must be activated again.
+//
+// The accesses of a bank that have not issued their first command
+// when a read arrives are its read queue, served FR-FCFS. The read
+// goes ahead of the accesses that arrived after it. If it hits the
+// row open at that point, it also goes ahead of older accesses that
+// do not. An access keeps the timing it was given when it was handed
+// over, so the read only goes ahead where it fits without moving the
+// next access: it must be done by that access's first command and
+// leave the row as it found it. A hit keeps the row open and an
+// access to a precharged bank closes it again, whatever the page
+// policy says. A read that would need a PRE there goes after.
+// Accesses that left the bounded queues (DRAM_BANK_QUEUE,
+// DRAM_ACT_HISTORY, DRAM_BUS_QUEUE) count as issued.
+//
+// Writebacks are posted into per-bank write queues and return at
+// once. They go out FR-FCFS (open-row hits first, then the oldest):
+// in the idle time a bank has before a read, and in a drain that
+// starts when DRAM_WQ_HIGH writebacks are queued and runs down to
+// DRAM_WQ_LOW, ahead of the read that triggered it.
+///////////////////////////////////////////////////////////////////
+
+// An access as dram_ctrl_time() would schedule it
+typedef struct Dram_Slot {
+  Dram_Req       req;
+  Dram_Row_State state;
+  Rowbuf_Entry   rowbuf;      // the page policy after it
+  uns64 data_start;
+  uns64 busy_from;            // the bank is held from here to req.ready
+  uns64 refresh_wait;
+  uns64 act_wait;
+  uns64 turn_wait;
+} Dram_Slot;
+
+static inline uns64 dram_later(uns64 a, uns64 b){
+    return (a > b) ? a : b;
+}
+
+// First refresh of a rank starts at its offset plus one tREFI
+static uns64 dram_refresh_offset(DRAM *dram, uns64 rank_idx){
+    return rank_idx * dram->timing.t_refi / (dram->ctx->dram_channels * dram->ctx->dram_ranks);
+}
+
+// Refreshes the rank has started by cycle
+static uns64 dram_refresh_count(DRAM *dram, uns64 rank_idx, uns64 cycle){
+    uns64 offset = dram_refresh_offset(dram, rank_idx);
+
+    if(!dram->timing.t_refi || cycle < offset){
+      return 0;
+    }
+    return (cycle - offset) / dram->timing.t_refi;
+}
+
+// First cycle at or after cycle that is not in a refresh of the rank
+static uns64 dram_refresh_end(DRAM *dram, uns64 rank_idx, uns64 cycle){
+    uns64 num = dram_refresh_count(dram, rank_idx, cycle);
+    uns64 end = dram_refresh_offset(dram, rank_idx) + num * dram->timing.t_refi + dram->timing.t_rfc;
+
+    return (num && cycle < end) ? end : cycle;
+}
+
+// Whether an ACT at cycle is tRRD away from every ACT of the rank and
+// leaves at most DRAM_FAW_ACTS in each tFAW window around it
+static Flag dram_ctrl_act_ok(DRAM *dram, Dram_Rank *rank, uns64 cycle){
+    Dram_Timing *timing = &dram->timing;
+    uns ii, jj;
+
+    for(ii=0; ii<rank->act_count; ii++){
+      uns64 act = rank->act_cycle[ii];
+      if(act + timing->t_rrd > cycle && act < cycle + timing->t_rrd){
+	return FALSE;
+      }
+    }
+
+    // the windows that hold cycle start at cycle or at an ACT before it
+    for(ii=0; ii<=rank->act_count && timing->t_faw; ii++){
+      uns64 from = (ii < rank->act_count) ? rank->act_cycle[ii] : cycle;
+      uns   num  = 1;
+      if(from > cycle || from + timing->t_faw <= cycle){
+	continue;
+      }
+      for(jj=0; jj<rank->act_count; jj++){
+	num += (rank->act_cycle[jj] >= from && rank->act_cycle[jj] < from + timing->t_faw);
+      }
+      if(num > DRAM_FAW_ACTS){
+	return FALSE;
+      }
+    }
+    return TRUE;
+}
+
+// First cycle at or after cycle at which the rank may ACT. ACTs may
+// already be scheduled on either side, so the answer is cycle itself
+// or tRRD or tFAW after one of them, whichever is the first that fits.
+static uns64 dram_ctrl_act_slot(DRAM *dram, Dram_Rank *rank, uns64 cycle){
+    cycle = dram_later(cycle, rank->act_floor);
+    while(!dram_ctrl_act_ok(dram, rank, cycle)){
+      uns64 next = 0;
+      uns   ii;
+      for(ii=0; ii<rank->act_count; ii++){
+	uns64 rrd = rank->act_cycle[ii] + dram->timing.t_rrd;
+	uns64 faw = rank->act_cycle[ii] + dram->timing.t_faw;
+	if(rrd > cycle && (!next || rrd < next)){
+	  next = rrd;
+	}
+	if(faw > cycle && (!next || faw < next)){
+	  next = faw;
+	}
+      }
+      cycle = next;
+    }
+    return cycle;
+}
 
+static void dram_ctrl_add_act(DRAM *dram, Dram_Rank *rank, uns64 act){
+    uns64 clear = dram_later(dram->timing.t_rrd, dram->timing.t_faw);
+    uns ii, oldest = 0;
+
+    if(rank->act_count < DRAM_ACT_HISTORY){
+      rank->act_cycle[rank->act_count++] = act;
+      return;
+    }
+    for(ii=1; ii<DRAM_ACT_HISTORY; ii++){
+      if(rank->act_cycle[ii] < rank->act_cycle[oldest]){
+	oldest = ii;
+      }
+    }
+    // the earliest ACT, which may be the new one, is dropped
+    if(act < rank->act_cycle[oldest]){
+      rank->act_floor = dram_later(rank->act_floor, act + clear);
+      return;
+    }
+    rank->act_floor = dram_later(rank->act_floor, rank->act_cycle[oldest] + clear);
+    rank->act_cycle[oldest] = act;
+}
+
+// First CAS at or after cas whose burst fits on the data bus of the
+// channel between the bursts scheduled there. With turn, it also
+// keeps tWTR and tRTW to the bursts of the other direction, on both
+// sides. The bursts are in order, so one pass finds the gap: a burst
+// the CAS moves past stays behind it.
+static uns64 dram_ctrl_bus_slot(DRAM *dram, Dram_Channel *channel, Flag is_dram_write, uns64 cas, Flag turn){
+    Dram_Timing *timing = &dram->timing;
+    uns64 t_cl = timing->t_cl, t_burst = timing->t_burst;
+    uns   ii;
+
+    if(cas + t_cl < channel->bus_free){
+      cas = channel->bus_free - t_cl;
+    }
+    if(turn && is_dram_write != channel->last_write){
+      uns64 gap = is_dram_write ? timing->t_rtw : timing->t_wtr;
+      uns64 min = (is_dram_write ? channel->read_cas : channel->bus_free) + gap;
+      if(gap && cas < min){
+	cas = min;
+      }
+    }
+
+    for(ii=0; ii<channel->burst_count; ii++){
+      Dram_Burst *b = &channel->burst[ii];
+      uns64 start = cas + t_cl;
+      Flag  turns = turn && b->is_write != is_dram_write;
+
+      if(start < b->start + t_burst){
+	if(start + t_burst <= b->start){
+	  // after: a write has its data out tWTR before a read CAS, a
+	  // read its CAS tRTW before a write CAS
+	  uns64 min = is_dram_write ? start + t_burst + timing->t_wtr : cas + timing->t_rtw;
+	  if(!turns || b->cas >= min){
+	    break;
+	  }
+	}
+	cas = b->start + t_burst - t_cl;
+      }
+      // before: the same, the other way round
+      if(turns){
+	uns64 min = b->is_write ? b->start + t_burst + timing->t_wtr : b->cas + timing->t_rtw;
+	cas = dram_later(cas, min);
+      }
+    }
+    return cas;
+}
+
+static void dram_ctrl_add_burst(Dram_Channel *channel, uns64 cas, uns64 start, Flag is_dram_write, uns64 t_burst){
+    uns ii;
+
+    // when full, the earliest burst, which may be the new one, goes
+    // into the bus state before the bursts
+    if(channel->burst_count == DRAM_BUS_QUEUE){
+      Dram_Burst b = channel->burst[0];
+      if(start < b.start){
+	b.cas      = cas;
+	b.start    = start;
+	b.is_write = is_dram_write;
+      }
+      else{
+	memmove(&channel->burst[0], &channel->burst[1], (DRAM_BUS_QUEUE-1) * sizeof(Dram_Burst));
+	channel->burst_count--;
+      }
+      channel->bus_free   = b.start + t_burst;
+      channel->last_write = b.is_write;
+      if(!b.is_write){
+	channel->read_cas = b.cas;
+      }
+      if(channel->burst_count == DRAM_BUS_QUEUE){
+	return;
+      }
+    }
+    for(ii=channel->burst_count; ii>0 && channel->burst[ii-1].start > start; ii--){
+      channel->burst[ii] = channel->burst[ii-1];
+    }
+    channel->burst[ii].cas      = cas;
+    channel->burst[ii].start    = start;
+    channel->burst[ii].is_write = is_dram_write;
+    channel->burst_count++;
+}
+
+// The access scheduled last on the bank
+static Dram_Req *dram_ctrl_last(Dram_Bank *bank){
+    return bank->req_count ? &bank->req[bank->req_count-1] : &bank->last;
+}
+
+// Time an access to row arriving at cycle, right after prev on its
+// bank, against the rank's ACTs and the channel's bursts. Ahead of a
+// scheduled access, the row is left as prev left it: a hit keeps it
+// open and an access to a precharged bank closes it again.
+static void dram_ctrl_time(DRAM *dram, uns64 bank_idx, uns64 row, uns64 channel_idx, Flag is_dram_write,
+			   uns64 cycle, Dram_Req *prev, Flag ahead, Dram_Slot *s){
+    Dram_Timing  *timing   = &dram->timing;
+    uns64         rank_idx = bank_idx / dram->ctx->dram_banks;
+    Dram_Rank    *rank     = &dram->ctrl.rank[rank_idx];
+    Dram_Channel *channel  = &dram->ctrl.channel[channel_idx];
+    uns64 t, first;
+
+    s->busy_from = dram_later(cycle, prev->ready);
+    t = dram_refresh_end(dram, rank_idx, s->busy_from);
+    s->refresh_wait = t - s->busy_from;
+
+    // a refresh since the previous access left the bank precharged
+    Flag refreshed = dram_refresh_count(dram, rank_idx, t) != dram_refresh_count(dram, rank_idx, prev->cas);
+    s->state = (refreshed || !prev->open) ? DRAM_ROW_EMPTY :
+               (prev->row == row) ? DRAM_ROW_HIT : DRAM_ROW_CONFLICT;
+
+    s->req.arrival = cycle;
+    s->req.row     = row;
+    s->req.hit     = (s->state == DRAM_ROW_HIT);
+    s->req.act     = prev->act;
+    s->act_wait    = 0;
+    first          = t;
+    if(s->state == DRAM_ROW_CONFLICT){
+      first = dram_later(t, prev->act + timing->t_ras);
+      t     = first + timing->t_rp;
+    }
+    if(s->state != DRAM_ROW_HIT){
+      s->req.act  = dram_ctrl_act_slot(dram, rank, t);
+      s->act_wait = s->req.act - t;
+      if(s->state == DRAM_ROW_EMPTY){
+	first = s->req.act;
+      }
+      t = s->req.act + timing->t_rcd;
+    }
+
+    s->req.cas    = dram_ctrl_bus_slot(dram, channel, is_dram_write, t, TRUE);
+    s->turn_wait  = s->req.cas - dram_ctrl_bus_slot(dram, channel, is_dram_write, t, FALSE);
+    s->data_start = s->req.cas + timing->t_cl;
+    s->req.start  = (s->state == DRAM_ROW_HIT) ? s->req.cas : first;
+
+    // the page policy learns from the accesses in the order they come
+    s->rowbuf = dram->perbank_row_buf[bank_idx];
+    if(refreshed){
+      s->rowbuf.valid = FALSE;
+    }
+    dram_page_policy(dram, &s->rowbuf, row);
+    if(ahead){
+      s->rowbuf.closed = (s->state != DRAM_ROW_HIT);
+    }
+    s->rowbuf.rowid = row;
+    s->rowbuf.valid = !s->rowbuf.closed;
+
+    s->req.open  = s->rowbuf.valid;
+    s->req.ready = s->data_start;
+    if(!s->req.open){
+      // the page policy precharges the row once the data is out
+      s->req.ready = dram_later(s->data_start, s->req.act + timing->t_ras) + timing->t_rp;
+    }
+}
+
+// Schedule an access arriving at cycle, FR-FCFS among the accesses of
+// its bank that have not started by then, and return the cycle at
+// which its data is off the bus. Only with commit are the bank, rank,
+// channel, page policy and stats updated. Otherwise it is an estimate
+// for dram_ctrl_write_idle(). If unloaded is given, it gets the
+// latency the access would have with the bank, rank and channel idle.
+static uns64 dram_ctrl_schedule(DRAM *dram, Addr lineaddr, Flag is_dram_write, uns64 cycle,
+				Flag commit, uns64 *unloaded){
+    Dram_Ctrl   *ctrl   = &dram->ctrl;
+    Dram_Timing *timing = &dram->timing;
+    uns64 bank_idx, row, channel_idx;
+    Dram_Slot s;
+    uns pos, ii;
+
+    dram_map(dram, lineaddr, &bank_idx, &row, &channel_idx);
+    uns64         rank_idx = bank_idx / dram->ctx->dram_banks;
+    Dram_Bank    *bank     = &ctrl->bank[bank_idx];
+    Dram_Channel *channel  = &ctrl->channel[channel_idx];
+
+    if(commit && bank->req_count == DRAM_BANK_QUEUE){
+      bank->last = bank->req[0];
+      memmove(&bank->req[0], &bank->req[1], (DRAM_BANK_QUEUE-1) * sizeof(Dram_Req));
+      bank->req_count--;
+    }
+
+    // the earliest place the access may take and fits in, the end of
+    // the queue at the latest
+    for(pos=0; pos<bank->req_count; pos++){
+      Dram_Req *prev = pos ? &bank->req[pos-1] : &bank->last;
+      Flag may_hit = prev->open && prev->row == row;
+      Flag ahead   = TRUE;
+
+      for(ii=pos; ii<bank->req_count && ahead; ii++){
+	Dram_Req *e = &bank->req[ii];
+	ahead = e->start > cycle && (e->arrival > cycle || (may_hit && !e->hit));
+      }
+      // cheap checks first: it cannot get its data out in time, or it
+      // would need a PRE
+      uns64 from = dram_later(cycle, prev->ready);
+      if(!ahead || from + timing->t_cl > bank->req[pos].start ||
+	 (prev->open && prev->row != row &&
+	  dram_refresh_count(dram, rank_idx, from) == dram_refresh_count(dram, rank_idx, prev->cas))){
+	continue;
+      }
+      dram_ctrl_time(dram, bank_idx, row, channel_idx, is_dram_write, cycle, prev, TRUE, &s);
+      if(s.state != DRAM_ROW_CONFLICT && s.req.ready <= bank->req[pos].start){
+	break;
+      }
+    }
+    if(pos == bank->req_count){
+      dram_ctrl_time(dram, bank_idx, row, channel_idx, is_dram_write, cycle, dram_ctrl_last(bank), FALSE, &s);
+    }
+
+    if(unloaded){
+      *unloaded = timing->t_cl + timing->t_burst +
+	          (s.state != DRAM_ROW_HIT ? timing->t_rcd : 0) + (s.state == DRAM_ROW_CONFLICT ? timing->t_rp : 0);
+    }
+    if(!commit){
+      return s.data_start + timing->t_burst;
+    }
+
+    bank->wq_done = 0;
+    memmove(&bank->req[pos+1], &bank->req[pos], (bank->req_count - pos) * sizeof(Dram_Req));
+    bank->req[pos] = s.req;
+    bank->req_count++;
+    dram->perbank_row_buf[bank_idx] = s.rowbuf;
+
+    if(s.state != DRAM_ROW_HIT){
+      dram_ctrl_add_act(dram, &ctrl->rank[rank_idx], s.req.act);
+    }
+    dram_ctrl_add_burst(channel, s.req.cas, s.data_start, is_dram_write, timing->t_burst);
+
+    dram->stat_row_state[is_dram_write != 0][s.state]++;
+    bank->stat_access++;
+    bank->stat_busy    += s.req.ready - s.busy_from;
+    channel->stat_access++;
+    channel->stat_busy += timing->t_burst;
+    ctrl->stat_refresh_stall += s.refresh_wait;
+    ctrl->stat_act_stall     += s.act_wait;
+    ctrl->stat_turn_stall    += s.turn_wait;
+    return s.data_start + timing->t_burst;
+}
+
+// Index in its bank's queue of the next writeback to issue, FR-FCFS
+// against the row the bank's last scheduled access leaves open
+static uns dram_ctrl_pick_write(Dram_Bank *bank, Flag *row_hit){
+    Dram_Req *last = dram_ctrl_last(bank);
+    uns ii, pick = 0;
+
+    *row_hit = FALSE;
+    for(ii=0; ii<bank->wq_count; ii++){
+      Flag hit = last->open && last->row == bank->wq_row[ii];
+      if((hit && !*row_hit) || (hit == *row_hit && bank->wq_arrival[ii] < bank->wq_arrival[pick])){
+	pick = ii;
+	*row_hit = hit;
+      }
+    }
+    return pick;
+}
+
+static void dram_ctrl_issue_write(DRAM *dram, uns64 bank_idx, uns64 cycle){
+    Dram_Ctrl *ctrl = &dram->ctrl;
+    Dram_Bank *bank = &ctrl->bank[bank_idx];
+    Flag row_hit;
+    uns pick = dram_ctrl_pick_write(bank, &row_hit);
+    uns64 done = dram_ctrl_schedule(dram, bank->wq_lineaddr[pick], TRUE, cycle, TRUE, NULL);
+
+    dram->stat_write_delay += done - bank->wq_arrival[pick];
+
+    bank->wq_count--;
+    bank->wq_done = 0;
+    bank->wq_lineaddr[pick] = bank->wq_lineaddr[bank->wq_count];
+    bank->wq_row[pick]      = bank->wq_row[bank->wq_count];
+    bank->wq_arrival[pick]  = bank->wq_arrival[bank->wq_count];
+    ctrl->wq_total--;
+}
+
+// Writebacks that finish on banks and bus left idle before cycle
+static void dram_ctrl_write_idle(DRAM *dram, uns64 cycle){
+    Dram_Ctrl *ctrl = &dram->ctrl;
+    uns64 bank_idx;
+
+    for(bank_idx=0; bank_idx<dram->num_banks && ctrl->wq_total; bank_idx++){
+      Dram_Bank *bank = &ctrl->bank[bank_idx];
+      while(bank->wq_count){
+	Flag row_hit;
+	uns pick = dram_ctrl_pick_write(bank, &row_hit);
+	// the estimate only grows as other banks take the bus and the
+	// rank, so one past cycle still is
+	if(bank->wq_done <= cycle){
+	  bank->wq_done = dram_ctrl_schedule(dram, bank->wq_lineaddr[pick], TRUE, bank->wq_arrival[pick], FALSE, NULL);
+	}
+	if(bank->wq_done > cycle){
+	  break;
+	}
+	dram_ctrl_issue_write(dram, bank_idx, bank->wq_arrival[pick]);
+	ctrl->stat_write_idle++;
+      }
+    }
+}
+
+// Write drain, FR-FCFS over all the queued writebacks
+static void dram_ctrl_drain(DRAM *dram, uns64 cycle){
+    Dram_Ctrl *ctrl = &dram->ctrl;
+
+    ctrl->stat_write_drains++;
+    while(ctrl->wq_total > DRAM_WQ_LOW){
+      uns64 bank_idx, best_bank = 0, best_arrival = 0;
+      Flag  best_hit = FALSE, found = FALSE;
+
+      for(bank_idx=0; bank_idx<dram->num_banks; bank_idx++){
+	Dram_Bank *bank = &ctrl->bank[bank_idx];
+	Flag row_hit;
+	if(!bank->wq_count){
+	  continue;
+	}
+	uns pick = dram_ctrl_pick_write(bank, &row_hit);
+	if(!found || (row_hit && !best_hit) ||
+	   (row_hit == best_hit && bank->wq_arrival[pick] < best_arrival)){
+	  best_bank    = bank_idx;
+	  best_arrival = bank->wq_arrival[pick];
+	  best_hit     = row_hit;
+	  found        = TRUE;
+	}
+      }
+      dram_ctrl_issue_write(dram, best_bank, cycle);
+    }
+}
+
+static uns64 dram_ctrl_access(DRAM *dram, Addr lineaddr, Flag is_dram_write, uns64 cycle){
+    Dram_Ctrl *ctrl = &dram->ctrl;
+    uns64 bank_idx, row, channel_idx;
+
+    dram_ctrl_write_idle(dram, cycle);
+
+    if(is_dram_write){
+      dram_map(dram, lineaddr, &bank_idx, &row, &channel_idx);
+      Dram_Bank *bank = &ctrl->bank[bank_idx];
+      if(bank->wq_count == DRAM_WQ_BANK_SIZE){
+	dram_ctrl_issue_write(dram, bank_idx, cycle);
+      }
+      bank->wq_lineaddr[bank->wq_count] = lineaddr;
+      bank->wq_row[bank->wq_count]      = row;
+      bank->wq_arrival[bank->wq_count]  = cycle;
+      bank->wq_count++;
+      bank->wq_done = 0;
+      ctrl->wq_total++;
+      dram->stat_write_access++;
+
+      if(ctrl->wq_total >= DRAM_WQ_HIGH){
+	dram_ctrl_drain(dram, cycle);
+      }
+      return 0;
+    }
+
+    // the read queues behind the bank and the bus, not counting its
+    // own row buffer latency
+    uns64 unloaded;
+    uns64 delay = dram_ctrl_schedule(dram, lineaddr, FALSE, cycle, TRUE, &unloaded) - cycle;
+
+    dram->stat_read_access++;
+    dram->stat_read_delay += delay;
+    ctrl->stat_read_queue_delay += delay - unloaded;
     return delay;
 }
 
@@ -6,8 +6,39 @@
 #include <stdlib.h>
 
 #include "types.h"
+#include "simctx.h"
+
+#define DRAM_WQ_BANK_SIZE       16   // write queue entries per bank
+#define DRAM_FAW_ACTS            4   // ACTs a rank may issue within tFAW
+#define DRAM_BANK_QUEUE         16   // scheduled accesses a bank keeps
+#define DRAM_BUS_QUEUE          32   // scheduled bursts a channel keeps
+#define DRAM_ACT_HISTORY        16   // scheduled ACTs a rank keeps
+
+// Fields of a line address, see -dram_map and dram_map()
+typedef enum Dram_Field_Enum {
+    DRAM_FIELD_COLUMN=0,
+    DRAM_FIELD_CHANNEL=1,
+    DRAM_FIELD_BANK=2,
+    DRAM_FIELD_RANK=3,
+    DRAM_FIELD_ROW=4,
+} Dram_Field;
+
+// Row buffer policies, values as given to -dram_page
+typedef enum Dram_Page_Policy_Enum {
+    DRAM_PAGE_OPEN=0,      // rows stay open until a conflict
+    DRAM_PAGE_CLOSED=1,    // every access precharges its row
+    DRAM_PAGE_ADAPTIVE=2,  // per-bank predictor decides whether to close
+} Dram_Page_Policy;
+
+// What an access finds in its bank's row buffer
+typedef enum Dram_Row_State_Enum {
+    DRAM_ROW_HIT=0,        // the row is open: CAS
+    DRAM_ROW_EMPTY=1,      // no row is open: ACT, CAS
+    DRAM_ROW_CONFLICT=2,   // another row is open: PRE, ACT, CAS
+    NUM_DRAM_ROW_STATES
+} Dram_Row_State;
+
 
-#define MAX_DRAM_BANKS          256
 
 
 
@@ -16,22 +47,123 @@
 
 typedef struct DRAM   DRAM;
 typedef struct Rowbuf_Entry Rowbuf_Entry;
+typedef struct Dram_Req     Dram_Req;
+typedef struct Dram_Burst   Dram_Burst;
+typedef struct Dram_Bank    Dram_Bank;
+typedef struct Dram_Rank    Dram_Rank;
+typedef struct Dram_Channel Dram_Channel;
+typedef struct Dram_Timing  Dram_Timing;
+typedef struct Dram_Ctrl    Dram_Ctrl;
 
 
 struct Rowbuf_Entry {
   Flag valid; // 0 means the rowbuffer entry is invalid
-  uns64 rowid; // If the entry is valid, which row?
+  uns64 rowid; // If the entry is valid, which row? Else the last row open
+  Flag closed; // the page policy closed rowid after its last access
+  uns8 keep_open; // DRAM_PAGE_ADAPTIVE: 2-bit counter, >=2 keeps the row open
+};
+
+
+// DRAM timing in core cycles, converted from the ns of -dram_timing
+struct Dram_Timing {
+  uns64 t_cl;      // read/write CAS to data
+  uns64 t_rcd;     // ACT to CAS
+  uns64 t_rp;      // PRE to ACT
+  uns64 t_ras;     // ACT to PRE
+  uns64 t_rrd;     // ACT to ACT in a rank
+  uns64 t_faw;     // window with at most DRAM_FAW_ACTS ACTs in a rank
+  uns64 t_wtr;     // end of write data to a read CAS on the channel
+  uns64 t_rtw;     // read CAS to a write CAS on the channel
+  uns64 t_refi;    // refresh interval of a rank, 0 is no refresh
+  uns64 t_rfc;     // the rank is blacked out this long by a refresh
+  uns64 t_burst;   // data bus cycles per line
+};
+
+// One access the controller has scheduled on a bank
+struct Dram_Req {
+  uns64 arrival;
+  uns64 start;         // its first command: PRE, ACT or CAS
+  uns64 ready;         // the bank can take the next command
+  uns64 act;           // ACT of the row it leaves behind, for tRAS
+  uns64 cas;           // a refresh since then closed the row
+  uns64 row;
+  Flag  open;          // the row stays open after it
+  Flag  hit;           // it found its row open
 };
 
+// One burst on the data bus of a channel
+struct Dram_Burst {
+  uns64 cas;
+  uns64 start;         // first cycle of the data
+  Flag  is_write;
+};
+
+// Controller view of one bank (-dram_ctrl): the accesses scheduled on
+// it and the writebacks waiting for it
+struct Dram_Bank {
+  Dram_Req last;                   // the latest access no longer in req
+  Dram_Req req[DRAM_BANK_QUEUE];   // in the order of their first command
+  uns   req_count;
+  uns   wq_count;
+  Addr  wq_lineaddr[DRAM_WQ_BANK_SIZE];
+  uns64 wq_row[DRAM_WQ_BANK_SIZE];
+  uns64 wq_arrival[DRAM_WQ_BANK_SIZE];
+  uns64 wq_done;       // estimated end of the next writeback, 0:unknown
+
+   // stats
+  uns64 stat_access;
+  uns64 stat_busy;     // cycles from a command until the bank can take the next
+};
+
+// ACTs of one rank, for tRRD and tFAW
+struct Dram_Rank {
+  uns64 act_cycle[DRAM_ACT_HISTORY];  // the latest ACTs, in no order
+  uns   act_count;                    // entries of act_cycle in use
+  uns64 act_floor;                    // clear of the ACTs no longer kept
+};
+
+// Each channel has its own data bus, shared by its ranks and banks
+struct Dram_Channel {
+  Dram_Burst burst[DRAM_BUS_QUEUE];   // by start
+  uns   burst_count;
+  uns64 bus_free;      // end of the bursts no longer in burst
+  uns64 read_cas;      // last read CAS among them, for tRTW
+  Flag  last_write;    // the last of them was a write, for tWTR
+
+   // stats
+  uns64 stat_access;
+  uns64 stat_busy;     // cycles the bus carried data
+};
+
+// Memory controller state, see dram_ctrl_access()
+struct Dram_Ctrl {
+  Dram_Bank    *bank;     // num_banks, indexed as in dram_map()
+  Dram_Rank    *rank;     // num_banks / ctx->dram_banks
+  Dram_Channel *channel;  // ctx->dram_channels
+  uns   wq_total;      // writebacks queued over all banks
+
+   // stats
+  uns64 stat_read_queue_delay;  // cycles reads waited for a bank or the bus
+  uns64 stat_write_drains;      // times the high watermark was reached
+  uns64 stat_write_idle;        // writebacks done while the bank was idle
+  uns64 stat_refresh_stall;     // cycles commands waited out a refresh
+  uns64 stat_act_stall;         // cycles ACTs waited for tRRD/tFAW
+  uns64 stat_turn_stall;        // cycles CASes waited for tWTR/tRTW
+};
 
 struct DRAM {
-  Rowbuf_Entry perbank_row_buf[MAX_DRAM_BANKS];
+  SimContext *ctx;
+  uns64 num_banks;     // over all channels and ranks
+  Rowbuf_Entry *perbank_row_buf;
+  Dram_Timing timing;
+  Dram_Ctrl ctrl;
   
    // stats 
   uns64 stat_read_access;
   uns64 stat_write_access;
   uns64 stat_read_delay;
   uns64 stat_write_delay;
+  uns64 stat_row_state[2][NUM_DRAM_ROW_STATES]; // [is_dram_write][Dram_Row_State]
 };
 
 
@@ -39,9 +171,12 @@ struct DRAM {
 //////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////
 
-DRAM   *dram_new();
+DRAM   *dram_new(SimContext *ctx);
+void    dram_free(DRAM *dram);
+void    dram_reset_stats(DRAM *dram);
 void    dram_print_stats(DRAM *dram);
 uns64   dram_access(DRAM *dram,Addr lineaddr, Flag is_dram_write);
+uns64   dram_access_at(DRAM *dram, Addr lineaddr, Flag is_dram_write, uns64 cycle);
 uns64   dram_access_sim_rowbuf(DRAM *dram,Addr lineaddr, Flag is_dram_write);
 
 
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "memsim.h"
+#include "parallel.h"
+
+#define DOT_INTERVAL 100000
+
+static Sim   *sim_alloc(SimContext *cfg);
+static uns64  sim_next_active_cycle(Sim *sim);
+static void   sim_print_dots(Sim *sim);
+static void   sim_run_sampled(Sim *sim);
+
+////////////////////////////////////////////////////////////////////
+// Build the memory system and one core per trace file
+////////////////////////////////////////////////////////////////////
+
+Sim *sim_new(SimContext *cfg, char **trace_fname)
+{
+  Sim *sim = sim_alloc(cfg);
+  uns ii;
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    sim->core[ii] = core_new(&sim->ctx, sim->memsys, trace_fname[ii], ii);
+  }
+
+  sim_print_dots(sim);
+  return sim;
+}
+
+////////////////////////////////////////////////////////////////////
+// Same, but every core reads its own clone of an already loaded
+// trace, so many simulations can share one decoded copy.
+////////////////////////////////////////////////////////////////////
+
+Sim *sim_new_from_traces(SimContext *cfg, Trace **trace)
+{
+  Sim *sim = sim_alloc(cfg);
+  uns ii;
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    sim->core[ii] = core_new_from_trace(&sim->ctx, sim->memsys, trace_clone(trace[ii]), ii);
+  }
+
+  sim_print_dots(sim);
+  return sim;
+}
+
+static Sim *sim_alloc(SimContext *cfg)
+{
+  Sim *sim = (Sim *) calloc (1, sizeof (Sim));
+
+  assert(cfg->num_cores<=MAX_CORES);
+
+  sim->ctx       = *cfg;
+  sim->ctx.cycle = 0;
+  sim->memsys    = memsys_new(&sim->ctx);
+  sim->core      = (Core **) calloc (cfg->num_cores, sizeof (Core *));
+
+  return sim;
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+void sim_free(Sim *sim)
+{
+  uns ii;
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    core_free(sim->core[ii]);
+  }
+  memsys_free(sim->memsys);
+  free(sim->core);
+  free(sim);
+}
+
+////////////////////////////////////////////////////////////////////
+// Cycle every core once and advance the clock. Returns TRUE once all
+// cores have run out of trace.
+////////////////////////////////////////////////////////////////////
+
+Flag sim_step(Sim *sim)
+{
+  SimContext *ctx = &sim->ctx;
+  Flag all_cores_done = 1;
+  uns ii;
+
+  if(sim->done){
+    return TRUE;
+  }
+
+  for(ii=0; ii<ctx->num_cores; ii++){
+    core_cycle(sim->core[ii]);
+    all_cores_done &= sim->core[ii]->done;
+  }
+
+  return sim_end_cycle(sim, all_cores_done);
+}
+
+////////////////////////////////////////////////////////////////////
+// Close the cycle every core has just run: heartbeat, then move the
+// clock to the next cycle worth running. Returns TRUE once all cores
+// are done.
+////////////////////////////////////////////////////////////////////
+
+Flag sim_end_cycle(Sim *sim, Flag all_cores_done)
+{
+  SimContext *ctx = &sim->ctx;
+
+  if (ctx->cycle - sim->last_printdot_cycle >= DOT_INTERVAL){
+    sim_print_dots(sim);
+  }
+
+  if(ctx->skip_idle_cycles && !all_cores_done){
+    ctx->cycle = sim_next_active_cycle(sim);
+  }
+  else{
+    ctx->cycle++;
+  }
+
+  sim->done = all_cores_done;
+  return sim->done;
+}
+
+////////////////////////////////////////////////////////////////////
+// Run num_inst instructions (over all cores, one at a time from each
+// in turn) functionally: caches are warmed, no time passes.
+////////////////////////////////////////////////////////////////////
+
+void sim_ffwd(Sim *sim, uns64 num_inst)
+{
+  uns64 count = 0;
+  Flag  all_cores_done = FALSE;
+  uns   ii;
+
+  while(count < num_inst && !all_cores_done){
+    all_cores_done = TRUE;
+    for(ii=0; ii<sim->ctx.num_cores && count < num_inst; ii++){
+      if(!sim->core[ii]->done){
+	core_ffwd(sim->core[ii]);
+	count++;
+	all_cores_done = FALSE;
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// Forget everything counted so far; the machine state is untouched
+////////////////////////////////////////////////////////////////////
+
+void sim_reset_stats(Sim *sim)
+{
+  uns ii;
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    core_reset_stats(sim->core[ii]);
+  }
+  memsys_reset_stats(sim->memsys);
+  sim->ctx.stat_cycle = sim->ctx.cycle;
+}
+
+////////////////////////////////////////////////////////////////////
+// Fast-forward ffwd_inst instructions, run warmup_inst more with
+// timing but without keeping their stats, then iterate until all
+// cores are done
+////////////////////////////////////////////////////////////////////
+
+void sim_run(Sim *sim)
+{
+  if(sim->ctx.ffwd_inst){
+    sim_ffwd(sim, sim->ctx.ffwd_inst);
+  }
+
+  if(sim->ctx.warmup_inst){
+    sim_step_inst(sim, sim->ctx.warmup_inst);
+  }
+
+  if(sim->ctx.ffwd_inst || sim->ctx.warmup_inst){
+    sim_reset_stats(sim);
+  }
+
+  if(sim->ctx.sample_period){
+    sim_run_sampled(sim);
+    return;
+  }
+
+  if(sim->ctx.threads > 1 && sim->ctx.num_cores > 1){
+    sim_run_parallel(sim);
+    return;
+  }
+
+  while(!sim_step(sim)){
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// Step until num_inst more instructions have run (or the traces end)
+////////////////////////////////////////////////////////////////////
+
+void sim_step_inst(Sim *sim, uns64 num_inst)
+{
+  uns64 end = sim_inst_count(sim) + num_inst;
+  uns64 count;
+  uns   ii;
+
+  // an out-of-order core retires up to -width a cycle: the cores that
+  // still run share what is left, so that together they stop at the
+  // end and the next region starts at the same instruction
+  while((count = sim_inst_count(sim)) < end){
+    if(sim->ctx.core_model){
+      uns64 left = end - count;
+      uns   num_running = 0, pos = 0;
+      for(ii=0; ii<sim->ctx.num_cores; ii++){
+        num_running += !sim->core[ii]->done;
+      }
+      for(ii=0; ii<sim->ctx.num_cores; ii++){
+        Core *c = sim->core[ii];
+        if(!c->done){
+          c->retire_limit = c->inst_count + left/num_running + (pos++ < left%num_running);
+        }
+      }
+    }
+    if(sim_step(sim)){
+      break;
+    }
+  }
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    sim->core[ii]->retire_limit = CORE_NEVER;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// SMARTS-style sampling: each period fast-forwards functionally,
+// runs sample_warmup instructions in detail to settle the DRAM rows
+// and core timing, then measures sample_unit detailed instructions.
+// A unit cut short by the end of the traces is dropped.
+////////////////////////////////////////////////////////////////////
+
+static void sim_run_sampled(Sim *sim)
+{
+  SimContext *ctx = &sim->ctx;
+  Sample     *s   = &sim->sample;
+
+  if(ctx->sample_unit == 0 || ctx->sample_period < ctx->sample_warmup + ctx->sample_unit){
+    die_message("-sample_period must cover -sample_warmup plus a non-empty -sample_unit");
+  }
+
+  while(!sim->done){
+    Sim_Counters cnt;
+
+    sim_ffwd(sim, ctx->sample_period - ctx->sample_warmup - ctx->sample_unit);
+    sim_step_inst(sim, ctx->sample_warmup);
+
+    sim_read_counters(sim, &cnt);
+    sim_step_inst(sim, ctx->sample_unit);
+    sim_counters_delta(sim, &cnt);
+
+    if(cnt.inst < ctx->sample_unit){
+      break;
+    }
+
+    s->units++;
+    s->inst += cnt.inst;
+    sample_add(&s->ipc,          cnt.inst,         cnt.cycles);
+    sample_add(&s->ifetch_delay, cnt.ifetch_delay, cnt.ifetch_access);
+    sample_add(&s->load_delay,   cnt.load_delay,   cnt.load_access);
+    sample_add(&s->store_delay,  cnt.store_delay,  cnt.store_access);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+void sim_print_stats(Sim *sim)
+{
+  uns ii;
+
+  fprintf(sim->ctx.out, "\n");
+  fprintf(sim->ctx.out, "\nCYCLES      \t\t\t : %10llu", sim->ctx.cycle - sim->ctx.stat_cycle);
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    core_print_stats(sim->core[ii]);
+  }
+
+  memsys_print_stats(sim->memsys);
+
+  if(sim->ctx.sample_period){
+    sample_print_stats(&sim->sample, sim->ctx.out);
+  }
+
+  fprintf(sim->ctx.out, "\n\n");
+}
+
+////////////////////////////////////////////////////////////////////
+// Instructions executed so far, summed over all cores
+////////////////////////////////////////////////////////////////////
+
+uns64 sim_inst_count(Sim *sim)
+{
+  uns64 count = 0;
+  uns ii;
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    count += sim->core[ii]->inst_count;
+  }
+  return count;
+}
+
+////////////////////////////////////////////////////////////////////
+// Snapshot the totals; delta turns a snapshot into the change since
+////////////////////////////////////////////////////////////////////
+
+void sim_read_counters(Sim *sim, Sim_Counters *cnt)
+{
+  Memsys *sys = sim->memsys;
+
+  cnt->inst          = sim_inst_count(sim);
+  cnt->cycles        = sim->ctx.cycle;
+  cnt->ifetch_access = sys->stat_ifetch_access;
+  cnt->ifetch_delay  = sys->stat_ifetch_delay;
+  cnt->load_access   = sys->stat_load_access;
+  cnt->load_delay    = sys->stat_load_delay;
+  cnt->store_access  = sys->stat_store_access;
+  cnt->store_delay   = sys->stat_store_delay;
+}
+
+void sim_counters_delta(Sim *sim, Sim_Counters *cnt)
+{
+  Sim_Counters now;
+
+  sim_read_counters(sim, &now);
+  cnt->inst          = now.inst          - cnt->inst;
+  cnt->cycles        = now.cycles        - cnt->cycles;
+  cnt->ifetch_access = now.ifetch_access - cnt->ifetch_access;
+  cnt->ifetch_delay  = now.ifetch_delay  - cnt->ifetch_delay;
+  cnt->load_access   = now.load_access   - cnt->load_access;
+  cnt->load_delay    = now.load_delay    - cnt->load_delay;
+  cnt->store_access  = now.store_access  - cnt->store_access;
+  cnt->store_delay   = now.store_delay   - cnt->store_delay;
+}
+
+////////////////////////////////////////////////////////////////////
+// Find the next cycle in which some core can make progress. Every
+// active core is asleep until its snooze_end_cycle, so the cycles in
+// between would only spin the loop. The jump is capped at the next
+// heartbeat so the dots fire on the same cycles as the lock-step loop.
+////////////////////////////////////////////////////////////////////
+
+static uns64 sim_next_active_cycle(Sim *sim)
+{
+  uns ii;
+  uns64 next = sim->ctx.cycle+1;
+  uns64 wake = (uns64)(-1);
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    Core *c = sim->core[ii];
+    if(!c->done && c->snooze_end_cycle+1 < wake){
+      wake = c->snooze_end_cycle+1;
+    }
+  }
+
+  if(wake > next){
+    next = wake;
+  }
+
+  if(next > sim->last_printdot_cycle + DOT_INTERVAL){
+    next = sim->last_printdot_cycle + DOT_INTERVAL;
+  }
+
+  return next;
+}
+
+////////////////////////////////////////////////////////////////////
+// Heartbeat
+////////////////////////////////////////////////////////////////////
+
+static void sim_print_dots(Sim *sim)
+{
+  uns64 cycle = sim->ctx.cycle;
+  uns LINE_INTERVAL = 50 *  DOT_INTERVAL;
+
+  sim->last_printdot_cycle = cycle;
+
+  if(!sim->ctx.print_dots){
+    return;
+  }
+
+  if (cycle % LINE_INTERVAL ==0){
+    fprintf(sim->ctx.out, "\n%4llu M\t", cycle/1000000);
+    fflush(sim->ctx.out);
+  }
+  else{
+    fprintf(sim->ctx.out, ".");
+    fflush(sim->ctx.out);
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef MEMSIM_H
+#define MEMSIM_H
+
+#include "types.h"
+#include "simctx.h"
+#include "memsys.h"
+#include "core.h"
+#include "trace.h"
+#include "sample.h"
+
+//////////////////////////////////////////////////////////////////
+// libmemsim: one simulation of NUM_CORES cores over a memory system.
+// Each Sim keeps its own copy of the configuration (clock, random
+// state included), so any number of them can run in one process.
+//
+//   SimContext cfg;
+//   simctx_init(&cfg);             // defaults, then set fields or
+//   simctx_option(&cfg, ...);      // apply command line options
+//   Sim *sim = sim_new(&cfg, trace_fnames);
+//   sim_run(sim);                  // or: while(!sim_step(sim)) ...
+//                                  // (sim_run honours -ffwd/-warmup)
+//   sim_print_stats(sim);
+//   sim_free(sim);
+//////////////////////////////////////////////////////////////////
+
+typedef struct Sim          Sim;
+typedef struct Sim_Counters Sim_Counters;
+
+struct Sim {
+  SimContext  ctx;
+  Memsys     *memsys;
+  Core      **core;    // ctx.num_cores of them
+  uns64       last_printdot_cycle;
+  Flag        done;
+  Sample      sample;  // estimates of a sampled run (ctx.sample_period)
+};
+
+// Running totals, to measure a region of a run by difference
+struct Sim_Counters {
+  uns64 inst;
+  uns64 cycles;
+  uns64 ifetch_access;
+  uns64 ifetch_delay;
+  uns64 load_access;
+  uns64 load_delay;
+  uns64 store_access;
+  uns64 store_delay;
+};
+
+//////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+Sim   *sim_new            (SimContext *cfg, char **trace_fname);
+Sim   *sim_new_from_traces(SimContext *cfg, Trace **trace);
+void   sim_free           (Sim *sim);
+Flag   sim_step           (Sim *sim);
+Flag   sim_end_cycle      (Sim *sim, Flag all_cores_done);
+void   sim_run            (Sim *sim);
+void   sim_ffwd           (Sim *sim, uns64 num_inst);
+void   sim_step_inst      (Sim *sim, uns64 num_inst);
+void   sim_reset_stats    (Sim *sim);
+void   sim_print_stats    (Sim *sim);
+uns64  sim_inst_count     (Sim *sim);
+void   sim_read_counters  (Sim *sim, Sim_Counters *cnt);
+void   sim_counters_delta (Sim *sim, Sim_Counters *cnt);
+
+//////////////////////////////////////////////////////////////////
+
+#endif // MEMSIM_H
@@ -8,64 +8,145 @@
 
 #define PAGE_SIZE 4096
 
+// counters shared by all cores, see Memsys.shared_lock
+#define MEMSYS_STAT_ADD(sys, stat, val)                                  \
+    do {                                                                 \
+        if((sys)->shared_lock)                                           \
+            __atomic_fetch_add(&(sys)->stat, (val), __ATOMIC_RELAXED);   \
+        else                                                             \
+            (sys)->stat += (val);                                        \
+    } while(0)
+
 //---- Cache Latencies  ------
 
 #define DCACHE_HIT_LATENCY   1
 #define ICACHE_HIT_LATENCY   1
 #define L2CACHE_HIT_LATENCY  10
 
-extern MODE   SIM_MODE;
-extern uns64  CACHE_LINESIZE;
-extern uns64  REPL_POLICY;
-
-extern uns64  DCACHE_SIZE;
-extern uns64  DCACHE_ASSOC;
-extern uns64  ICACHE_SIZE;
-extern uns64  ICACHE_ASSOC;
-extern uns64  L2CACHE_SIZE;
-extern uns64  L2CACHE_ASSOC;
-extern uns64  L2CACHE_REPL;
-extern uns64  NUM_CORES;
+static void  memsys_l2_new(Memsys *sys, uns64 repl_policy);
+static uns   memsys_l2_slice(Memsys *sys, Addr lineaddr, Addr *slice_lineaddr);
+static Addr  memsys_l2_lineaddr(Memsys *sys, uns slice_id, Addr slice_lineaddr);
+static uns64 memsys_l2_nuca_delay(Memsys *sys, uns slice_id, uns core_id, uns64 now);
+static uns64 memsys_l2_access_at(Memsys *sys, Addr lineaddr, Flag is_writeback, uns core_id, uns64 cycle);
+static uns64 memsys_l1_mshr_access(Memsys *sys, Cache *c, Addr lineaddr, Flag result, uns64 hit_delay, uns core_id);
+static Flag  memsys_l1_access(Memsys *sys, Cache *c, Addr lineaddr, Flag is_write, uns core_id, uns64 *delay, Cache_Line *evicted);
+static uns64 memsys_core_cycle(Memsys *sys, uns core_id);
+static void  memsys_l2_print_stats(Memsys *sys);
 
 ////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////
 
 
-Memsys *memsys_new(void)
+Memsys *memsys_new(SimContext *ctx)
 {
     Memsys *sys = (Memsys *) calloc (1, sizeof (Memsys));
+    sys->ctx = ctx;
+    sys->sdprof = (Stackdist **) calloc (ctx->num_cores, sizeof (Stackdist *));
 
-      if(SIM_MODE==SIM_MODE_A){
-        sys->dcache = cache_new(DCACHE_SIZE, DCACHE_ASSOC, CACHE_LINESIZE, REPL_POLICY);
+      if(ctx->sim_mode==SIM_MODE_A){
+        sys->dcache = cache_new(ctx, ctx->dcache_size, ctx->dcache_assoc, ctx->cache_linesize, ctx->repl_policy);
       }
 
-      if(SIM_MODE==SIM_MODE_B){
-        sys->dcache = cache_new(DCACHE_SIZE, DCACHE_ASSOC, CACHE_LINESIZE, REPL_POLICY);
-        sys->icache = cache_new(ICACHE_SIZE, ICACHE_ASSOC, CACHE_LINESIZE, REPL_POLICY);
-        sys->l2cache = cache_new(L2CACHE_SIZE, L2CACHE_ASSOC, CACHE_LINESIZE, REPL_POLICY);
-        sys->dram    = dram_new();
+      if(ctx->sim_mode==SIM_MODE_B){
+        sys->dcache = cache_new(ctx, ctx->dcache_size, ctx->dcache_assoc, ctx->cache_linesize, ctx->repl_policy);
+        sys->icache = cache_new(ctx, ctx->icache_size, ctx->icache_assoc, ctx->cache_linesize, ctx->repl_policy);
+        cache_mshr_init(sys->dcache, ctx->l1_mshrs);
+        cache_mshr_init(sys->icache, ctx->l1_mshrs);
+        memsys_l2_new(sys, ctx->repl_policy);
+        sys->dram    = dram_new(ctx);
       }
 
-      if(SIM_MODE==SIM_MODE_C){
-        sys->dcache = cache_new(DCACHE_SIZE, DCACHE_ASSOC, CACHE_LINESIZE, REPL_POLICY);
-        sys->icache = cache_new(ICACHE_SIZE, ICACHE_ASSOC, CACHE_LINESIZE, REPL_POLICY);
-        sys->l2cache = cache_new(L2CACHE_SIZE, L2CACHE_ASSOC, CACHE_LINESIZE, REPL_POLICY);
-        sys->dram    = dram_new();
+      if(ctx->sim_mode==SIM_MODE_C){
+        sys->dcache = cache_new(ctx, ctx->dcache_size, ctx->dcache_assoc, ctx->cache_linesize, ctx->repl_policy);
+        sys->icache = cache_new(ctx, ctx->icache_size, ctx->icache_assoc, ctx->cache_linesize, ctx->repl_policy);
+        cache_mshr_init(sys->dcache, ctx->l1_mshrs);
+        cache_mshr_init(sys->icache, ctx->l1_mshrs);
+        memsys_l2_new(sys, ctx->repl_policy);
+        sys->dram    = dram_new(ctx);
       }
 
-      if( (SIM_MODE==SIM_MODE_D) || (SIM_MODE==SIM_MODE_E) || (SIM_MODE==SIM_MODE_F) ) {
-        sys->l2cache = cache_new(L2CACHE_SIZE, L2CACHE_ASSOC, CACHE_LINESIZE, L2CACHE_REPL);
-        sys->dram    = dram_new();
+      if( (ctx->sim_mode==SIM_MODE_D) || (ctx->sim_mode==SIM_MODE_E) || (ctx->sim_mode==SIM_MODE_F) ) {
+        memsys_l2_new(sys, ctx->l2cache_repl);
+        sys->dram    = dram_new(ctx);
         uns ii;
-        for(ii=0; ii<NUM_CORES; ii++){
-          sys->dcache_coreid[ii] = cache_new(DCACHE_SIZE, DCACHE_ASSOC, CACHE_LINESIZE, REPL_POLICY);
-          sys->icache_coreid[ii] = cache_new(ICACHE_SIZE, ICACHE_ASSOC, CACHE_LINESIZE, REPL_POLICY);
+        sys->dcache_coreid = (Cache **) calloc (ctx->num_cores, sizeof (Cache *));
+        sys->icache_coreid = (Cache **) calloc (ctx->num_cores, sizeof (Cache *));
+        for(ii=0; ii<ctx->num_cores; ii++){
+          sys->dcache_coreid[ii] = cache_new(ctx, ctx->dcache_size, ctx->dcache_assoc, ctx->cache_linesize, ctx->repl_policy);
+          sys->icache_coreid[ii] = cache_new(ctx, ctx->icache_size, ctx->icache_assoc, ctx->cache_linesize, ctx->repl_policy);
+          cache_mshr_init(sys->dcache_coreid[ii], ctx->l1_mshrs);
+          cache_mshr_init(sys->icache_coreid[ii], ctx->l1_mshrs);
         }
       }
 
       return sys;
 }
 
+////////////////////////////////////////////////////////////////////
+// Release the memory system and every cache it allocated
+////////////////////////////////////////////////////////////////////
+
+void memsys_free(Memsys *sys)
+{
+    uns ii;
+
+    if(sys->dcache)  cache_free(sys->dcache);
+    if(sys->icache)  cache_free(sys->icache);
+    if(sys->dram)    dram_free(sys->dram);
+
+    for(ii=0; ii<sys->num_l2_slices; ii++){
+      cache_free(sys->l2slice[ii].cache);
+    }
+
+    for(ii=0; ii<sys->ctx->num_cores; ii++){
+      if(sys->dcache_coreid) cache_free(sys->dcache_coreid[ii]);
+      if(sys->icache_coreid) cache_free(sys->icache_coreid[ii]);
+      if(sys->sdprof[ii])    stackdist_free(sys->sdprof[ii]);
+    }
+
+    free(sys->l2slice);
+    free(sys->dcache_coreid);
+    free(sys->icache_coreid);
+    free(sys->sdprof);
+    free(sys);
+}
+
+////////////////////////////////////////////////////////////////////
+// Zero every counter of the memory system (after fast-forward and
+// warmup), leaving the cache and row buffer contents as they are
+////////////////////////////////////////////////////////////////////
+
+void memsys_reset_stats(Memsys *sys)
+{
+    uns ii;
+
+    sys->stat_ifetch_access = 0;
+    sys->stat_load_access   = 0;
+    sys->stat_store_access  = 0;
+    sys->stat_ifetch_delay  = 0;
+    sys->stat_load_delay    = 0;
+    sys->stat_store_delay   = 0;
+
+    if(sys->dcache)  cache_reset_stats(sys->dcache);
+    if(sys->icache)  cache_reset_stats(sys->icache);
+    if(sys->dram)    dram_reset_stats(sys->dram);
+
+    for(ii=0; ii<sys->num_l2_slices; ii++){
+      L2_Slice *slice = &sys->l2slice[ii];
+      cache_reset_stats(slice->cache);
+      slice->stat_access      = 0;
+      slice->stat_hops        = 0;
+      slice->stat_conflicts   = 0;
+      slice->stat_queue_delay = 0;
+    }
+
+    for(ii=0; ii<sys->ctx->num_cores; ii++){
+      if(sys->dcache_coreid) cache_reset_stats(sys->dcache_coreid[ii]);
+      if(sys->icache_coreid) cache_reset_stats(sys->icache_coreid[ii]);
+      if(sys->sdprof[ii])    stackdist_reset_stats(sys->sdprof[ii]);
+    }
+}
+
 
 ////////////////////////////////////////////////////////////////////
 // This function takes an ifetch/ldst access and returns the delay
@@ -77,34 +158,34 @@ uns64 memsys_access(Memsys *sys, Addr addr, Access_Type type, uns core_id)
 
 
     // all cache transactions happen at line granularity, so get lineaddr
-    Addr lineaddr=addr/CACHE_LINESIZE;
+    Addr lineaddr=addr/sys->ctx->cache_linesize;
 
-    if(SIM_MODE==SIM_MODE_A){
+    if(sys->ctx->sim_mode==SIM_MODE_A){
         delay = memsys_access_modeA(sys,lineaddr,type, core_id);
     }
 
-    if((SIM_MODE==SIM_MODE_B)||(SIM_MODE==SIM_MODE_C)){
+    if((sys->ctx->sim_mode==SIM_MODE_B)||(sys->ctx->sim_mode==SIM_MODE_C)){
         delay = memsys_access_modeBC(sys,lineaddr,type, core_id);
     }
 
-    if((SIM_MODE==SIM_MODE_D)||(SIM_MODE==SIM_MODE_E) ||(SIM_MODE==SIM_MODE_F)  ){
+    if((sys->ctx->sim_mode==SIM_MODE_D)||(sys->ctx->sim_mode==SIM_MODE_E) ||(sys->ctx->sim_mode==SIM_MODE_F)  ){
         delay = memsys_access_modeDEF(sys,lineaddr,type, core_id);
     }
 
     //update the stats
     if(type==ACCESS_TYPE_IFETCH){
-        sys->stat_ifetch_access++;
-        sys->stat_ifetch_delay+=delay;
+        MEMSYS_STAT_ADD(sys, stat_ifetch_access, 1);
+        MEMSYS_STAT_ADD(sys, stat_ifetch_delay, delay);
     }
 
     if(type==ACCESS_TYPE_LOAD){
-        sys->stat_load_access++;
-        sys->stat_load_delay+=delay;
+        MEMSYS_STAT_ADD(sys, stat_load_access, 1);
+        MEMSYS_STAT_ADD(sys, stat_load_delay, delay);
     }
 
     if(type==ACCESS_TYPE_STORE){
-        sys->stat_store_access++;
-        sys->stat_store_delay+=delay;
+        MEMSYS_STAT_ADD(sys, stat_store_access, 1);
+        MEMSYS_STAT_ADD(sys, stat_store_delay, delay);
     }
 
 
@@ -138,33 +219,40 @@ void memsys_print_stats(Memsys *sys)
   }
 
 
-  printf("\n");
-  printf("\n%s_IFETCH_ACCESS  \t\t : %10llu",  header, sys->stat_ifetch_access);
-  printf("\n%s_LOAD_ACCESS    \t\t : %10llu",  header, sys->stat_load_access);
-  printf("\n%s_STORE_ACCESS   \t\t : %10llu",  header, sys->stat_store_access);
-  printf("\n%s_IFETCH_AVGDELAY\t\t : %10.3f",  header, ifetch_delay_avg);
-  printf("\n%s_LOAD_AVGDELAY  \t\t : %10.3f",  header, load_delay_avg);
-  printf("\n%s_STORE_AVGDELAY \t\t : %10.3f",  header, store_delay_avg);
-  printf("\n");
+  fprintf(sys->ctx->out, "\n");
+  fprintf(sys->ctx->out, "\n%s_IFETCH_ACCESS  \t\t : %10llu",  header, sys->stat_ifetch_access);
+  fprintf(sys->ctx->out, "\n%s_LOAD_ACCESS    \t\t : %10llu",  header, sys->stat_load_access);
+  fprintf(sys->ctx->out, "\n%s_STORE_ACCESS   \t\t : %10llu",  header, sys->stat_store_access);
+  fprintf(sys->ctx->out, "\n%s_IFETCH_AVGDELAY\t\t : %10.3f",  header, ifetch_delay_avg);
+  fprintf(sys->ctx->out, "\n%s_LOAD_AVGDELAY  \t\t : %10.3f",  header, load_delay_avg);
+  fprintf(sys->ctx->out, "\n%s_STORE_AVGDELAY \t\t : %10.3f",  header, store_delay_avg);
+  fprintf(sys->ctx->out, "\n");
 
-   if(SIM_MODE==SIM_MODE_A){
+   if(sys->ctx->sim_mode==SIM_MODE_A){
     cache_print_stats(sys->dcache, "DCACHE");
   }
 
-  if((SIM_MODE==SIM_MODE_B)||(SIM_MODE==SIM_MODE_C)){
+  if((sys->ctx->sim_mode==SIM_MODE_B)||(sys->ctx->sim_mode==SIM_MODE_C)){
     cache_print_stats(sys->icache, "ICACHE");
+    cache_print_mshr_stats(sys->icache, "ICACHE");
     cache_print_stats(sys->dcache, "DCACHE");
-    cache_print_stats(sys->l2cache, "L2CACHE");
+    cache_print_mshr_stats(sys->dcache, "DCACHE");
+    memsys_l2_print_stats(sys);
     dram_print_stats(sys->dram);
   }
 
-  if((SIM_MODE==SIM_MODE_D)||(SIM_MODE==SIM_MODE_E)||(SIM_MODE==SIM_MODE_F) ){
-    assert(NUM_CORES==2); //Hardcoded
-    cache_print_stats(sys->icache_coreid[0], "ICACHE_0");
-    cache_print_stats(sys->dcache_coreid[0], "DCACHE_0");
-    cache_print_stats(sys->icache_coreid[1], "ICACHE_1");
-    cache_print_stats(sys->dcache_coreid[1], "DCACHE_1");
-    cache_print_stats(sys->l2cache, "L2CACHE");
+  if((sys->ctx->sim_mode==SIM_MODE_D)||(sys->ctx->sim_mode==SIM_MODE_E)||(sys->ctx->sim_mode==SIM_MODE_F) ){
+    uns ii;
+    for(ii=0; ii<sys->ctx->num_cores; ii++){
+      char name[32];
+      sprintf(name, "ICACHE_%u", ii);
+      cache_print_stats(sys->icache_coreid[ii], name);
+      cache_print_mshr_stats(sys->icache_coreid[ii], name);
+      sprintf(name, "DCACHE_%u", ii);
+      cache_print_stats(sys->dcache_coreid[ii], name);
+      cache_print_mshr_stats(sys->dcache_coreid[ii], name);
+    }
+    memsys_l2_print_stats(sys);
     dram_print_stats(sys->dram);
 
   }
@@ -194,10 +282,8 @@ uns64 memsys_access_modeA(Memsys *sys, Addr lineaddr, Access_Type type, uns core
   }
 
   if(needs_dcache_access){
-    Flag outcome=cache_access(sys->dcache, lineaddr, is_write,core_id);
-    if(outcome==MISS){
-      cache_install(sys->dcache, lineaddr, is_write,core_id);
-    }
+    Cache_Line evicted;
+    cache_access_install(sys->dcache, lineaddr, is_write, core_id, &evicted);
   }
 
   // timing is not simulated in Part A
@@ -213,8 +299,10 @@ uns64 memsys_access_modeA(Memsys *sys, Addr lineaddr, Access_Type type, uns core
 uns64 memsys_convert_vpn_to_pfn(Memsys *sys, uns64 vpn, uns core_id){
     uns64 tail = vpn & 0x000fffff;
     uns64 head = vpn >> 20;
-    uns64 pfn  = tail + (core_id << 21) + (head << 21);
-    assert(NUM_CORES==2); //We don't support more than two cores yet
+    // every (head, core) pair gets its own 2^21 frame region, so no two
+    // cores share a frame whatever the number of cores
+    uns64 pfn  = tail + (((head * sys->ctx->num_cores) + core_id) << 21);
+    assert(core_id < sys->ctx->num_cores);
     return pfn;
 }
 
@@ -222,10 +310,41 @@ uns64 memsys_convert_vpn_to_pfn(Memsys *sys, uns64 vpn, uns core_id){
 // --------------- DO NOT CHANGE THE CODE ABOVE THIS LINE ----------
 ////////////////////////////////////////////////////////////////////
 
+/////////////////////////////////////////////////////////////////////
+// L1 access for modes B-F: hit or fill, with the L2 read on a miss
+// added to *delay. RAND picks the L1 victim only after the L2 access,
+// as the separate lookup and install always did, so that the random
+// draws come in the same order and RAND runs do not change.
+/////////////////////////////////////////////////////////////////////
+
+static Flag memsys_l1_access(Memsys *sys, Cache *c, Addr lineaddr, Flag is_write, uns core_id,
+                             uns64 *delay, Cache_Line *evicted){
+    Flag result;
+
+    if(c->repl_policy == REPL_RAND && !c->num_mshrs) {
+        result = cache_access(c, lineaddr, is_write, core_id);
+        if(result == MISS) {
+            *delay += memsys_L2_access(sys, lineaddr, FALSE, core_id);
+            cache_install(c, lineaddr, is_write, core_id, evicted);
+        }
+        return result;
+    }
+
+    result = cache_access_install(c, lineaddr, is_write, core_id, evicted);
+    if(c->num_mshrs) {
+        *delay = memsys_l1_mshr_access(sys, c, lineaddr, result, *delay, core_id);
+    }
+    else if(result == MISS) {
+        *delay += memsys_L2_access(sys, lineaddr, FALSE, core_id);
+    }
+    return result;
+}
+
 uns64 memsys_access_modeBC(Memsys *sys, Addr lineaddr, Access_Type type,uns core_id){
     uns64 delay=0;
     Flag is_write = FALSE;
     Cache* use_cache = NULL;
+    Cache_Line evicted;
     Flag result;
 
     switch(type) {
@@ -245,17 +364,29 @@ uns64 memsys_access_modeBC(Memsys *sys, Addr lineaddr, Access_Type type,uns core
             delay = DCACHE_HIT_LATENCY;
             break;
     }
-    result = cache_access(use_cache, lineaddr, is_write, core_id);
-    if(result == MISS) {
-        delay += memsys_L2_access(sys, lineaddr, FALSE, core_id);
-        cache_install(use_cache, lineaddr, is_write, core_id);
-        Cache_Line* line = &use_cache->last_evicted_line;
-        if(line->valid && line->dirty)
-            memsys_L2_access(sys, line->tag, TRUE, core_id);
+    result = memsys_l1_access(sys, use_cache, lineaddr, is_write, core_id, &delay, &evicted);
+    if(result == MISS && evicted.valid && evicted.dirty) {
+        memsys_L2_access(sys, evicted.tag, TRUE, core_id);
     }
     return delay;
 }
 
+/////////////////////////////////////////////////////////////////////
+// Virtual to physical line address, page by page
+/////////////////////////////////////////////////////////////////////
+
+static Addr memsys_translate_lineaddr(Memsys *sys, Addr v_lineaddr, uns core_id){
+    // Remove page offset from lineaddress
+    Addr v_page_num = v_lineaddr / (PAGE_SIZE / sys->ctx->cache_linesize);
+    Addr v_page_offset = v_lineaddr % (PAGE_SIZE / sys->ctx->cache_linesize);
+
+    // Decode frame number
+    Addr p_frame_num = memsys_convert_vpn_to_pfn(sys, v_page_num, core_id);
+
+    // Offset will be invariant between translations
+    return (p_frame_num * (PAGE_SIZE / sys->ctx->cache_linesize)) + v_page_offset;
+}
+
 /////////////////////////////////////////////////////////////////////
 // For Mode D/E/F you will use per-core ICACHE and DCACHE
 // ----- YOU NEED TO WRITE THIS FUNCTION AND UPDATE DELAY ----------
@@ -264,21 +395,12 @@ uns64 memsys_access_modeBC(Memsys *sys, Addr lineaddr, Access_Type type,uns core
 
 uns64 memsys_access_modeDEF(Memsys *sys, Addr v_lineaddr, Access_Type type,uns core_id){
     uns64 delay=0;
-    Addr p_lineaddr=0;
+    Addr p_lineaddr = memsys_translate_lineaddr(sys, v_lineaddr, core_id);
     Flag is_write = FALSE;
     Cache* use_cache = NULL;
+    Cache_Line evicted;
     Flag result;
 
-    // Remove page offset from lineaddress
-    Addr v_page_num = v_lineaddr / (PAGE_SIZE / CACHE_LINESIZE);
-    Addr v_page_offset = v_lineaddr % (PAGE_SIZE / CACHE_LINESIZE);
-
-    // Decode frame number
-    Addr p_frame_num = memsys_convert_vpn_to_pfn(sys, v_page_num, core_id);
-
-    // Offset will be invariant between translations
-    p_lineaddr = (p_frame_num * (PAGE_SIZE / CACHE_LINESIZE)) + v_page_offset;
-
     // TODO: First convert lineaddr from virtual (v) to physical (p) using the
     // function memsys_convert_vpn_to_pfn. Page size is defined to be 4KB.
     // NOTE: VPN_to_PFN operates at page granularity and returns page addr
@@ -300,20 +422,11 @@ uns64 memsys_access_modeDEF(Memsys *sys, Addr v_lineaddr, Access_Type type,uns c
             delay = DCACHE_HIT_LATENCY;
             break;
     }
-    // Access per-core caches
-    result = cache_access(use_cache, p_lineaddr, is_write, core_id);
-    // Only for simulation
-    if (result == MISS) {
-        // Access shared L2
-        delay += memsys_L2_access(sys, p_lineaddr, FALSE, core_id);
-        // Install into the cache of core requesting
-        cache_install(use_cache, p_lineaddr, is_write, core_id);
-        Cache_Line* line = &use_cache->last_evicted_line;
-        if(line->valid && line->dirty) {
-            // Similarly shared
-            memsys_L2_access(sys, line->tag, TRUE, line->core_id);
-            line->valid = FALSE;
-        }
+    // Access per-core caches, installing into the requesting core's cache on a miss
+    result = memsys_l1_access(sys, use_cache, p_lineaddr, is_write, core_id, &delay, &evicted);
+    if(result == MISS && evicted.valid && evicted.dirty) {
+        // Similarly shared
+        memsys_L2_access(sys, evicted.tag, TRUE, evicted.core_id);
     }
     return delay;
   }
@@ -324,20 +437,323 @@ uns64 memsys_access_modeDEF(Memsys *sys, Addr v_lineaddr, Access_Type type,uns c
 /////////////////////////////////////////////////////////////////////
 
 uns64   memsys_L2_access(Memsys *sys, Addr lineaddr, Flag is_writeback, uns core_id){
+    return memsys_l2_access_at(sys, lineaddr, is_writeback, core_id, memsys_core_cycle(sys, core_id));
+}
+
+/////////////////////////////////////////////////////////////////////
+// Same, for a request that leaves the core at the given cycle. With
+// -L2mshrs a read that hits a line still being filled waits for the
+// fill, and a miss waits for a free MSHR before it goes to the DRAM.
+// Writebacks do not take MSHRs.
+/////////////////////////////////////////////////////////////////////
+
+static uns64 memsys_l2_access_at(Memsys *sys, Addr lineaddr, Flag is_writeback, uns core_id, uns64 cycle){
     uns64 delay = L2CACHE_HIT_LATENCY;
+    Cache_Line evicted;
+    Addr slice_lineaddr;
+    uns slice_id = memsys_l2_slice(sys, lineaddr, &slice_lineaddr);
+    Cache *l2 = sys->l2slice[slice_id].cache;
+    Flag use_mshr = l2->num_mshrs && !is_writeback;
+
+    if(sys->shared_lock){
+        pthread_mutex_lock(sys->shared_lock);
+    }
+
+    if(sys->sdprof[core_id]){
+        stackdist_access(sys->sdprof[core_id], lineaddr);
+    }
 
-    Flag result = cache_access(sys->l2cache, lineaddr, is_writeback, core_id);
+    if(sys->num_l2_slices > 1){
+        delay += memsys_l2_nuca_delay(sys, slice_id, core_id, cycle);
+    }
+
+    Flag result = cache_access_install(l2, slice_lineaddr, is_writeback, core_id, &evicted);
     //To get the delay of L2 MISS, you must use the dram_access() function
     //To perform writebacks to memory, you must use the dram_access() function
     //This will help us track your memory reads and memory writes
     if(result == MISS) {
-        delay += dram_access(sys->dram, lineaddr, FALSE);
-        cache_install(sys->l2cache, lineaddr, is_writeback, core_id);
-        Cache_Line* line = &sys->l2cache->last_evicted_line;
-        if(line->valid && line->dirty) {
-            dram_access(sys->dram, line->tag, TRUE);
-            line->valid = FALSE;
+        // the miss leaves for the DRAM once the L2 lookup is done
+        uns64 dram_cycle = cycle + delay;
+        if(use_mshr){
+            dram_cycle = cache_mshr_issue(l2, dram_cycle);
+        }
+        delay = dram_cycle - cycle + dram_access_at(sys->dram, lineaddr, FALSE, dram_cycle);
+        if(use_mshr){
+            cache_mshr_fill(l2, slice_lineaddr, dram_cycle, cycle + delay);
+        }
+        if(evicted.valid && evicted.dirty) {
+            dram_access_at(sys->dram, memsys_l2_lineaddr(sys, slice_id, evicted.tag), TRUE, dram_cycle);
         }
     }
+    else if(use_mshr) {
+        uns64 fill = cache_mshr_find(l2, slice_lineaddr, cycle);
+        if(fill > cycle + delay){
+            delay = fill - cycle;
+        }
+    }
+
+    if(sys->shared_lock){
+        pthread_mutex_unlock(sys->shared_lock);
+    }
     return delay;
 }
+
+/////////////////////////////////////////////////////////////////////
+// Delay of an L1 access with -L1mshrs, given its hit latency and the
+// result of the tag lookup. A hit on a line whose fill is still on
+// its way (a secondary miss) waits for that fill. A miss waits for a
+// free MSHR, then goes to the L2 and holds the MSHR until its data is
+// back. It goes at the issue cycle, which can be later than accesses
+// that come after it from other cores or MSHRs, so the L2 and the DRAM
+// see requests out of cycle order: the DRAM controller schedules them
+// by their arrival cycle (dram_ctrl_access).
+/////////////////////////////////////////////////////////////////////
+
+static uns64 memsys_l1_mshr_access(Memsys *sys, Cache *c, Addr lineaddr, Flag result, uns64 hit_delay, uns core_id){
+    uns64 now = memsys_core_cycle(sys, core_id);
+
+    if(result == HIT){
+        uns64 fill = cache_mshr_find(c, lineaddr, now);
+        return (fill > now + hit_delay) ? fill - now : hit_delay;
+    }
+
+    uns64 issue = cache_mshr_issue(c, now);
+    uns64 delay = issue - now + hit_delay + memsys_l2_access_at(sys, lineaddr, FALSE, core_id, issue);
+    cache_mshr_fill(c, lineaddr, issue, now + delay);
+    return delay;
+}
+
+/////////////////////////////////////////////////////////////////////
+// First cycle at which a load of addr can go to the data cache of the
+// core. Only a primary miss needs a free MSHR and stalls until then:
+// hits and secondary misses (the tag is in while the fill is on its
+// way) go at once.
+/////////////////////////////////////////////////////////////////////
+
+uns64 memsys_mshr_free_cycle(Memsys *sys, Addr addr, uns core_id){
+    Cache *c = sys->dcache_coreid ? sys->dcache_coreid[core_id] : sys->dcache;
+    Addr lineaddr = addr/sys->ctx->cache_linesize;
+    uns64 now = memsys_core_cycle(sys, core_id);
+
+    if(!c || !c->num_mshrs){
+        return now;
+    }
+    if(sys->dcache_coreid){
+        lineaddr = memsys_translate_lineaddr(sys, lineaddr, core_id);
+    }
+    return cache_holds(c, lineaddr, core_id) ? now : cache_mshr_free_cycle(c, now);
+}
+
+/////////////////////////////////////////////////////////////////////
+// Functional access for fast-forwarding: the same lookups, installs
+// and writebacks as memsys_access, but only the tag state changes.
+// There is no delay, the DRAM is not touched and neither the cache
+// nor the memsys counters move. The -mrc profiler sees the same L2 stream as in
+// timing mode, so its stacks are warm after a fast-forward.
+/////////////////////////////////////////////////////////////////////
+
+void memsys_access_functional(Memsys *sys, Addr addr, Access_Type type, uns core_id){
+    Addr lineaddr = addr/sys->ctx->cache_linesize;
+    Flag is_write = (type==ACCESS_TYPE_STORE);
+    Cache *use_cache;
+    Cache_Line evicted;
+
+    if(sys->ctx->sim_mode==SIM_MODE_A){
+        if(type != ACCESS_TYPE_IFETCH){
+            cache_access_install_functional(sys->dcache, lineaddr, is_write, core_id, &evicted);
+        }
+        return;
+    }
+
+    if((sys->ctx->sim_mode==SIM_MODE_B)||(sys->ctx->sim_mode==SIM_MODE_C)){
+        use_cache = (type==ACCESS_TYPE_IFETCH) ? sys->icache : sys->dcache;
+    }
+    else{
+        lineaddr  = memsys_translate_lineaddr(sys, lineaddr, core_id);
+        use_cache = (type==ACCESS_TYPE_IFETCH) ? sys->icache_coreid[core_id] : sys->dcache_coreid[core_id];
+    }
+
+    if(cache_access_install_functional(use_cache, lineaddr, is_write, core_id, &evicted) == MISS){
+        Cache_Line l2_evicted;
+        Addr slice_lineaddr;
+        uns slice_id = memsys_l2_slice(sys, lineaddr, &slice_lineaddr);
+
+        if(sys->sdprof[core_id]){
+            stackdist_access(sys->sdprof[core_id], lineaddr);
+        }
+        cache_access_install_functional(sys->l2slice[slice_id].cache, slice_lineaddr, FALSE, core_id, &l2_evicted);
+        if(evicted.valid && evicted.dirty){
+            if(sys->sdprof[evicted.core_id]){
+                stackdist_access(sys->sdprof[evicted.core_id], evicted.tag);
+            }
+            slice_id = memsys_l2_slice(sys, evicted.tag, &slice_lineaddr);
+            cache_access_install_functional(sys->l2slice[slice_id].cache, slice_lineaddr, TRUE, evicted.core_id, &l2_evicted);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////
+// The shared L2 as num_l2_slices banks (-L2slices, a power of two),
+// each with its own tags and a single port. Slice i sits on tile i of
+// a square mesh and core c next to tile c*num_l2_slices/num_cores.
+// With one slice this is the plain L2 of the assignment: a flat
+// L2CACHE_HIT_LATENCY and no port contention.
+/////////////////////////////////////////////////////////////////////
+
+static void memsys_l2_new(Memsys *sys, uns64 repl_policy){
+    SimContext *ctx = sys->ctx;
+    uns64 slices = ctx->l2_slices ? ctx->l2_slices : 1;
+    uns ii;
+
+    if(slices > MAX_L2_SLICES || (slices & (slices-1)) || ctx->l2cache_size/slices < ctx->l2cache_assoc*ctx->cache_linesize){
+      die_message("-L2slices must be a power of 2 that leaves every slice at least one set");
+    }
+
+    sys->num_l2_slices = slices;
+    sys->l2slice = (L2_Slice *) calloc (slices, sizeof (L2_Slice));
+    for(ii=0; ii<slices; ii++){
+      sys->l2slice[ii].cache = cache_new(ctx, ctx->l2cache_size/slices, ctx->l2cache_assoc, ctx->cache_linesize, repl_policy);
+      cache_mshr_init(sys->l2slice[ii].cache, ctx->l2_mshrs);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////
+// Slice index: the low line address bits XORed with all the bits
+// above them, so strided and per-core (PFN) patterns still spread
+// over every slice. The slice keeps the line address without those
+// low bits, which uses all of its sets; memsys_l2_lineaddr() undoes
+// the mapping for lines evicted from a slice.
+/////////////////////////////////////////////////////////////////////
+
+static inline uns memsys_l2_fold(Addr high, uns bits){
+    uns fold = 0;
+    for(; high; high >>= bits){
+        fold ^= high & ((1u << bits) - 1);
+    }
+    return fold;
+}
+
+static uns memsys_l2_slice(Memsys *sys, Addr lineaddr, Addr *slice_lineaddr){
+    uns bits = __builtin_ctz(sys->num_l2_slices);
+
+    if(!bits){
+        *slice_lineaddr = lineaddr;
+        return 0;
+    }
+    *slice_lineaddr = lineaddr >> bits;
+    return (lineaddr ^ memsys_l2_fold(lineaddr >> bits, bits)) & (sys->num_l2_slices - 1);
+}
+
+static Addr memsys_l2_lineaddr(Memsys *sys, uns slice_id, Addr slice_lineaddr){
+    uns bits = __builtin_ctz(sys->num_l2_slices);
+
+    if(!bits){
+        return slice_lineaddr;
+    }
+    return (slice_lineaddr << bits) | (slice_id ^ memsys_l2_fold(slice_lineaddr, bits));
+}
+
+/////////////////////////////////////////////////////////////////////
+// Extra L2 latency of a sliced L2: the round trip over the mesh
+// (-L2hop cycles per hop each way) plus the wait for the slice's port,
+// which every access holds for -L2busy cycles. Requests from a core
+// whose clock is behind the last one seen (other threads of a relaxed
+// -quantum) do not queue and leave the port alone.
+/////////////////////////////////////////////////////////////////////
+
+static uns64 memsys_l2_nuca_delay(Memsys *sys, uns slice_id, uns core_id, uns64 now){
+    SimContext *ctx   = sys->ctx;
+    L2_Slice   *slice = &sys->l2slice[slice_id];
+    uns   width = 1;
+    uns   home  = (core_id * sys->num_l2_slices) / ctx->num_cores;
+    uns64 arrival, hops, queue = 0;
+
+    while(width*width < sys->num_l2_slices){
+        width++;
+    }
+    hops = abs((int)(home % width) - (int)(slice_id % width)) +
+           abs((int)(home / width) - (int)(slice_id / width));
+
+    arrival = now + hops*ctx->l2_hop_latency;
+
+    if(now >= slice->last_arrival){
+        if(slice->port_free > arrival){
+            queue = slice->port_free - arrival;
+            slice->stat_conflicts++;
+        }
+        slice->port_free    = arrival + queue + ctx->l2_port_busy;
+        slice->last_arrival = now;
+    }
+
+    slice->stat_access++;
+    slice->stat_hops        += hops;
+    slice->stat_queue_delay += queue;
+
+    return 2*hops*ctx->l2_hop_latency + queue;
+}
+
+/////////////////////////////////////////////////////////////////////
+// Clock of the requesting core: its L1s follow the thread clock when
+// a relaxed -quantum is running, sys->ctx only moves at the barriers
+/////////////////////////////////////////////////////////////////////
+
+static uns64 memsys_core_cycle(Memsys *sys, uns core_id){
+    return sys->dcache_coreid ? sys->dcache_coreid[core_id]->ctx->cycle : sys->ctx->cycle;
+}
+
+/////////////////////////////////////////////////////////////////////
+// One slice prints as L2CACHE like before. Otherwise every slice gets
+// its own block, followed by the L2CACHE totals.
+/////////////////////////////////////////////////////////////////////
+
+static void memsys_l2_print_stats(Memsys *sys){
+    FILE *out = sys->ctx->out;
+    Cache total;
+    uns64 access = 0, hops = 0, conflicts = 0, queue_delay = 0;
+    uns ii;
+
+    if(sys->num_l2_slices == 1){
+        cache_print_stats(sys->l2slice[0].cache, "L2CACHE");
+        cache_print_mshr_stats(sys->l2slice[0].cache, "L2CACHE");
+        return;
+    }
+
+    memset(&total, 0, sizeof(total));
+    total.ctx       = sys->ctx;
+    total.num_mshrs = sys->l2slice[0].cache->num_mshrs;
+
+    for(ii=0; ii<sys->num_l2_slices; ii++){
+        L2_Slice *slice = &sys->l2slice[ii];
+        Cache    *c     = slice->cache;
+        char header[32];
+
+        sprintf(header, "L2SLICE_%u", ii);
+        cache_print_stats(c, header);
+        cache_print_mshr_stats(c, header);
+        fprintf(out, "%s_CONFLICTS      \t\t : %10llu", header, slice->stat_conflicts);
+        fprintf(out, "\n%s_QUEUE_AVG      \t\t : %10.3f", header,
+                slice->stat_access ? (double)(slice->stat_queue_delay)/(double)(slice->stat_access) : 0);
+        fprintf(out, "\n");
+
+        total.stat_read_access  += c->stat_read_access;
+        total.stat_write_access += c->stat_write_access;
+        total.stat_read_miss    += c->stat_read_miss;
+        total.stat_write_miss   += c->stat_write_miss;
+        total.stat_dirty_evicts += c->stat_dirty_evicts;
+        total.stat_mshr_alloc     += c->stat_mshr_alloc;
+        total.stat_mshr_merge     += c->stat_mshr_merge;
+        total.stat_mshr_full      += c->stat_mshr_full;
+        total.stat_mshr_occupancy += c->stat_mshr_occupancy;
+        access      += slice->stat_access;
+        hops        += slice->stat_hops;
+        conflicts   += slice->stat_conflicts;
+        queue_delay += slice->stat_queue_delay;
+    }
+
+    cache_print_stats(&total, "L2CACHE");
+    cache_print_mshr_stats(&total, "L2CACHE");
+    fprintf(out, "L2CACHE_HOPS_AVG       \t\t : %10.3f", access ? (double)hops/(double)access : 0);
+    fprintf(out, "\nL2CACHE_CONFLICTS      \t\t : %10llu", conflicts);
+    fprintf(out, "\nL2CACHE_QUEUE_AVG      \t\t : %10.3f", access ? (double)queue_delay/(double)access : 0);
+    fprintf(out, "\n");
+}
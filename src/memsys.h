@@ -1,25 +1,54 @@
 #ifndef MEMSYS_H
 #define MEMSYS_H
 
+#include <pthread.h>
+
 #include "types.h"
 #include "cache.h"
 #include "dram.h"
+#include "stackdist.h"
+
+#define MAX_L2_SLICES 256
 
 //////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////
 
 typedef struct Memsys   Memsys;
+typedef struct L2_Slice L2_Slice;
+
+// One address-interleaved bank of the shared L2 (see memsys_L2_access)
+struct L2_Slice {
+  Cache *cache;         // tags of the lines that hash to this slice
+  uns64  port_free;     // cycle at which the port can start the next access
+  uns64  last_arrival;  // latest request cycle seen, to spot out-of-order clocks
+
+   // stats
+  uns64  stat_access;
+  uns64  stat_hops;        // network hops, one way
+  uns64  stat_conflicts;   // accesses that found the port busy
+  uns64  stat_queue_delay; // cycles spent waiting for the port
+};
 
 struct Memsys {
+  SimContext *ctx;
+
   Cache *dcache;  // For Part A
   Cache *icache;  // For Part A,B,C
 
-  Cache *dcache_coreid[MAX_CORES];  // For Part D,E,F
-  Cache *icache_coreid[MAX_CORES];  // For Part D,E,F
+  Cache **dcache_coreid;  // For Part D,E,F, one per core
+  Cache **icache_coreid;  // For Part D,E,F, one per core
   
-  Cache *l2cache; // For Part A,B,C,D,E
+  L2_Slice *l2slice;  // For Part B,C,D,E: the shared L2, one slice unless -L2slices
+  uns       num_l2_slices;
   DRAM  *dram;    // For Part C,D,E
 
+  Stackdist **sdprof; // L2 access stream profile per core (-mrc)
+
+  // Set while cores run on several threads with a relaxed quantum:
+  // L2/DRAM accesses take this lock and the counters below are
+  // updated atomically
+  pthread_mutex_t *shared_lock;
+
    // stats 
   uns64 stat_ifetch_access;
   uns64 stat_load_access;
@@ -34,18 +63,26 @@ struct Memsys {
 ///////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////
 
-Memsys *memsys_new();
+Memsys *memsys_new(SimContext *ctx);
+void    memsys_free(Memsys *sys);
 void    memsys_print_stats(Memsys *sys);
+void    memsys_reset_stats(Memsys *sys);
 
 uns64   memsys_access(Memsys *sys, Addr addr, Access_Type type, uns core_id);
 uns64   memsys_access_modeA(Memsys *sys, Addr lineaddr, Access_Type type, uns core_id);
 uns64   memsys_access_modeBC(Memsys *sys, Addr lineaddr, Access_Type type, uns core_id);
 uns64   memsys_access_modeDEF(Memsys *sys, Addr lineaddr, Access_Type type, uns core_id);
 
+// Tags only, no timing: used to fast-forward (-ffwd)
+void    memsys_access_functional(Memsys *sys, Addr addr, Access_Type type, uns core_id);
+
 
 // For mode B/C/D/E you must use this function to access L2 
 uns64   memsys_L2_access(Memsys *sys, Addr lineaddr, Flag is_writeback, uns core_id);
 
+// Cycle at which a load of addr can go to the core's data cache (-L1mshrs)
+uns64   memsys_mshr_free_cycle(Memsys *sys, Addr addr, uns core_id);
+
 // This function can convert VPN to PFN
 uns64 memsys_convert_vpn_to_pfn(Memsys *sys, uns64 vpn, uns core_id);
 
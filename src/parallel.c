@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "parallel.h"
+
+typedef struct Par_Thread Par_Thread;
+typedef struct Par_Engine Par_Engine;
+
+struct Par_Thread {
+  Par_Engine *eng;
+  pthread_t   tid;
+  uns         first_core;  // cores [first_core, last_core)
+  uns         last_core;
+  SimContext  ctx;         // relaxed: own clock and L1 random state
+};
+
+struct Par_Engine {
+  Sim              *sim;
+  Flag              relaxed;
+  uns               num_threads;
+  Par_Thread       *thread;
+
+  pthread_barrier_t barrier;
+  pthread_mutex_t   shared_lock; // relaxed: L2 and DRAM
+  pthread_mutex_t   turn_lock;   // quantum 1: which core runs next
+  pthread_cond_t    turn_cond;
+  uns               turn;
+
+  uns64             quantum_start; // cycles of the current quantum
+  uns64             quantum_end;
+  Flag              done;
+};
+
+static void *par_worker(void *arg);
+static void  par_run_in_order(Par_Thread *th);
+static void  par_run_relaxed(Par_Thread *th);
+static void  par_end_quantum(Par_Engine *eng);
+
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+void sim_run_parallel(Sim *sim)
+{
+  SimContext *ctx = &sim->ctx;
+  Memsys     *sys = sim->memsys;
+  Par_Engine  eng;
+  uns         tt, ii;
+
+  if(ctx->quantum == 0){
+    die_message("-quantum must be at least 1");
+  }
+
+  memset(&eng, 0, sizeof(eng));
+  eng.sim           = sim;
+  eng.relaxed       = (ctx->quantum > 1);
+  eng.num_threads   = (ctx->threads < ctx->num_cores) ? ctx->threads : ctx->num_cores;
+  eng.thread        = (Par_Thread *) calloc (eng.num_threads, sizeof(Par_Thread));
+  eng.quantum_start = ctx->cycle;
+  eng.quantum_end   = ctx->cycle + ctx->quantum;
+
+  if(eng.relaxed && !sys->dcache_coreid){
+    die_message("A -quantum above 1 needs private L1 caches (mode 4 to 6)");
+  }
+  if(eng.relaxed && (ctx->dram_ctrl || ctx->l2_mshrs)){
+    die_message("A -quantum above 1 cannot time the shared -dram_ctrl queues or -L2mshrs, use -quantum 1");
+  }
+
+  pthread_barrier_init(&eng.barrier, NULL, eng.num_threads);
+  pthread_mutex_init(&eng.shared_lock, NULL);
+  pthread_mutex_init(&eng.turn_lock, NULL);
+  pthread_cond_init(&eng.turn_cond, NULL);
+
+  for(tt=0; tt<eng.num_threads; tt++){
+    Par_Thread *th = &eng.thread[tt];
+    th->eng        = &eng;
+    th->first_core = tt * ctx->num_cores / eng.num_threads;
+    th->last_core  = (tt+1) * ctx->num_cores / eng.num_threads;
+
+    // relaxed: the thread's cores and their L1s run on its own clock
+    if(eng.relaxed){
+      th->ctx = *ctx;
+      simctx_srand(&th->ctx, simctx_rand(ctx));
+      for(ii=th->first_core; ii<th->last_core; ii++){
+	sim->core[ii]->ctx          = &th->ctx;
+	sys->dcache_coreid[ii]->ctx = &th->ctx;
+	sys->icache_coreid[ii]->ctx = &th->ctx;
+      }
+    }
+  }
+
+  if(eng.relaxed){
+    sys->shared_lock = &eng.shared_lock;
+  }
+
+  for(tt=0; tt<eng.num_threads; tt++){
+    if(pthread_create(&eng.thread[tt].tid, NULL, par_worker, &eng.thread[tt])){
+      die_message("Unable to start a simulation thread");
+    }
+  }
+  for(tt=0; tt<eng.num_threads; tt++){
+    pthread_join(eng.thread[tt].tid, NULL);
+  }
+
+  sys->shared_lock = NULL;
+  for(ii=0; ii<ctx->num_cores; ii++){
+    sim->core[ii]->ctx = ctx;
+    if(sys->dcache_coreid){
+      sys->dcache_coreid[ii]->ctx = ctx;
+      sys->icache_coreid[ii]->ctx = ctx;
+    }
+  }
+
+  pthread_cond_destroy(&eng.turn_cond);
+  pthread_mutex_destroy(&eng.turn_lock);
+  pthread_mutex_destroy(&eng.shared_lock);
+  pthread_barrier_destroy(&eng.barrier);
+  free(eng.thread);
+}
+
+////////////////////////////////////////////////////////////////////
+// One quantum, then the barrier: the last thread to arrive closes the
+// quantum while the others wait for it at the second barrier
+////////////////////////////////////////////////////////////////////
+
+static void *par_worker(void *arg)
+{
+  Par_Thread *th  = (Par_Thread *) arg;
+  Par_Engine *eng = th->eng;
+
+  while(1){
+    if(eng->relaxed){
+      par_run_relaxed(th);
+    }
+    else{
+      par_run_in_order(th);
+    }
+
+    if(pthread_barrier_wait(&eng->barrier) == PTHREAD_BARRIER_SERIAL_THREAD){
+      par_end_quantum(eng);
+    }
+    pthread_barrier_wait(&eng->barrier);
+
+    if(eng->done){
+      break;
+    }
+  }
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+// Quantum 1: wait for the cores before ours to finish the cycle, run
+// ours in order, hand the turn to the next thread
+////////////////////////////////////////////////////////////////////
+
+static void par_run_in_order(Par_Thread *th)
+{
+  Par_Engine *eng = th->eng;
+  uns ii;
+
+  pthread_mutex_lock(&eng->turn_lock);
+  while(eng->turn != th->first_core){
+    pthread_cond_wait(&eng->turn_cond, &eng->turn_lock);
+  }
+  pthread_mutex_unlock(&eng->turn_lock);
+
+  for(ii=th->first_core; ii<th->last_core; ii++){
+    core_cycle(eng->sim->core[ii]);
+  }
+
+  pthread_mutex_lock(&eng->turn_lock);
+  eng->turn = th->last_core;
+  pthread_cond_broadcast(&eng->turn_cond);
+  pthread_mutex_unlock(&eng->turn_lock);
+}
+
+////////////////////////////////////////////////////////////////////
+// Run our cores to the end of the quantum, skipping cycles where all
+// of them are snoozing
+////////////////////////////////////////////////////////////////////
+
+static void par_run_relaxed(Par_Thread *th)
+{
+  Par_Engine *eng   = th->eng;
+  uns64       cycle = eng->quantum_start;
+  uns         ii;
+
+  while(cycle < eng->quantum_end){
+    uns64 next = cycle+1;
+    uns64 wake = (uns64)(-1);
+    Flag  all_cores_done = TRUE;
+
+    th->ctx.cycle = cycle;
+    for(ii=th->first_core; ii<th->last_core; ii++){
+      Core *c = eng->sim->core[ii];
+      core_cycle(c);
+      if(!c->done){
+	all_cores_done = FALSE;
+	if(c->snooze_end_cycle+1 < wake){
+	  wake = c->snooze_end_cycle+1;
+	}
+      }
+    }
+
+    if(all_cores_done){
+      break;
+    }
+    if(th->ctx.skip_idle_cycles && wake > next){
+      next = wake;
+    }
+    cycle = next;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// Every thread is at the barrier: close the last cycle of the quantum
+// as the single threaded loop would, and set up the next quantum
+////////////////////////////////////////////////////////////////////
+
+static void par_end_quantum(Par_Engine *eng)
+{
+  Sim  *sim = eng->sim;
+  Flag  all_cores_done = TRUE;
+  uns64 last_cycle = eng->quantum_end - 1;
+  uns   ii;
+
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    all_cores_done &= sim->core[ii]->done;
+  }
+
+  // the run ends with the cycle in which the last core finished
+  if(all_cores_done){
+    last_cycle = 0;
+    for(ii=0; ii<sim->ctx.num_cores; ii++){
+      uns64 done_cycle = sim->ctx.stat_cycle + sim->core[ii]->done_cycle_count;
+      if(done_cycle > last_cycle){
+	last_cycle = done_cycle;
+      }
+    }
+  }
+
+  sim->ctx.cycle = last_cycle;
+  sim_end_cycle(sim, all_cores_done);
+
+  eng->quantum_start = sim->ctx.cycle;
+  eng->quantum_end   = sim->ctx.cycle + sim->ctx.quantum;
+  eng->turn          = 0;
+  eng->done          = sim->done;
+}
@@ -0,0 +1,32 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "types.h"
+#include "memsim.h"
+
+//////////////////////////////////////////////////////////////////
+// Run the cores of a Sim on ctx.threads threads, each owning a
+// contiguous block of cores and its private L1s. The threads meet at
+// a barrier every ctx.quantum cycles, where the global clock, the
+// heartbeat and the idle skipping are handled.
+//
+// quantum == 1: the cores still run in core order within a cycle (a
+//   turn is handed from thread to thread), which gives exactly the
+//   results of the single threaded loop.
+// quantum >  1: each thread runs its cores up to the next barrier on
+//   its own clock. The shared L2 and DRAM are serialized by a lock
+//   in the order the requests arrive, and each thread draws its own
+//   random numbers for its L1s. Faster, but not reproducible: on
+//   the bzip2+lbm mix the core cycles move by up to about 5%.
+//   Needs per-core L1s (mode 4 to 6). Shared state that is timed,
+//   like the -dram_ctrl bank and bus queues or the -L2mshrs of the
+//   L2, would see requests stamped on the clocks of other threads
+//   (cycles off by 10% and more), so it is refused. The -L1mshrs are
+//   private and run on the clock of their core.
+//////////////////////////////////////////////////////////////////
+
+void   sim_run_parallel(Sim *sim);
+
+//////////////////////////////////////////////////////////////////
+
+#endif // PARALLEL_H
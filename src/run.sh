@@ -10,44 +10,40 @@ rm ../src.tar.gz
 rm ../results.tar.gz
 rm ../results/*
 
+########## All parts run as one sweep: each trace is decoded once and
+########## the runs are spread over every CPU (-j 0)
+echo "Parts A-E..."
+./sim -sweep /dev/stdin -j 0 <<EOF
 ########## ---------------  A.1 ---------------- ################
-echo "Part A..."
-./sim -mode 1 ../traces/bzip2.mtr.gz > ../results/A1.bzip2.res
-./sim -mode 1 ../traces/lbm.mtr.gz  > ../results/A1.lbm.res 
-./sim -mode 1 ../traces/libq.mtr.gz   > ../results/A1.libq.res 
-echo "done"
+-mode 1 ../traces/bzip2.mtr.gz -out ../results/A1.bzip2.res
+-mode 1 ../traces/lbm.mtr.gz -out ../results/A1.lbm.res
+-mode 1 ../traces/libq.mtr.gz -out ../results/A1.libq.res
 ########## ---------------  B ---------------- ################
-echo "Part B..."
-./sim -mode 2 -L2sizeKB 1024 ../traces/bzip2.mtr.gz  > ../results/B.S1MB.bzip2.res 
-./sim -mode 2 -L2sizeKB 1024 ../traces/lbm.mtr.gz    > ../results/B.S1MB.lbm.res &
-./sim -mode 2 -L2sizeKB 1024 ../traces/libq.mtr.gz    > ../results/B.S1MB.libq.res
-echo "done"
+-mode 2 -L2sizeKB 1024 ../traces/bzip2.mtr.gz -out ../results/B.S1MB.bzip2.res
+-mode 2 -L2sizeKB 1024 ../traces/lbm.mtr.gz -out ../results/B.S1MB.lbm.res
+-mode 2 -L2sizeKB 1024 ../traces/libq.mtr.gz -out ../results/B.S1MB.libq.res
 ########## ---------------  C ---------------- ################
-echo "Part C..."
-./sim -mode 3 -L2sizeKB 1024 ../traces/bzip2.mtr.gz  > ../results/C.S1MB.bzip2.res 
-./sim -mode 3 -L2sizeKB 1024 ../traces/lbm.mtr.gz    > ../results/C.S1MB.lbm.res &
-./sim -mode 3 -L2sizeKB 1024 ../traces/libq.mtr.gz    > ../results/C.S1MB.libq.res 
-echo "done"
+-mode 3 -L2sizeKB 1024 ../traces/bzip2.mtr.gz -out ../results/C.S1MB.bzip2.res
+-mode 3 -L2sizeKB 1024 ../traces/lbm.mtr.gz -out ../results/C.S1MB.lbm.res
+-mode 3 -L2sizeKB 1024 ../traces/libq.mtr.gz -out ../results/C.S1MB.libq.res
 ########## ---------------  D ---------------- ################
 
-echo "Part D..."
-./sim -mode 4 ../traces/bzip2.mtr.gz ../traces/libq.mtr.gz > ../results/D.mix1.res
-./sim -mode 4 ../traces/bzip2.mtr.gz ../traces/lbm.mtr.gz  > ../results/D.mix2.res
-./sim -mode 4 ../traces/lbm.mtr.gz ../traces/libq.mtr.gz   > ../results/D.mix3.res
-echo "done"
+-mode 4 ../traces/bzip2.mtr.gz ../traces/libq.mtr.gz -out ../results/D.mix1.res
+-mode 4 ../traces/bzip2.mtr.gz ../traces/lbm.mtr.gz -out ../results/D.mix2.res
+-mode 4 ../traces/lbm.mtr.gz ../traces/libq.mtr.gz -out ../results/D.mix3.res
 ########## ---------------  E (Same as D, except L2rep=2l) -------------- ################
-echo "Part E..."
-./sim -mode 5 -L2repl 2 -SWP_core0ways 4 ../traces/bzip2.mtr.gz ../traces/libq.mtr.gz  > ../results/E.Q1.mix1.res
-./sim -mode 5 -L2repl 2 -SWP_core0ways 8 ../traces/bzip2.mtr.gz ../traces/libq.mtr.gz  > ../results/E.Q2.mix1.res
-./sim -mode 5 -L2repl 2 -SWP_core0ways 12 ../traces/bzip2.mtr.gz ../traces/libq.mtr.gz > ../results/E.Q3.mix1.res
+-mode 5 -L2repl 2 -SWP_core0ways 4 ../traces/bzip2.mtr.gz ../traces/libq.mtr.gz -out ../results/E.Q1.mix1.res
+-mode 5 -L2repl 2 -SWP_core0ways 8 ../traces/bzip2.mtr.gz ../traces/libq.mtr.gz -out ../results/E.Q2.mix1.res
+-mode 5 -L2repl 2 -SWP_core0ways 12 ../traces/bzip2.mtr.gz ../traces/libq.mtr.gz -out ../results/E.Q3.mix1.res
 
-./sim -mode 5 -L2repl 2 -SWP_core0ways 4 ../traces/bzip2.mtr.gz ../traces/lbm.mtr.gz  > ../results/E.Q1.mix2.res
-./sim -mode 5 -L2repl 2 -SWP_core0ways 8 ../traces/bzip2.mtr.gz ../traces/lbm.mtr.gz  > ../results/E.Q2.mix2.res
-./sim -mode 5 -L2repl 2 -SWP_core0ways 12 ../traces/bzip2.mtr.gz ../traces/lbm.mtr.gz > ../results/E.Q3.mix2.res
+-mode 5 -L2repl 2 -SWP_core0ways 4 ../traces/bzip2.mtr.gz ../traces/lbm.mtr.gz -out ../results/E.Q1.mix2.res
+-mode 5 -L2repl 2 -SWP_core0ways 8 ../traces/bzip2.mtr.gz ../traces/lbm.mtr.gz -out ../results/E.Q2.mix2.res
+-mode 5 -L2repl 2 -SWP_core0ways 12 ../traces/bzip2.mtr.gz ../traces/lbm.mtr.gz -out ../results/E.Q3.mix2.res
 
-./sim -mode 5 -L2repl 2 -SWP_core0ways 4 ../traces/lbm.mtr.gz ../traces/libq.mtr.gz  > ../results/E.Q1.mix3.res
-./sim -mode 5 -L2repl 2 -SWP_core0ways 8 ../traces/lbm.mtr.gz ../traces/libq.mtr.gz  > ../results/E.Q2.mix3.res
-./sim -mode 5 -L2repl 2 -SWP_core0ways 12 ../traces/lbm.mtr.gz ../traces/libq.mtr.gz > ../results/E.Q3.mix3.res
+-mode 5 -L2repl 2 -SWP_core0ways 4 ../traces/lbm.mtr.gz ../traces/libq.mtr.gz -out ../results/E.Q1.mix3.res
+-mode 5 -L2repl 2 -SWP_core0ways 8 ../traces/lbm.mtr.gz ../traces/libq.mtr.gz -out ../results/E.Q2.mix3.res
+-mode 5 -L2repl 2 -SWP_core0ways 12 ../traces/lbm.mtr.gz ../traces/libq.mtr.gz -out ../results/E.Q3.mix3.res
+EOF
 echo "done"
 
 ########## ---------------  F (Same as D, except L2repl=3) -------------- ################
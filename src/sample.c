@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sample.h"
+
+#define SAMPLE_Z95  1.96
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+void sample_add(Sample_Ratio *r, double y, double x)
+{
+  r->n++;
+  r->sum_x  += x;
+  r->sum_y  += y;
+  r->sum_xx += x*x;
+  r->sum_yy += y*y;
+  r->sum_xy += x*y;
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+double sample_estimate(Sample_Ratio *r)
+{
+  if(r->sum_x == 0){
+    return 0;
+  }
+  return r->sum_y/r->sum_x;
+}
+
+////////////////////////////////////////////////////////////////////
+// Half width of the 95% interval of the ratio estimate:
+// var(R) ~= s^2(y - R*x) / (n * mean(x)^2)
+////////////////////////////////////////////////////////////////////
+
+double sample_ci95(Sample_Ratio *r)
+{
+  double R = sample_estimate(r);
+  double mean_x, s2;
+
+  if(r->n < 2 || r->sum_x == 0){
+    return 0;
+  }
+
+  mean_x = r->sum_x/r->n;
+  s2     = (r->sum_yy - 2*R*r->sum_xy + R*R*r->sum_xx)/(r->n-1);
+  if(s2 < 0){
+    s2 = 0; // rounding when every unit has the same ratio
+  }
+
+  return SAMPLE_Z95 * sqrt(s2/r->n) / mean_x;
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+void sample_print_stats(Sample *s, FILE *out)
+{
+  char header[256];
+  sprintf(header, "SAMPLE");
+
+  fprintf(out, "\n");
+  fprintf(out, "\n%s_UNITS              \t\t : %10llu", header, s->units);
+  fprintf(out, "\n%s_INST               \t\t : %10llu", header, s->inst);
+  fprintf(out, "\n%s_IPC                \t\t : %10.3f", header, sample_estimate(&s->ipc));
+  fprintf(out, "\n%s_IPC_CI95           \t\t : %10.3f", header, sample_ci95(&s->ipc));
+  fprintf(out, "\n%s_IFETCH_AVGDELAY    \t\t : %10.3f", header, sample_estimate(&s->ifetch_delay));
+  fprintf(out, "\n%s_IFETCH_AVGDELAY_CI95\t\t : %10.3f", header, sample_ci95(&s->ifetch_delay));
+  fprintf(out, "\n%s_LOAD_AVGDELAY      \t\t : %10.3f", header, sample_estimate(&s->load_delay));
+  fprintf(out, "\n%s_LOAD_AVGDELAY_CI95 \t\t : %10.3f", header, sample_ci95(&s->load_delay));
+  fprintf(out, "\n%s_STORE_AVGDELAY     \t\t : %10.3f", header, sample_estimate(&s->store_delay));
+  fprintf(out, "\n%s_STORE_AVGDELAY_CI95\t\t : %10.3f", header, sample_ci95(&s->store_delay));
+  fprintf(out, "\n");
+}
@@ -0,0 +1,47 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdio.h>
+
+#include "types.h"
+
+//////////////////////////////////////////////////////////////////
+// Estimates from sampled simulation (-sample_period). Each detailed
+// unit adds one observation (y, x) to a ratio estimator: instructions
+// over cycles for IPC, delay over accesses for the MEMSYS averages.
+// The estimate is sum(y)/sum(x); its 95% confidence interval comes
+// from the spread of y - R*x over the units.
+//////////////////////////////////////////////////////////////////
+
+typedef struct Sample_Ratio Sample_Ratio;
+typedef struct Sample       Sample;
+
+struct Sample_Ratio {
+  uns64  n;
+  double sum_x;
+  double sum_y;
+  double sum_xx;
+  double sum_yy;
+  double sum_xy;
+};
+
+struct Sample {
+  uns64        units;        // detailed units measured
+  uns64        inst;         // instructions in them
+  Sample_Ratio ipc;
+  Sample_Ratio ifetch_delay;
+  Sample_Ratio load_delay;
+  Sample_Ratio store_delay;
+};
+
+//////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+void    sample_add        (Sample_Ratio *r, double y, double x);
+double  sample_estimate   (Sample_Ratio *r);
+double  sample_ci95       (Sample_Ratio *r);
+void    sample_print_stats(Sample *s, FILE *out);
+
+//////////////////////////////////////////////////////////////////
+
+#endif // SAMPLE_H
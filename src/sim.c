@@ -9,147 +9,158 @@
 #include <string.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "types.h"
-#include "memsys.h"
-#include "core.h"
-
-#define PRINT_DOTS   1
-#define DOT_INTERVAL 100000
-
-/***************************************************************************
- * Globals 
- **************************************************************************/
-
-MODE        SIM_MODE        = SIM_MODE_A;
-uns64       CACHE_LINESIZE  = 64;
-uns64       REPL_POLICY     = 0; // 0:LRU 1:RAND
-
-uns64       DCACHE_SIZE     = 32*1024; 
-uns64       DCACHE_ASSOC    = 8; 
-
-uns64       ICACHE_SIZE     = 32*1024; 
-uns64       ICACHE_ASSOC    = 8; 
-
-uns64       L2CACHE_SIZE    = 1024*1024; 
-uns64       L2CACHE_ASSOC   = 16;
-uns64       L2CACHE_REPL    = 0; // 0:LRU 1:RND 2:SWP 3:UCP
-
-uns64       SWP_CORE0_WAYS  = 0;
-
-uns64       NUM_CORES       = 1;
+#include "memsim.h"
+#include "sweep.h"
+#include "checkpoint.h"
+#include "simpoint.h"
 
 
 /***************************************************************************************
  * Functions
  ***************************************************************************************/
-void print_dots(void);
 void die_usage();
-void die_message(const char * msg);
 void get_params(int argc, char** argv);
-void print_stats();
+int  get_option(int argc, char** argv, int ii);
+void write_mrc(Sim *sim);
 
 /***************************************************************************************
  * Globals
  ***************************************************************************************/
 
-Memsys      *memsys;
-Core        *core[MAX_CORES];
+SimContext  params;
 char        trace_filename[MAX_CORES][1024];
-uns64       last_printdot_cycle;
-uns64       cycle;
+char        convert_filename[1024];
+char        sweep_filename[1024];
+char        mrc_filename[1024];
+uns         sweep_jobs = 1;
+uns64       checkpoint_inst;
+char        checkpoint_filename[1024] = "sim.ckpt";
+char        restore_filename[1024];
+char        simpoint_profile_filename[1024];
+char        simpoint_filename[1024];
+uns64       simpoint_interval = 100000;
+uns         simpoint_k = 5;
 
 /***************************************************************************************
  * Main
  ***************************************************************************************/
 int main(int argc, char** argv)
 {
-  Flag ii;
+  char *fnames[MAX_CORES];
+  Sim  *sim;
+  uns   ii;
 
-    srand(42);
+    simctx_init(&params);
 
     get_params(argc, argv);
 
-    assert(NUM_CORES<=MAX_CORES);
+    assert(params.num_cores<=MAX_CORES);
 
-    //---- Initiliaze the system
-    memsys = memsys_new();
+    //---- Only convert the trace to the flat format
+    if(convert_filename[0]){
+      uns64 num_recs = trace_convert(trace_filename[0], convert_filename);
+      printf("Wrote %llu records to %s\n", num_recs, convert_filename);
+      return 0;
+    }
 
-    for(ii=0; ii<NUM_CORES; ii++){
-	core[ii] = core_new(memsys,trace_filename[ii], ii);
+    //---- Only find the simulation points of trace_0
+    if(simpoint_profile_filename[0]){
+      uns num_points = simpoint_profile(trace_filename[0], simpoint_interval, simpoint_k, simpoint_profile_filename);
+      printf("Wrote %u simulation points to %s\n", num_points, simpoint_profile_filename);
+      return 0;
     }
 
-    print_dots();
+    if(mrc_filename[0] && (sweep_filename[0] || params.sim_mode==SIM_MODE_A)){
+      die_message("-mrc needs an L2 (mode 2 to 6) and cannot be combined with -sweep");
+    }
 
-    //--------------------------------------------------------------------
-    // -- Iterate until all cores are done
-    //--------------------------------------------------------------------
-    Flag all_cores_done=0;
-    
-    while( ! (all_cores_done) ){
-       all_cores_done=1;
-      
-      for(ii=0; ii<NUM_CORES; ii++){
-	core_cycle(core[ii]);
-	all_cores_done &= core[ii]->done;
+    // the profiler stacks are not part of a checkpoint, a curve would
+    // only cover the accesses after the restore
+    if(mrc_filename[0] && (checkpoint_inst || restore_filename[0])){
+      die_message("-mrc cannot be combined with -checkpoint_at or -restore");
+    }
+
+    for(ii=0; ii<MAX_CORES; ii++){
+      fnames[ii] = trace_filename[ii];
+    }
+
+    //---- Run every configuration of the sweep file over the same traces
+    if(sweep_filename[0]){
+      sweep_run(sweep_filename, &params, fnames, sweep_jobs);
+      return 0;
+    }
+
+    //---- Initiliaze the system
+    sim = sim_new(&params, fnames);
+
+    if(restore_filename[0]){
+      sim_restore(sim, restore_filename);
+    }
+
+    if(mrc_filename[0]){
+      for(ii=0; ii<params.num_cores; ii++){
+	sim->memsys->sdprof[ii] = stackdist_new();
       }
-      
-      if (cycle - last_printdot_cycle >= DOT_INTERVAL){
-	print_dots();
+    }
+
+    //---- Simulate only the simulation points, report their weighted stats
+    if(simpoint_filename[0]){
+      Simpoint_Est est;
+      sim_run_simpoints(sim, simpoint_filename, &est);
+      simpoint_print_stats(&est, params.out);
+      sim_free(sim);
+      return 0;
+    }
+
+    //---- Run up to the checkpoint, save the state and stop. The
+    //---- fast-forward is done functionally first, if there is one.
+    if(checkpoint_inst){
+      sim_ffwd(sim, params.ffwd_inst);
+      while(sim_inst_count(sim) < checkpoint_inst && !sim_step(sim)){
       }
-      
-      cycle++; 
+      sim_checkpoint(sim, checkpoint_filename);
+      printf("\nWrote checkpoint at %llu instructions (cycle %llu) to %s\n",
+	     sim_inst_count(sim), sim->ctx.cycle, checkpoint_filename);
+      sim_free(sim);
+      return 0;
     }
+
+    sim_run(sim);
     
-    print_stats();
+    sim_print_stats(sim);
+
+    if(mrc_filename[0]){
+      write_mrc(sim);
+    }
+
+    sim_free(sim);
     return 0;
 }
 
 //--------------------------------------------------------------------
-// -- Print statistics
+// -- Miss ratio curves: LRU miss ratio of the L2 access stream (L1
+// -- misses and writebacks) for every power-of-2 set count and every
+// -- associativity, profiled in the same pass as the simulation.
 //--------------------------------------------------------------------
 
-void print_stats(){
+void write_mrc(Sim *sim){
+  FILE *fp;
   uns ii;
 
-  printf("\n");
-  printf("\nCYCLES      \t\t\t : %10llu", cycle);
-  
-  for(ii=0; ii<NUM_CORES; ii++){
-    core_print_stats(core[ii]);
+  if ((fp = fopen(mrc_filename, "w")) == NULL){
+    die_message("Unable to open the miss ratio curve file");
   }
-  
-  memsys_print_stats(memsys);
-  
-  printf("\n\n");
-}
-
-//--------------------------------------------------------------------
-// -- Print Hearbeats 
-//--------------------------------------------------------------------
 
-
-void print_dots(){
-  uns LINE_INTERVAL = 50 *  DOT_INTERVAL;
-
-  last_printdot_cycle = cycle;
-
-  if(!PRINT_DOTS){
-      return;
+  fprintf(fp, "core,sets,assoc,size_kb,accesses,misses,miss_ratio\n");
+  for(ii=0; ii<sim->ctx.num_cores; ii++){
+    stackdist_print_csv(sim->memsys->sdprof[ii], fp, ii, sim->ctx.cache_linesize);
   }
-
-  if (cycle % LINE_INTERVAL ==0){
-	printf("\n%4llu M\t", cycle/1000000);
-	fflush(stdout);
-    }
-    else{
-	printf(".");
-	fflush(stdout);
-    }
-    
+  fclose(fp);
 }
 
-
 //--------------------------------------------------------------------
 // -- Usage Menu
 //--------------------------------------------------------------------
@@ -159,23 +170,161 @@ void die_usage() {
     printf("   Options\n");
     printf("      -mode            <num>    Set mode of the simulator[1:PartA, 2:PartB, 3:PartC 4:PartD 5:PartE]  (Default: 1)\n");
     printf("      -linesize        <num>    Set cache linesize for all caches (Default:64)\n");
-    printf("      -repl            <num>    Set replacement policy for L1 cache [0:LRU,1:RND] (Default:0)\n");
+    printf("      -repl            <num>    Set replacement policy for L1 cache [0:LRU,1:RND,4:TREE_PLRU,5:BIT_PLRU] (Default:0)\n");
     printf("      -DsizeKB         <num>    Set capacity in KB of the the Level 1 DCACHE (Default:32 KB)\n");
     printf("      -Dassoc          <num>    Set associativity of the the Level 1 DCACHE (Default:8)\n");
     printf("      -L2sizeKB        <num>    Set capacity in KB of the unified Level 2 cache (Default: 512 KB)\n");
-    printf("      -L2repl          <num>    Set replacement policy for L2 cache [0:LRU,1:RND,2:SWP] (Default:0)\n");
-    printf("      -SWP_core0ways   <num>    Set static quota for core_0 for SWP (Default:1)\n");
+    printf("      -L2repl          <num>    Set replacement policy for L2 cache [0:LRU,1:RND,2:SWP,4:TREE_PLRU,5:BIT_PLRU] (Default:0)\n");
+    printf("      -L2slices        <num>    Split the L2 into <num> address-hashed slices on a mesh, a power of 2 (Default:1)\n");
+    printf("      -L2hop           <num>    Cycles per mesh hop between a core and an L2 slice, each way (Default:1)\n");
+    printf("      -L2busy          <num>    Cycles an access occupies its L2 slice's port (Default:2)\n");
+    printf("      -core            <num>    Core model [0:in-order, blocking on loads, 1:out-of-order] (Default:0)\n");
+    printf("      -width           <num>    Out-of-order: instructions dispatched and retired per cycle (Default:4)\n");
+    printf("      -rob             <num>    Out-of-order: reorder buffer entries (Default:224)\n");
+    printf("      -lq              <num>    Out-of-order: load queue entries (Default:72)\n");
+    printf("      -sq              <num>    Out-of-order: store queue entries (Default:56)\n");
+    printf("      -L1mshrs         <num>    MSHRs per L1 cache, loads no longer block the core [0:blocking] (Default:0)\n");
+    printf("      -L2mshrs         <num>    MSHRs per L2 slice [0:blocking] (Default:0)\n");
+    printf("      -load_dep        <num>    With -L1mshrs, a load waits for the data of the load <num> loads back [0:independent] (Default:0)\n");
+    printf("      -SWP_core0ways   <num>    Set static quota for core_0 for SWP, the other cores share the rest (Default:1)\n");
+    printf("      -SWP_ways        <list>   Set the SWP quota of every core, e.g. 4,4,8 (overrides -SWP_core0ways)\n");
+    printf("      -skipidle        <num>    Skip cycles where every core is snoozing [0:off,1:on] (Default:1)\n");
+    printf("      -tracethread     <num>    Decode each trace on a prefetch thread [0:off,1:on] (Default:0)\n");
+    printf("      -ffwd            <num>    Fast-forward <num> instructions updating only the cache tags (Default:0)\n");
+    printf("      -warmup          <num>    Then simulate <num> instructions with timing and drop their stats (Default:0)\n");
+    printf("      -sample_period   <num>    Sample: of every <num> instructions, warm the caches functionally, then simulate\n");
+    printf("                                -sample_warmup + -sample_unit in detail and measure the unit [0:off] (Default:0)\n");
+    printf("      -sample_warmup   <num>    Detailed instructions before each measured unit (Default:2000)\n");
+    printf("      -sample_unit     <num>    Measured instructions per sample (Default:1000)\n");
+    printf("      -dram_ctrl       <num>    DRAM timing [0:row buffer latency only, 1:controller with bank/bus queues, FR-FCFS writes] (Default:0)\n");
+    printf("      -dram_channels   <num>    DRAM channels, each with its own data bus (Default:1)\n");
+    printf("      -dram_ranks      <num>    Ranks per channel (Default:1)\n");
+    printf("      -dram_banks      <num>    Banks per rank (Default:16)\n");
+    printf("      -dram_rowbuf     <num>    Row buffer size in bytes (Default:1024)\n");
+    printf("      -dram_map        <order>  Line address fields, most significant first (Default: row:rank:bank:channel:column)\n");
+    printf("      -dram_xor        <num>    XOR the bank index with the low row bits [0:off,1:on] (Default:0)\n");
+    printf("      -dram_page       <num>    DRAM row buffer policy [0:open,1:closed,2:adaptive] (Default:0)\n");
+    printf("      -dram_timing     <name>   DRAM timing [base,DDR4-2400,DDR4-3200,DDR5-4800 or a file of \"<param> <ns>\" lines] (Default:base)\n");
+    printf("      -core_ghz        <num>    Core clock in GHz, converts the DRAM timing from ns (Default:3.2)\n");
+    printf("      -threads         <num>    Run the cores on <num> threads (Default:1)\n");
+    printf("      -quantum         <num>    Cycles between thread synchronizations [1:same results as one thread] (Default:1)\n");
+    printf("      -convert         <file>   Write trace_0 as a flat (mmap-able) trace to <file> and exit\n");
+    printf("      -sweep           <file>   Simulate each line of <file> (options, -out <file>, traces) over one decoded copy of each trace\n");
+    printf("      -j               <num>    Run that many sweep configurations in parallel [0:one per CPU] (Default:1)\n");
+    printf("      -checkpoint_at   <num>    Save the simulator state once the cores have run <num> instructions and exit\n");
+    printf("      -checkpoint      <file>   Where -checkpoint_at saves the state (Default: sim.ckpt)\n");
+    printf("      -restore         <file>   Start from a saved state instead of the beginning of the traces\n");
+    printf("      -mrc             <file>   Write LRU miss ratio curves of the L2 access stream to <file> (CSV)\n");
+    printf("      -simpoint_profile <file>  Cluster the basic block vectors of trace_0 and write its simulation points to <file>\n");
+    printf("      -simpoint_interval <num>  Instructions per simulation point interval (Default:100000)\n");
+    printf("      -simpoint_k      <num>    Number of clusters (Default:5)\n");
+    printf("      -simpoint        <file>   Simulate only the points in <file> (after -warmup instructions each) and weight them\n");
     exit(0);
 }
 
 //--------------------------------------------------------------------
-// -- Print Error Message and Die
+// -- Apply the option at argv[ii] (and its value), return the index of
+// -- the last argument consumed. Simulator options go to the context,
+// -- the rest select what the driver does.
 //--------------------------------------------------------------------
 
-												          
-void die_message(const char * msg) {
-    printf("Error! %s. Exiting...\n", msg);
-    exit(1);
+int get_option(int argc, char** argv, int ii){
+  int last = simctx_option(&params, argc, argv, ii);
+
+    if (last >= 0) {
+	return last;
+    }
+
+    else if (!strcmp(argv[ii], "-h") || !strcmp(argv[ii], "-help")) {
+	die_usage();
+    }	    
+
+    else if (!strcmp(argv[ii], "-convert")) {
+	if (ii < argc - 1) {		  
+	    strncpy(convert_filename, argv[ii+1], sizeof(convert_filename)-1);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-sweep")) {
+	if (ii < argc - 1) {		  
+	    strncpy(sweep_filename, argv[ii+1], sizeof(sweep_filename)-1);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-j")) {
+	if (ii < argc - 1) {		  
+	    sweep_jobs = atoi(argv[ii+1]);
+	    if(sweep_jobs == 0){
+	      sweep_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	    }
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-checkpoint_at")) {
+	if (ii < argc - 1) {		  
+	    checkpoint_inst = strtoull(argv[ii+1], NULL, 10);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-checkpoint")) {
+	if (ii < argc - 1) {		  
+	    strncpy(checkpoint_filename, argv[ii+1], sizeof(checkpoint_filename)-1);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-restore")) {
+	if (ii < argc - 1) {		  
+	    strncpy(restore_filename, argv[ii+1], sizeof(restore_filename)-1);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-mrc")) {
+	if (ii < argc - 1) {		  
+	    strncpy(mrc_filename, argv[ii+1], sizeof(mrc_filename)-1);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-simpoint_profile")) {
+	if (ii < argc - 1) {		  
+	    strncpy(simpoint_profile_filename, argv[ii+1], sizeof(simpoint_profile_filename)-1);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-simpoint_interval")) {
+	if (ii < argc - 1) {		  
+	    simpoint_interval = strtoull(argv[ii+1], NULL, 10);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-simpoint_k")) {
+	if (ii < argc - 1) {		  
+	    simpoint_k = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-simpoint")) {
+	if (ii < argc - 1) {		  
+	    strncpy(simpoint_filename, argv[ii+1], sizeof(simpoint_filename)-1);
+	    ii += 1;
+	}
+    }
+    
+    else {
+	char msg[256];
+	sprintf(msg, "Invalid option %s", argv[ii]);
+	die_message(msg);
+    }
+    return ii;
 }
 
 //--------------------------------------------------------------------
@@ -195,80 +344,16 @@ void get_params(int argc, char** argv){
     //--------------------------------------------------------------------    
     for ( ii = 1; ii < argc; ii++) {
 	if (argv[ii][0] == '-') {	    
-	    if (!strcmp(argv[ii], "-h") || !strcmp(argv[ii], "-help")) {
-		die_usage();
-	    }	    
-
-	    else if (!strcmp(argv[ii], "-mode")) {
-		if (ii < argc - 1) {		  
-     		  SIM_MODE = atoi(argv[ii+1]);
-		  ii += 1;
-		}
-	    }
-
-	    else if (!strcmp(argv[ii], "-linesize")) {
-		if (ii < argc - 1) {		  
-		    CACHE_LINESIZE = atoi(argv[ii+1]);
-		    ii += 1;
-		}
-	    }
-
-	    else if (!strcmp(argv[ii], "-repl")) {
-		if (ii < argc - 1) {		  
-		    REPL_POLICY = atoi(argv[ii+1]);
-		    ii += 1;
-		}
-	    }
-
-	    else if (!strcmp(argv[ii], "-DsizeKB")) {
-		if (ii < argc - 1) {		  
-		    DCACHE_SIZE = atoi(argv[ii+1])*1024;
-		    ii += 1;
-		}
-	    }
-
-	    else if (!strcmp(argv[ii], "-Dassoc")) {
-		if (ii < argc - 1) {		  
-		    DCACHE_ASSOC = atoi(argv[ii+1]);
-		    ii += 1;
-		}
-	    }
-
-	    else if (!strcmp(argv[ii], "-L2sizeKB")) {
-		if (ii < argc - 1) {		  
-		    L2CACHE_SIZE = atoi(argv[ii+1])*1024;
-		    ii += 1;
-		}
-	    }
-
-	    else if (!strcmp(argv[ii], "-L2repl")) {
-		if (ii < argc - 1) {		  
-		    L2CACHE_REPL = atoi(argv[ii+1]);
-		    ii += 1;
-		}
-	    }
-
-	    else if (!strcmp(argv[ii], "-SWP_core0ways")) {
-		if (ii < argc - 1) {		  
-		    SWP_CORE0_WAYS = atoi(argv[ii+1]);
-		    ii += 1;
-		}
-	    }
-	    
-	    else {
-		char msg[256];
-		sprintf(msg, "Invalid option %s", argv[ii]);
-		die_message(msg);
-	    }
+	    ii = get_option(argc, argv, ii);
 	}
 	else if (num_trace_filename<MAX_CORES) {
 	    strcpy(trace_filename[num_trace_filename], argv[ii]);
 	    num_trace_filename++;
-	    NUM_CORES=num_trace_filename;
+	    params.num_cores=num_trace_filename;
 	}
 	else {
 	    char msg[256];
-	    sprintf(msg, "Invalid option %s, got filename %s", argv[ii], trace_filename[NUM_CORES]);
+	    sprintf(msg, "Invalid option %s, got filename %s", argv[ii], trace_filename[params.num_cores]);
 	    die_message(msg);
 	}    
     }
@@ -276,7 +361,7 @@ void get_params(int argc, char** argv){
     //--------------------------------------------------------------------
     // Error checking
     //--------------------------------------------------------------------
-    if (num_trace_filename==0) {
+    if (num_trace_filename==0 && !sweep_filename[0]) {
 	die_message("Must provide at least one trace file");
     }
 
@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simctx.h"
+#include "dram.h"
+
+static void simctx_dram_map(SimContext *ctx, const char *spec);
+
+////////////////////////////////////////////////////////////////////
+// Default configuration
+////////////////////////////////////////////////////////////////////
+
+void simctx_init(SimContext *ctx)
+{
+  memset(ctx, 0, sizeof(SimContext));
+
+  ctx->sim_mode         = SIM_MODE_A;
+  ctx->cache_linesize   = 64;
+  ctx->repl_policy      = 0;
+
+  ctx->dcache_size      = 32*1024;
+  ctx->dcache_assoc     = 8;
+  ctx->icache_size      = 32*1024;
+  ctx->icache_assoc     = 8;
+  ctx->l2cache_size     = 1024*1024;
+  ctx->l2cache_assoc    = 16;
+  ctx->l2cache_repl     = 0;
+  ctx->l2_slices        = 1;
+  ctx->l2_hop_latency   = 1;
+  ctx->l2_port_busy     = 2;
+  ctx->l1_mshrs         = 0;
+  ctx->l2_mshrs         = 0;
+  ctx->load_dep         = 0;
+
+  ctx->swp_core0_ways   = 0;
+  ctx->num_cores        = 1;
+  ctx->core_model       = 0;
+  ctx->core_width       = 4;
+  ctx->rob_size         = 224;
+  ctx->lq_size          = 72;
+  ctx->sq_size          = 56;
+
+  ctx->skip_idle_cycles = 1;
+  ctx->trace_prefetch   = 0;
+  ctx->sample_period    = 0;
+  ctx->sample_warmup    = 2000;
+  ctx->sample_unit      = 1000;
+  ctx->dram_ctrl        = 0;
+  ctx->dram_channels    = 1;
+  ctx->dram_ranks       = 1;
+  ctx->dram_banks       = 16;
+  ctx->dram_rowbuf_size = 1024;
+  ctx->dram_xor         = 0;
+  ctx->dram_page_policy = 0;
+  strcpy(ctx->dram_timing, "base");
+  ctx->core_ghz         = 3.2;
+  simctx_dram_map(ctx, "row:rank:bank:channel:column");
+  ctx->threads          = 1;
+  ctx->quantum          = 1;
+  ctx->print_dots       = TRUE;
+  ctx->out              = stdout;
+
+  simctx_srand(ctx, 42);
+}
+
+////////////////////////////////////////////////////////////////////
+// Apply the simulator option at argv[ii] (and its value). Returns the
+// index of the last argument consumed, or -1 if argv[ii] is not a
+// simulator option so the caller can handle its own.
+////////////////////////////////////////////////////////////////////
+
+int simctx_option(SimContext *ctx, int argc, char **argv, int ii)
+{
+    if (!strcmp(argv[ii], "-mode")) {
+	if (ii < argc - 1) {		  
+	  ctx->sim_mode = (MODE) atoi(argv[ii+1]);
+	  ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-linesize")) {
+	if (ii < argc - 1) {		  
+	    ctx->cache_linesize = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-repl")) {
+	if (ii < argc - 1) {		  
+	    ctx->repl_policy = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-DsizeKB")) {
+	if (ii < argc - 1) {		  
+	    ctx->dcache_size = atoi(argv[ii+1])*1024;
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-Dassoc")) {
+	if (ii < argc - 1) {		  
+	    ctx->dcache_assoc = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-L2sizeKB")) {
+	if (ii < argc - 1) {		  
+	    ctx->l2cache_size = atoi(argv[ii+1])*1024;
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-L2repl")) {
+	if (ii < argc - 1) {		  
+	    ctx->l2cache_repl = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-L2slices")) {
+	if (ii < argc - 1) {		  
+	    ctx->l2_slices = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-L2hop")) {
+	if (ii < argc - 1) {		  
+	    ctx->l2_hop_latency = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-L2busy")) {
+	if (ii < argc - 1) {		  
+	    ctx->l2_port_busy = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-SWP_core0ways")) {
+	if (ii < argc - 1) {		  
+	    ctx->swp_core0_ways = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-SWP_ways")) {
+	if (ii < argc - 1) {		  
+	    char *p = argv[ii+1];
+	    ctx->swp_num_quota = 0;
+	    while(*p && ctx->swp_num_quota < MAX_CORES){
+	      ctx->swp_quota[ctx->swp_num_quota++] = strtoull(p, &p, 10);
+	      p += (*p == ',');
+	    }
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-skipidle")) {
+	if (ii < argc - 1) {		  
+	    ctx->skip_idle_cycles = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-tracethread")) {
+	if (ii < argc - 1) {		  
+	    ctx->trace_prefetch = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-ffwd")) {
+	if (ii < argc - 1) {		  
+	    ctx->ffwd_inst = strtoull(argv[ii+1], NULL, 10);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-warmup")) {
+	if (ii < argc - 1) {		  
+	    ctx->warmup_inst = strtoull(argv[ii+1], NULL, 10);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-sample_period")) {
+	if (ii < argc - 1) {		  
+	    ctx->sample_period = strtoull(argv[ii+1], NULL, 10);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-sample_warmup")) {
+	if (ii < argc - 1) {		  
+	    ctx->sample_warmup = strtoull(argv[ii+1], NULL, 10);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-sample_unit")) {
+	if (ii < argc - 1) {		  
+	    ctx->sample_unit = strtoull(argv[ii+1], NULL, 10);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-core")) {
+	if (ii < argc - 1) {		  
+	    ctx->core_model = atoi(argv[ii+1]);
+	    if(ctx->core_model > 1){
+	      die_message("-core must be 0 (in-order) or 1 (out-of-order)");
+	    }
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-width")) {
+	if (ii < argc - 1) {		  
+	    ctx->core_width = atoi(argv[ii+1]);
+	    if(!ctx->core_width){
+	      die_message("-width must be at least 1");
+	    }
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-rob")) {
+	if (ii < argc - 1) {		  
+	    ctx->rob_size = atoi(argv[ii+1]);
+	    if(!ctx->rob_size){
+	      die_message("-rob must be at least 1");
+	    }
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-lq")) {
+	if (ii < argc - 1) {		  
+	    ctx->lq_size = atoi(argv[ii+1]);
+	    if(!ctx->lq_size){
+	      die_message("-lq must be at least 1");
+	    }
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-sq")) {
+	if (ii < argc - 1) {		  
+	    ctx->sq_size = atoi(argv[ii+1]);
+	    if(!ctx->sq_size){
+	      die_message("-sq must be at least 1");
+	    }
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-L1mshrs")) {
+	if (ii < argc - 1) {		  
+	    ctx->l1_mshrs = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-L2mshrs")) {
+	if (ii < argc - 1) {		  
+	    ctx->l2_mshrs = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-load_dep")) {
+	if (ii < argc - 1) {		  
+	    ctx->load_dep = atoi(argv[ii+1]);
+	    if(ctx->load_dep > MAX_LOAD_DEP){
+	      char msg[256];
+	      sprintf(msg, "-load_dep can be at most %d", MAX_LOAD_DEP);
+	      die_message(msg);
+	    }
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-dram_ctrl")) {
+	if (ii < argc - 1) {		  
+	    ctx->dram_ctrl = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-dram_channels")) {
+	if (ii < argc - 1) {		  
+	    ctx->dram_channels = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-dram_ranks")) {
+	if (ii < argc - 1) {		  
+	    ctx->dram_ranks = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-dram_banks")) {
+	if (ii < argc - 1) {		  
+	    ctx->dram_banks = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-dram_rowbuf")) {
+	if (ii < argc - 1) {		  
+	    ctx->dram_rowbuf_size = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-dram_map")) {
+	if (ii < argc - 1) {		  
+	    simctx_dram_map(ctx, argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-dram_xor")) {
+	if (ii < argc - 1) {		  
+	    ctx->dram_xor = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-dram_page")) {
+	if (ii < argc - 1) {		  
+	    ctx->dram_page_policy = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-dram_timing")) {
+	if (ii < argc - 1) {		  
+	    snprintf(ctx->dram_timing, sizeof(ctx->dram_timing), "%s", argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-core_ghz")) {
+	if (ii < argc - 1) {		  
+	    ctx->core_ghz = atof(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-threads")) {
+	if (ii < argc - 1) {		  
+	    ctx->threads = atoi(argv[ii+1]);
+	    ii += 1;
+	}
+    }
+
+    else if (!strcmp(argv[ii], "-quantum")) {
+	if (ii < argc - 1) {		  
+	    ctx->quantum = strtoull(argv[ii+1], NULL, 10);
+	    ii += 1;
+	}
+    }
+
+    else {
+	return -1;
+    }
+    return ii;
+}
+
+////////////////////////////////////////////////////////////////////
+// -dram_map: field names from the most significant down, e.g.
+// row:rank:bank:channel:column. Unknown names are stored as
+// DRAM_MAP_FIELDS and rejected by dram_new() with the other checks.
+////////////////////////////////////////////////////////////////////
+
+static void simctx_dram_map(SimContext *ctx, const char *spec)
+{
+  static const char *names[DRAM_MAP_FIELDS] = { "column", "channel", "bank", "rank", "row" };
+  uns8 field[DRAM_MAP_FIELDS];
+  uns  num = 0, ii;
+
+  memset(field, DRAM_MAP_FIELDS, sizeof(field));
+  while(*spec && num < DRAM_MAP_FIELDS){
+    size_t len = strcspn(spec, ":");
+    for(ii=0; ii<DRAM_MAP_FIELDS; ii++){
+      if(strlen(names[ii]) == len && !strncmp(spec, names[ii], len)){
+	field[num] = ii;
+      }
+    }
+    num++;
+    spec += len + (spec[len] == ':');
+  }
+
+  for(ii=0; ii<DRAM_MAP_FIELDS; ii++){
+    ctx->dram_map[ii] = (num == DRAM_MAP_FIELDS && !*spec) ? field[DRAM_MAP_FIELDS-1-ii] : DRAM_MAP_FIELDS;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// x[i] = x[i-3] + x[i-31], seeded by a Lehmer generator and run for
+// 310 steps before use: the TYPE_3 generator behind rand(), so RAND
+// replacement picks the same victims as with srand()/rand().
+////////////////////////////////////////////////////////////////////
+
+void simctx_srand(SimContext *ctx, uns32 seed)
+{
+  int32 word = seed ? (int32) seed : 1;
+  uns   ii;
+
+  ctx->rand_state[0] = word;
+  for(ii=1; ii<31; ii++){
+    int32 hi = word / 127773;
+    int32 lo = word % 127773;
+    word = 16807 * lo - 2836 * hi;
+    if(word < 0){
+      word += 2147483647;
+    }
+    ctx->rand_state[ii] = word;
+  }
+  for(ii=31; ii<34; ii++){
+    ctx->rand_state[ii % SIMCTX_RAND_DEG] = ctx->rand_state[(ii-31) % SIMCTX_RAND_DEG];
+  }
+
+  ctx->rand_pos = 34;
+  for(ii=34; ii<344; ii++){
+    simctx_rand(ctx);
+  }
+}
+
+uns32 simctx_rand(SimContext *ctx)
+{
+  uns    pos = ctx->rand_pos++ % SIMCTX_RAND_DEG;
+  uns32  val = ctx->rand_state[(pos + SIMCTX_RAND_DEG - 31) % SIMCTX_RAND_DEG]
+             + ctx->rand_state[(pos + SIMCTX_RAND_DEG - 3)  % SIMCTX_RAND_DEG];
+
+  ctx->rand_state[pos] = val;
+  return val >> 1;
+}
+
+////////////////////////////////////////////////////////////////////
+// Print Error Message and Die
+////////////////////////////////////////////////////////////////////
+
+void die_message(const char * msg)
+{
+  printf("Error! %s. Exiting...\n", msg);
+  exit(1);
+}
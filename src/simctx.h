@@ -0,0 +1,94 @@
+#ifndef SIMCTX_H
+#define SIMCTX_H
+
+#include <stdio.h>
+
+#include "types.h"
+
+#define SIMCTX_RAND_DEG  32
+#define DRAM_MAP_FIELDS  5
+#define MAX_LOAD_DEP     64  // largest -load_dep
+
+//////////////////////////////////////////////////////////////////
+// Everything one simulation reads that used to be process-wide:
+// the configuration set from the command line, the global clock
+// and the random number state. cache_new, dram_new, memsys_new and
+// core_new keep a pointer to it, so several simulations can live in
+// one process (or on several threads) as long as each has its own.
+//////////////////////////////////////////////////////////////////
+
+typedef struct SimContext SimContext;
+
+struct SimContext {
+  MODE   sim_mode;
+  uns64  cache_linesize;
+  uns64  repl_policy;      // 0:LRU 1:RAND 4:TREE_PLRU 5:BIT_PLRU
+
+  uns64  dcache_size;
+  uns64  dcache_assoc;
+  uns64  icache_size;
+  uns64  icache_assoc;
+  uns64  l2cache_size;
+  uns64  l2cache_assoc;
+  uns64  l2cache_repl;     // 0:LRU 1:RND 2:SWP 3:UCP 4:TREE_PLRU 5:BIT_PLRU
+  uns64  l2_slices;        // NUCA: address-interleaved L2 slices, 1 is the flat L2
+  uns64  l2_hop_latency;   // NUCA: cycles per mesh hop, each way
+  uns64  l2_port_busy;     // NUCA: cycles an access holds its slice's port
+  uns64  l1_mshrs;         // MSHRs per L1 cache, 0 is a blocking cache and core
+  uns64  l2_mshrs;         // MSHRs per L2 slice, 0 is a blocking L2
+  uns64  load_dep;         // with -L1mshrs: a load needs the data of the load this many loads back, 0:none
+
+  uns64  swp_core0_ways;   // SWP way partition for core 0, the rest is split evenly
+  uns64  swp_quota[MAX_CORES]; // or an explicit quota per core (-SWP_ways)
+  uns64  swp_num_quota;
+  uns64  num_cores;
+  uns64  core_model;       // 0:in-order blocking 1:out-of-order (see core_cycle_ooo)
+  uns64  core_width;       // out-of-order: instructions dispatched/retired per cycle
+  uns64  rob_size;         // out-of-order: reorder buffer entries
+  uns64  lq_size;          // out-of-order: loads in the window
+  uns64  sq_size;          // out-of-order: stores in the window
+
+  uns64  skip_idle_cycles; // 0:lock-step 1:jump over cycles where all cores snooze
+  uns64  trace_prefetch;   // 1:decode each trace on its own thread
+  uns64  ffwd_inst;        // instructions run functionally (tags only) first
+  uns64  warmup_inst;      // then timed instructions whose stats are dropped
+  uns64  sample_period;    // 0:run everything in detail, else instructions per sample
+  uns64  sample_warmup;    // detailed but unmeasured instructions before each unit
+  uns64  sample_unit;      // measured instructions at the end of each period
+  uns64  dram_ctrl;        // 0:fixed row buffer latency 1:memory controller with queues
+  uns64  dram_channels;
+  uns64  dram_ranks;       // per channel
+  uns64  dram_banks;       // per rank
+  uns64  dram_rowbuf_size; // bytes per row
+  uns8   dram_map[DRAM_MAP_FIELDS]; // Dram_Field of each address field, lowest first
+  uns64  dram_xor;         // 1:XOR the bank index with the low row bits
+  uns64  dram_page_policy; // 0:open 1:closed 2:adaptive
+  char   dram_timing[256]; // timing preset or file, see dram_timing_load()
+  double core_ghz;         // core clock, converts the DRAM timing from ns
+  uns64  threads;          // >1: run the cores on that many threads (see parallel.h)
+  uns64  quantum;          // cycles between thread synchronizations, 1 is deterministic
+  Flag   print_dots;       // heartbeat while running
+  FILE  *out;              // where stats and heartbeat go (Default: stdout)
+
+  uns64  cycle;            // global clock, also the LRU timestamp
+  uns64  stat_cycle;       // cycle at which the stats were last reset
+
+  // additive feedback generator, same sequence as the C library rand()
+  uns32  rand_state[SIMCTX_RAND_DEG];
+  uns    rand_pos;
+};
+
+//////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+void   simctx_init  (SimContext *ctx);
+int    simctx_option(SimContext *ctx, int argc, char **argv, int ii);
+void   simctx_srand (SimContext *ctx, uns32 seed);
+uns32  simctx_rand  (SimContext *ctx);
+
+// Configuration and I/O errors: print and exit
+void   die_message  (const char *msg) __attribute__((noreturn));
+
+//////////////////////////////////////////////////////////////////
+
+#endif // SIMCTX_H
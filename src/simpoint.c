@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "simpoint.h"
+
+typedef struct Simpoint Simpoint;
+
+struct Simpoint {
+  uns64  interval;
+  double weight;
+  uns    cluster;
+};
+
+static uns    simpoint_dim(Addr block_addr);
+static double simpoint_dist(double *a, double *b);
+static void   simpoint_kmeans(double *bbv, uns64 num, uns k, uns *cluster, double *centroid);
+static int    simpoint_cmp(const void *a, const void *b);
+
+
+////////////////////////////////////////////////////////////////////
+// Profile one trace and write its simulation points. Only whole
+// intervals are profiled. Returns the number of points written.
+////////////////////////////////////////////////////////////////////
+
+uns simpoint_profile(char *trace_fname, uns64 interval_size, uns k, char *out_fname)
+{
+  Trace    *t = trace_open(trace_fname, FALSE);
+  Trace_Rec rec;
+  double   *bbv = NULL, *centroid;
+  uns      *cluster;
+  Simpoint *point;
+  uns64     num = 0, cap = 0, count = 0, ii;
+  Addr      prev_addr = 0;
+  uns       dim = 0, num_points = 0, cc;
+  FILE     *fp;
+
+  if(interval_size == 0 || k == 0){
+    die_message("-simpoint_interval and -simpoint_k must be non-zero");
+  }
+
+  while(trace_read(t, &rec)){
+    if(count == 0){
+      if(num == cap){
+	double *grown;
+	cap = cap ? 2*cap : 256;
+	if((grown = (double *) realloc (bbv, cap * SP_DIMS * sizeof(double))) == NULL){
+	  free(bbv);
+	  die_message("Unable to hold the basic block vectors in memory");
+	}
+	bbv = grown;
+      }
+      memset(&bbv[num*SP_DIMS], 0, SP_DIMS * sizeof(double));
+    }
+
+    // anything but a short forward step is a taken branch: new block
+    if(rec.inst_addr - prev_addr - 1 >= SP_MAX_INST_BYTES){
+      dim = simpoint_dim(rec.inst_addr);
+    }
+    prev_addr = rec.inst_addr;
+    bbv[num*SP_DIMS + dim] += 1.0/interval_size;
+
+    if(++count == interval_size){
+      num++;
+      count = 0;
+    }
+  }
+  trace_close(t);
+
+  if(num == 0){
+    die_message("Trace is shorter than one simulation point interval");
+  }
+  if(k > num){
+    k = num;
+  }
+
+  cluster  = (uns *)     calloc (num, sizeof(uns));
+  centroid = (double *)  calloc (k * SP_DIMS, sizeof(double));
+  point    = (Simpoint *) calloc (k, sizeof(Simpoint));
+  simpoint_kmeans(bbv, num, k, cluster, centroid);
+
+  // the point of a cluster is its interval closest to the centroid.
+  // Interval 0 runs on cold caches, so it is only picked if alone.
+  for(cc=0; cc<k; cc++){
+    double best = DBL_MAX;
+    uns64  members = 0, best_ii = 0;
+
+    for(ii=0; ii<num; ii++){
+      if(cluster[ii] == cc){
+	double d = simpoint_dist(&bbv[ii*SP_DIMS], &centroid[cc*SP_DIMS]);
+	members++;
+	if(d < best || best_ii == 0){
+	  best    = d;
+	  best_ii = ii;
+	}
+      }
+    }
+
+    if(members){
+      point[num_points].interval = best_ii;
+      point[num_points].weight   = (double)members/(double)num;
+      point[num_points].cluster  = cc;
+      num_points++;
+    }
+  }
+  qsort(point, num_points, sizeof(Simpoint), simpoint_cmp);
+
+  if ((fp = fopen(out_fname, "w")) == NULL){
+    die_message("Unable to create the simulation point file");
+  }
+  fprintf(fp, "# interval_size %llu intervals %llu\n", interval_size, num);
+  for(cc=0; cc<num_points; cc++){
+    fprintf(fp, "%llu %.6f %u\n", point[cc].interval, point[cc].weight, point[cc].cluster);
+  }
+  fclose(fp);
+
+  free(point);
+  free(centroid);
+  free(cluster);
+  free(bbv);
+  return num_points;
+}
+
+////////////////////////////////////////////////////////////////////
+// Fast-forward to each point, run the last -warmup instructions
+// before it in detail, then measure the interval. The Sim must have
+// one core and start at the beginning of its trace.
+////////////////////////////////////////////////////////////////////
+
+void sim_run_simpoints(Sim *sim, char *fname, Simpoint_Est *est)
+{
+  FILE  *fp;
+  uns64  interval_size, interval;
+  double weight;
+  uns    cluster;
+
+  memset(est, 0, sizeof(Simpoint_Est));
+
+  if(sim->ctx.num_cores != 1){
+    die_message("Simulation points are replayed on a single trace");
+  }
+  if ((fp = fopen(fname, "r")) == NULL){
+    die_message("Unable to open the simulation point file");
+  }
+  if(fscanf(fp, "# interval_size %llu intervals %*u", &interval_size) != 1 || interval_size == 0){
+    die_message("Not a simulation point file");
+  }
+
+  while(fscanf(fp, "%llu %lf %u", &interval, &weight, &cluster) == 3){
+    Sim_Counters cnt;
+    uns64 start = interval * interval_size;
+    uns64 pos   = sim_inst_count(sim);
+    uns64 warm  = sim->ctx.warmup_inst;
+
+    if(start < pos){
+      die_message("Simulation points must be in increasing order");
+    }
+    if(warm > start - pos){
+      warm = start - pos;
+    }
+
+    sim_ffwd(sim, start - pos - warm);
+    sim_step_inst(sim, warm);
+
+    sim_read_counters(sim, &cnt);
+    sim_step_inst(sim, interval_size);
+    sim_counters_delta(sim, &cnt);
+
+    if(cnt.inst < interval_size){
+      die_message("Trace ends before a simulation point");
+    }
+
+    est->num_points++;
+    est->inst            += cnt.inst;
+    est->inst_w          += weight * cnt.inst;
+    est->cycles_w        += weight * cnt.cycles;
+    est->ifetch_access_w += weight * cnt.ifetch_access;
+    est->ifetch_delay_w  += weight * cnt.ifetch_delay;
+    est->load_access_w   += weight * cnt.load_access;
+    est->load_delay_w    += weight * cnt.load_delay;
+    est->store_access_w  += weight * cnt.store_access;
+    est->store_delay_w   += weight * cnt.store_delay;
+  }
+  fclose(fp);
+
+  if(est->num_points == 0){
+    die_message("No simulation points in the file");
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+void simpoint_print_stats(Simpoint_Est *est, FILE *out)
+{
+  char header[256];
+  double ipc=0, ifetch_delay_avg=0, load_delay_avg=0, store_delay_avg=0;
+  sprintf(header, "SIMPOINT");
+
+  if(est->cycles_w){
+    ipc = est->inst_w/est->cycles_w;
+  }
+  if(est->ifetch_access_w){
+    ifetch_delay_avg = est->ifetch_delay_w/est->ifetch_access_w;
+  }
+  if(est->load_access_w){
+    load_delay_avg = est->load_delay_w/est->load_access_w;
+  }
+  if(est->store_access_w){
+    store_delay_avg = est->store_delay_w/est->store_access_w;
+  }
+
+  fprintf(out, "\n");
+  fprintf(out, "\n%s_POINTS           \t\t : %10llu", header, est->num_points);
+  fprintf(out, "\n%s_INST             \t\t : %10llu", header, est->inst);
+  fprintf(out, "\n%s_IPC              \t\t : %10.3f", header, ipc);
+  fprintf(out, "\n%s_IFETCH_AVGDELAY  \t\t : %10.3f", header, ifetch_delay_avg);
+  fprintf(out, "\n%s_LOAD_AVGDELAY    \t\t : %10.3f", header, load_delay_avg);
+  fprintf(out, "\n%s_STORE_AVGDELAY   \t\t : %10.3f", header, store_delay_avg);
+  fprintf(out, "\n\n");
+}
+
+////////////////////////////////////////////////////////////////////
+// Random projection of the block vector: each block lands in one
+// dimension picked by a hash of its start address
+////////////////////////////////////////////////////////////////////
+
+static uns simpoint_dim(Addr block_addr)
+{
+  block_addr ^= block_addr >> 33;
+  block_addr *= 0xff51afd7ed558ccdULL;
+  block_addr ^= block_addr >> 33;
+  return block_addr % SP_DIMS;
+}
+
+static double simpoint_dist(double *a, double *b)
+{
+  double d = 0;
+  uns ii;
+
+  for(ii=0; ii<SP_DIMS; ii++){
+    d += (a[ii]-b[ii]) * (a[ii]-b[ii]);
+  }
+  return d;
+}
+
+////////////////////////////////////////////////////////////////////
+// Lloyd's k-means. Seeds are picked farthest-first starting from the
+// first interval, so the clustering is deterministic.
+////////////////////////////////////////////////////////////////////
+
+static void simpoint_kmeans(double *bbv, uns64 num, uns k, uns *cluster, double *centroid)
+{
+  double *near = (double *) malloc (num * sizeof(double));
+  uns64  *size = (uns64 *)  malloc (k * sizeof(uns64));
+  uns64   ii;
+  uns     cc, dd, iter;
+
+  memcpy(centroid, bbv, SP_DIMS * sizeof(double));
+  for(ii=0; ii<num; ii++){
+    near[ii] = simpoint_dist(&bbv[ii*SP_DIMS], centroid);
+  }
+
+  for(cc=1; cc<k; cc++){
+    uns64 far = 0;
+    for(ii=1; ii<num; ii++){
+      if(near[ii] > near[far]){
+	far = ii;
+      }
+    }
+    memcpy(&centroid[cc*SP_DIMS], &bbv[far*SP_DIMS], SP_DIMS * sizeof(double));
+    for(ii=0; ii<num; ii++){
+      double d = simpoint_dist(&bbv[ii*SP_DIMS], &centroid[cc*SP_DIMS]);
+      if(d < near[ii]){
+	near[ii] = d;
+      }
+    }
+  }
+
+  for(iter=0; iter<SP_MAX_ITER; iter++){
+    Flag changed = (iter == 0);
+
+    for(ii=0; ii<num; ii++){
+      uns    best = 0;
+      double best_d = DBL_MAX;
+      for(cc=0; cc<k; cc++){
+	double d = simpoint_dist(&bbv[ii*SP_DIMS], &centroid[cc*SP_DIMS]);
+	if(d < best_d){
+	  best_d = d;
+	  best   = cc;
+	}
+      }
+      if(cluster[ii] != best){
+	cluster[ii] = best;
+	changed = TRUE;
+      }
+    }
+
+    if(!changed){
+      break;
+    }
+
+    // an empty cluster keeps its old centroid
+    memset(size, 0, k * sizeof(uns64));
+    for(ii=0; ii<num; ii++){
+      if(size[cluster[ii]]++ == 0){
+	memset(&centroid[cluster[ii]*SP_DIMS], 0, SP_DIMS * sizeof(double));
+      }
+      for(dd=0; dd<SP_DIMS; dd++){
+	centroid[cluster[ii]*SP_DIMS + dd] += bbv[ii*SP_DIMS + dd];
+      }
+    }
+    for(cc=0; cc<k; cc++){
+      for(dd=0; dd<SP_DIMS && size[cc]; dd++){
+	centroid[cc*SP_DIMS + dd] /= size[cc];
+      }
+    }
+  }
+
+  free(size);
+  free(near);
+}
+
+static int simpoint_cmp(const void *a, const void *b)
+{
+  const Simpoint *pa = (const Simpoint *) a;
+  const Simpoint *pb = (const Simpoint *) b;
+
+  return (pa->interval > pb->interval) - (pa->interval < pb->interval);
+}
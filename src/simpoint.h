@@ -0,0 +1,52 @@
+#ifndef SIMPOINT_H
+#define SIMPOINT_H
+
+#include <stdio.h>
+
+#include "types.h"
+#include "memsim.h"
+
+#define SP_DIMS            64  // basic block vectors are hashed to this many dimensions
+#define SP_MAX_INST_BYTES  16  // a longer (or backward) step in inst_addr starts a new basic block
+#define SP_MAX_ITER        100 // k-means iterations
+
+//////////////////////////////////////////////////////////////////
+// SimPoint-style phase analysis. The profile pass cuts a trace into
+// fixed size intervals, builds a basic block vector for each (how
+// many instructions ran in each block, hashed to SP_DIMS and
+// normalized), clusters them with k-means and writes the interval
+// closest to each centroid with the fraction of intervals in its
+// cluster as weight. Replay fast-forwards to each point, simulates
+// it in detail and combines the points by weight.
+//
+// Point file: "# interval_size <N>" then "<interval> <weight> <cluster>"
+// per point, intervals in increasing order.
+//////////////////////////////////////////////////////////////////
+
+typedef struct Simpoint_Est Simpoint_Est;
+
+// Weighted sums over the points: every ratio (IPC, average delay) is
+// sum(weight * numerator) / sum(weight * denominator)
+struct Simpoint_Est {
+  uns64  num_points;
+  uns64  inst;            // instructions simulated in detail
+  double inst_w;
+  double cycles_w;
+  double ifetch_access_w;
+  double ifetch_delay_w;
+  double load_access_w;
+  double load_delay_w;
+  double store_access_w;
+  double store_delay_w;
+};
+
+//////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+uns    simpoint_profile    (char *trace_fname, uns64 interval_size, uns k, char *out_fname);
+void   sim_run_simpoints   (Sim *sim, char *fname, Simpoint_Est *est);
+void   simpoint_print_stats(Simpoint_Est *est, FILE *out);
+
+//////////////////////////////////////////////////////////////////
+
+#endif // SIMPOINT_H
@@ -0,0 +1,260 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "stackdist.h"
+
+#define SD_NONE        0xFFFFFFFF
+#define SD_MIN_CAP     16
+#define SD_HASH_INIT   (1<<16)
+
+static uns32 stackdist_line_id(Stackdist *sd, Addr lineaddr, Flag *is_new);
+static void  stackdist_compact(Stackdist *sd, Stackdist_Set *set, uns level);
+static uns32 stackdist_prefix(Stackdist_Set *set, uns32 time);
+static void  stackdist_mark(Stackdist_Set *set, uns32 time, int delta);
+
+
+////////////////////////////////////////////////////////////////////
+// Per-set Mattson stack distances for every power-of-2 set count at
+// once. The histograms give the LRU miss count of every capacity and
+// associativity up to SD_MAX_SET_BITS/SD_MAX_ASSOC from a single pass.
+////////////////////////////////////////////////////////////////////
+
+Stackdist *stackdist_new(void)
+{
+  Stackdist *sd = (Stackdist *) calloc (1, sizeof (Stackdist));
+  uns level;
+
+  sd->hash_size = SD_HASH_INIT;
+  sd->hash_key  = (Addr *)  calloc (sd->hash_size, sizeof(Addr));
+  sd->hash_id   = (uns32 *) malloc (sd->hash_size * sizeof(uns32));
+  memset(sd->hash_id, 0xFF, sd->hash_size * sizeof(uns32));
+
+  for(level=0; level<SD_NUM_LEVELS; level++){
+    sd->sets[level] = (Stackdist_Set *) calloc (1ULL << level, sizeof(Stackdist_Set));
+  }
+
+  return sd;
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+void stackdist_free(Stackdist *sd)
+{
+  uns level;
+  uns64 ii;
+
+  for(level=0; level<SD_NUM_LEVELS; level++){
+    for(ii=0; ii < (1ULL << level); ii++){
+      free(sd->sets[level][ii].tree);
+      free(sd->sets[level][ii].owner);
+    }
+    free(sd->sets[level]);
+    free(sd->last[level]);
+  }
+  free(sd->hash_key);
+  free(sd->hash_id);
+  free(sd);
+}
+
+////////////////////////////////////////////////////////////////////
+// Record one access. O(log n) per set count.
+////////////////////////////////////////////////////////////////////
+
+void stackdist_access(Stackdist *sd, Addr lineaddr)
+{
+  Flag  is_new;
+  uns32 id = stackdist_line_id(sd, lineaddr, &is_new);
+  uns   level;
+
+  sd->stat_access++;
+
+  for(level=0; level<SD_NUM_LEVELS; level++){
+    Stackdist_Set *set = &sd->sets[level][lineaddr & ((1ULL << level) - 1)];
+    uns32 dist = SD_MAX_ASSOC;
+    uns32 time;
+
+    if(set->now == set->cap){
+      stackdist_compact(sd, set, level);
+    }
+    time = set->now++;
+
+    if(!is_new){
+      uns32 prev = sd->last[level][id];
+      dist = stackdist_prefix(set, time) - stackdist_prefix(set, prev+1);
+      stackdist_mark(set, prev, -1);
+      set->owner[prev] = SD_NONE;
+      if(dist > SD_MAX_ASSOC){
+	dist = SD_MAX_ASSOC;
+      }
+    }
+
+    sd->hist[level][dist]++;
+    stackdist_mark(set, time, +1);
+    set->owner[time] = id;
+    sd->last[level][id] = time;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// Drop the histograms but keep the stacks, so accesses after a warmup
+// still see the distances to lines touched during it.
+////////////////////////////////////////////////////////////////////
+
+void stackdist_reset_stats(Stackdist *sd)
+{
+  memset(sd->hist, 0, sizeof(sd->hist));
+  sd->stat_access = 0;
+}
+
+////////////////////////////////////////////////////////////////////
+// One row per (sets, assoc): an LRU cache with d ways misses on every
+// access whose stack distance is d or more.
+////////////////////////////////////////////////////////////////////
+
+void stackdist_print_csv(Stackdist *sd, FILE *fp, uns core_id, uns64 linesize)
+{
+  uns   level, assoc;
+
+  for(level=0; level<SD_NUM_LEVELS; level++){
+    uns64 misses = sd->hist[level][SD_MAX_ASSOC];
+    uns64 row_misses[SD_MAX_ASSOC+1];
+
+    for(assoc=SD_MAX_ASSOC; assoc>=1; assoc--){
+      row_misses[assoc] = misses;
+      misses += sd->hist[level][assoc-1];
+    }
+
+    for(assoc=1; assoc<=SD_MAX_ASSOC; assoc++){
+      uns64 sets = 1ULL << level;
+      double mr  = 0;
+      if(sd->stat_access){
+	mr = (double)(row_misses[assoc])/(double)(sd->stat_access);
+      }
+      fprintf(fp, "%u,%llu,%u,%llu,%llu,%llu,%.6f\n", core_id, sets, assoc,
+	      sets*assoc*linesize/1024, sd->stat_access, row_misses[assoc], mr);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// Open addressing with linear probing; grows at half load
+////////////////////////////////////////////////////////////////////
+
+static uns32 stackdist_line_id(Stackdist *sd, Addr lineaddr, Flag *is_new)
+{
+  uns64 mask = sd->hash_size - 1;
+  uns64 pos  = (lineaddr * 0x9E3779B97F4A7C15ULL) >> 20 & mask;
+  uns   level;
+
+  while(sd->hash_id[pos] != SD_NONE){
+    if(sd->hash_key[pos] == lineaddr){
+      *is_new = FALSE;
+      return sd->hash_id[pos];
+    }
+    pos = (pos + 1) & mask;
+  }
+
+  *is_new = TRUE;
+  sd->hash_key[pos] = lineaddr;
+  sd->hash_id[pos]  = sd->num_lines;
+
+  if(sd->num_lines == sd->lines_cap){
+    sd->lines_cap = sd->lines_cap ? 2*sd->lines_cap : SD_HASH_INIT;
+    for(level=0; level<SD_NUM_LEVELS; level++){
+      sd->last[level] = (uns32 *) realloc (sd->last[level], sd->lines_cap * sizeof(uns32));
+      if(sd->last[level] == NULL){
+	printf("Unable to track %llu lines in the stack distance profiler\n", sd->lines_cap);
+	exit(-1);
+      }
+    }
+  }
+
+  if(2*(sd->num_lines+1) > sd->hash_size){
+    Addr  *old_key  = sd->hash_key;
+    uns32 *old_id   = sd->hash_id;
+    uns64  old_size = sd->hash_size;
+    uns64  ii;
+
+    sd->hash_size *= 2;
+    sd->hash_key = (Addr *)  calloc (sd->hash_size, sizeof(Addr));
+    sd->hash_id  = (uns32 *) malloc (sd->hash_size * sizeof(uns32));
+    memset(sd->hash_id, 0xFF, sd->hash_size * sizeof(uns32));
+    mask = sd->hash_size - 1;
+
+    for(ii=0; ii<old_size; ii++){
+      if(old_id[ii] != SD_NONE){
+	pos = (old_key[ii] * 0x9E3779B97F4A7C15ULL) >> 20 & mask;
+	while(sd->hash_id[pos] != SD_NONE){
+	  pos = (pos + 1) & mask;
+	}
+	sd->hash_key[pos] = old_key[ii];
+	sd->hash_id[pos]  = old_id[ii];
+      }
+    }
+    free(old_key);
+    free(old_id);
+  }
+
+  return sd->num_lines++;
+}
+
+////////////////////////////////////////////////////////////////////
+// The set ran out of times: keep only the live ones (one per line,
+// in access order) and give the set room for as many new accesses.
+////////////////////////////////////////////////////////////////////
+
+static void stackdist_compact(Stackdist *sd, Stackdist_Set *set, uns level)
+{
+  uns32 live = 0;
+  uns32 time, ii;
+
+  for(time=0; time<set->now; time++){
+    if(set->owner[time] != SD_NONE){
+      set->owner[live] = set->owner[time];
+      sd->last[level][set->owner[live]] = live;
+      live++;
+    }
+  }
+
+  set->cap = 2*live > SD_MIN_CAP ? 2*live : SD_MIN_CAP;
+  set->now = live;
+  set->owner = (uns32 *) realloc (set->owner, set->cap * sizeof(uns32));
+  free(set->tree);
+  set->tree  = (uns32 *) calloc (set->cap + 1, sizeof(uns32));
+  if(set->owner == NULL || set->tree == NULL){
+    printf("Unable to grow a stack distance set to %u entries\n", set->cap);
+    exit(-1);
+  }
+
+  // linear-time build with every live time marked
+  for(ii=1; ii<=set->cap; ii++){
+    uns32 parent = ii + (ii & -ii);
+    set->tree[ii] += (ii <= live);
+    if(parent <= set->cap){
+      set->tree[parent] += set->tree[ii];
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// Number of marked times in [0, time)
+////////////////////////////////////////////////////////////////////
+
+static uns32 stackdist_prefix(Stackdist_Set *set, uns32 time)
+{
+  uns32 sum = 0;
+  for(; time > 0; time -= time & -time){
+    sum += set->tree[time];
+  }
+  return sum;
+}
+
+static void stackdist_mark(Stackdist_Set *set, uns32 time, int delta)
+{
+  for(time++; time <= set->cap; time += time & -time){
+    set->tree[time] += delta;
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef STACKDIST_H
+#define STACKDIST_H
+
+#include <stdio.h>
+
+#include "types.h"
+
+#define SD_MAX_SET_BITS   16  // profile 1 .. 64K sets
+#define SD_MAX_ASSOC      32  // and 1 .. 32 ways per set
+#define SD_NUM_LEVELS     (SD_MAX_SET_BITS+1)
+
+typedef struct Stackdist     Stackdist;
+typedef struct Stackdist_Set Stackdist_Set;
+
+//////////////////////////////////////////////////////////////////
+// LRU stack of one set, kept as a Fenwick tree over the set's own
+// access times. A time stays marked while it is the latest access of
+// some line, so the marks after a line's previous access count the
+// distinct lines touched since: its stack distance.
+//////////////////////////////////////////////////////////////////
+
+struct Stackdist_Set {
+  uns32  now;    // next access time in this set
+  uns32  cap;    // times available before the set is compacted
+  uns32 *tree;   // Fenwick tree of marks, 1-based
+  uns32 *owner;  // line id of the access at each time, SD_NONE once superseded
+};
+
+
+struct Stackdist {
+  // line address -> dense line id
+  Addr  *hash_key;
+  uns32 *hash_id;
+  uns64  hash_size;
+  uns64  num_lines;
+  uns64  lines_cap;
+
+  // level k models 2^k sets
+  uns32         *last[SD_NUM_LEVELS]; // per line id, time of its last access
+  Stackdist_Set *sets[SD_NUM_LEVELS];
+
+  // stack distance histogram per level, the last bucket holds
+  // distances >= SD_MAX_ASSOC and first-time (cold) accesses
+  uns64 hist[SD_NUM_LEVELS][SD_MAX_ASSOC+1];
+  uns64 stat_access;
+};
+
+//////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+Stackdist *stackdist_new(void);
+void       stackdist_free(Stackdist *sd);
+void       stackdist_access(Stackdist *sd, Addr lineaddr);
+void       stackdist_reset_stats(Stackdist *sd);
+void       stackdist_print_csv(Stackdist *sd, FILE *fp, uns core_id, uns64 linesize);
+
+//////////////////////////////////////////////////////////////////
+
+#endif // STACKDIST_H
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "sweep.h"
+#include "memsim.h"
+
+#define MAX_SWEEP_ARGS   (MAX_CORES+64)
+#define MAX_SWEEP_TRACES 64
+#define SWEEP_LINE_SIZE  8192
+
+typedef struct Sweep_Config Sweep_Config;
+
+struct Sweep_Config {
+  SimContext  cfg;
+  Trace      *trace[MAX_CORES];      // shared, owned by the trace table
+  char        line[SWEEP_LINE_SIZE]; // the line as given, for the header
+  char        out_fname[1024];       // -out: stats go to this file
+  char       *result;                // stats block, when buffered
+  size_t      result_len;
+  Flag        done;
+};
+
+typedef struct Sweep Sweep;
+
+struct Sweep {
+  Sweep_Config *config;
+  uns           num_configs;
+
+  char   trace_fname[MAX_SWEEP_TRACES][1024];
+  Trace *trace[MAX_SWEEP_TRACES];
+  uns    num_traces;
+
+  uns             next;         // next configuration to hand out
+  Flag            buffered;     // stats go to memory, printed in order
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;         // a configuration finished
+};
+
+static void   sweep_parse(Sweep *sw, char *sweep_fname, SimContext *base, char **trace_fname);
+static Trace *sweep_trace(Sweep *sw, char *fname);
+static void   sweep_run_config(Sweep *sw, Sweep_Config *sc);
+static void  *sweep_worker(void *arg);
+
+
+////////////////////////////////////////////////////////////////////
+// With one job the configurations run back to back on this thread and
+// print as they go. Otherwise each one prints into its own buffer and
+// this thread emits the buffers in sweep file order while the workers
+// take the next unclaimed configuration.
+////////////////////////////////////////////////////////////////////
+
+void sweep_run(char *sweep_fname, SimContext *base, char **trace_fname, uns jobs)
+{
+  Sweep      sw;
+  pthread_t *thread;
+  uns        ii;
+
+  memset(&sw, 0, sizeof(Sweep));
+  sweep_parse(&sw, sweep_fname, base, trace_fname);
+
+  if(jobs > sw.num_configs){
+    jobs = sw.num_configs;
+  }
+
+  if(jobs <= 1){
+    for(ii=0; ii<sw.num_configs; ii++){
+      printf("\n\nSWEEP_CONFIG_%u\t\t\t :%s", ii, sw.config[ii].line);
+      fflush(stdout);
+      sweep_run_config(&sw, &sw.config[ii]);
+    }
+  }
+  else{
+    sw.buffered = TRUE;
+    pthread_mutex_init(&sw.lock, NULL);
+    pthread_cond_init(&sw.cond, NULL);
+
+    thread = (pthread_t *) calloc (jobs, sizeof(pthread_t));
+    for(ii=0; ii<jobs; ii++){
+      if(pthread_create(&thread[ii], NULL, sweep_worker, &sw)){
+	die_message("Unable to start a sweep worker thread");
+      }
+    }
+
+    for(ii=0; ii<sw.num_configs; ii++){
+      Sweep_Config *sc = &sw.config[ii];
+
+      pthread_mutex_lock(&sw.lock);
+      while(!sc->done){
+	pthread_cond_wait(&sw.cond, &sw.lock);
+      }
+      pthread_mutex_unlock(&sw.lock);
+
+      printf("\n\nSWEEP_CONFIG_%u\t\t\t :%s", ii, sc->line);
+      if(sc->result){
+	fwrite(sc->result, 1, sc->result_len, stdout);
+	free(sc->result);
+      }
+      fflush(stdout);
+    }
+
+    for(ii=0; ii<jobs; ii++){
+      pthread_join(thread[ii], NULL);
+    }
+    free(thread);
+    pthread_cond_destroy(&sw.cond);
+    pthread_mutex_destroy(&sw.lock);
+  }
+
+  for(ii=0; ii<sw.num_traces; ii++){
+    trace_close(sw.trace[ii]);
+  }
+  free(sw.config);
+}
+
+////////////////////////////////////////////////////////////////////
+// Read every line up front, so the traces are all decoded before the
+// first configuration starts
+////////////////////////////////////////////////////////////////////
+
+static void sweep_parse(Sweep *sw, char *sweep_fname, SimContext *base, char **trace_fname)
+{
+  char   line[SWEEP_LINE_SIZE];
+  char  *args[MAX_SWEEP_ARGS];
+  uns    num_args, max_configs=0, ii;
+  int    jj;
+  FILE  *fp;
+
+  if ((fp = fopen(sweep_fname, "r")) == NULL){
+    die_message("Unable to open the sweep file");
+  }
+
+  while(fgets(line, sizeof(line), fp)){
+    Sweep_Config *sc;
+    uns num_traces = 0;
+
+    line[strcspn(line, "#\n")] = 0;
+
+    num_args = 0;
+    for(char *tok = strtok(line, " \t\r"); tok; tok = strtok(NULL, " \t\r")){
+      if(num_args == MAX_SWEEP_ARGS){
+	die_message("Too many options on one sweep line");
+      }
+      args[num_args++] = tok;
+    }
+    if(num_args == 0){
+      continue;
+    }
+
+    if(sw->num_configs == max_configs){
+      max_configs = max_configs ? 2*max_configs : 64;
+      sw->config = (Sweep_Config *) realloc (sw->config, max_configs * sizeof(Sweep_Config));
+    }
+    sc = &sw->config[sw->num_configs++];
+    memset(sc, 0, sizeof(Sweep_Config));
+    sc->cfg = *base;
+
+    for(jj=0; jj<(int)num_args; jj++){
+      size_t len = strlen(sc->line);
+      snprintf(sc->line + len, sizeof(sc->line) - len, " %s", args[jj]);
+    }
+
+    for(jj=0; jj<(int)num_args; jj++){
+      if(args[jj][0] != '-'){
+	if(num_traces == MAX_CORES){
+	  die_message("Too many traces on one sweep line");
+	}
+	sc->trace[num_traces++] = sweep_trace(sw, args[jj]);
+      }
+      else if(!strcmp(args[jj], "-out") && jj < (int)num_args - 1){
+	strncpy(sc->out_fname, args[jj+1], sizeof(sc->out_fname)-1);
+	jj += 1;
+      }
+      else{
+	int last = simctx_option(&sc->cfg, num_args, args, jj);
+	if(last < 0){
+	  char msg[256];
+	  sprintf(msg, "Sweep lines take simulator options, -out and traces only, got %s", args[jj]);
+	  die_message(msg);
+	}
+	jj = last;
+      }
+    }
+
+    if(num_traces){
+      sc->cfg.num_cores = num_traces;
+    }
+    else{
+      for(ii=0; ii<base->num_cores && trace_fname[ii][0]; ii++){
+	sc->trace[ii] = sweep_trace(sw, trace_fname[ii]);
+      }
+      if(ii == 0){
+	die_message("Sweep line names no trace and none was given on the command line");
+      }
+    }
+  }
+
+  fclose(fp);
+}
+
+////////////////////////////////////////////////////////////////////
+// Decode a trace the first time a line names it
+////////////////////////////////////////////////////////////////////
+
+static Trace *sweep_trace(Sweep *sw, char *fname)
+{
+  uns ii;
+
+  for(ii=0; ii<sw->num_traces; ii++){
+    if(!strcmp(sw->trace_fname[ii], fname)){
+      return sw->trace[ii];
+    }
+  }
+
+  if(sw->num_traces == MAX_SWEEP_TRACES){
+    die_message("Too many distinct traces in the sweep file");
+  }
+  strncpy(sw->trace_fname[sw->num_traces], fname, sizeof(sw->trace_fname[0])-1);
+  sw->trace[sw->num_traces] = trace_load(fname);
+  return sw->trace[sw->num_traces++];
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+static void sweep_run_config(Sweep *sw, Sweep_Config *sc)
+{
+  FILE *out = stdout;
+  Sim  *sim;
+
+  if(sc->out_fname[0]){
+    if((out = fopen(sc->out_fname, "w")) == NULL){
+      die_message("Unable to open a sweep output file");
+    }
+  }
+  else if(sw->buffered){
+    if((out = open_memstream(&sc->result, &sc->result_len)) == NULL){
+      die_message("Unable to buffer the sweep output");
+    }
+  }
+  sc->cfg.out = out;
+
+  sim = sim_new_from_traces(&sc->cfg, sc->trace);
+  sim_run(sim);
+  sim_print_stats(sim);
+  sim_free(sim);
+
+  if(out != stdout){
+    fclose(out);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// Configurations are claimed one at a time, so a worker that draws a
+// short one simply takes the next instead of idling behind a long one
+////////////////////////////////////////////////////////////////////
+
+static void *sweep_worker(void *arg)
+{
+  Sweep *sw = (Sweep *) arg;
+  uns    ii;
+
+  while((ii = __atomic_fetch_add(&sw->next, 1, __ATOMIC_RELAXED)) < sw->num_configs){
+    sweep_run_config(sw, &sw->config[ii]);
+
+    pthread_mutex_lock(&sw->lock);
+    sw->config[ii].done = TRUE;
+    pthread_cond_broadcast(&sw->cond);
+    pthread_mutex_unlock(&sw->lock);
+  }
+
+  return NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "types.h"
+#include "simctx.h"
+
+//////////////////////////////////////////////////////////////////
+// Parameter sweep: every non-empty line of the sweep file holds
+// simulator options applied on top of a base context, optionally
+// followed by the traces to run (the base traces otherwise) and
+// "-out <file>" to send that configuration's stats to a file.
+// Each distinct trace is decoded once and shared read-only by all
+// configurations, which run on a pool of worker threads. Stats
+// blocks are printed in the order of the sweep file.
+//////////////////////////////////////////////////////////////////
+
+void sweep_run(char *sweep_fname, SimContext *base, char **trace_fname, uns jobs);
+
+//////////////////////////////////////////////////////////////////
+
+#endif // SWEEP_H
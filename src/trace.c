@@ -0,0 +1,480 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sched.h>
+
+#include "trace.h"
+
+#define TRACE_GZ_BUFFER   (256*1024) // zlib input buffer size
+
+extern void die_message(const char * msg);
+
+////////////////////////////////////////////////////////////////////
+// Single-producer/single-consumer ring filled by the prefetch thread.
+// head and tail sit on their own host cache lines, and each side only
+// re-reads the other's index when its cached copy runs out.
+////////////////////////////////////////////////////////////////////
+
+struct Trace_Ring {
+  Trace_Rec recs[TRACE_RING_SIZE];
+
+  uns64 head __attribute__((aligned(64))); // next slot to fill (producer)
+  uns64 tail_cache;                        // producer's view of tail
+  uns64 done;                              // producer reached end of trace
+
+  uns64 tail __attribute__((aligned(64))); // next slot to read (consumer)
+  uns64 head_cache;                        // consumer's view of head
+  uns64 stop;                              // consumer asks producer to quit
+};
+
+static Flag  trace_open_flat(Trace *t, char *fname);
+static void  trace_open_gz(Trace *t, char *fname);
+static void  trace_refill(Trace *t);
+static Flag  trace_decode(Trace *t, Trace_Rec *rec);
+static Flag  trace_ring_pop(Trace_Ring *r, Trace_Rec *rec);
+static void *trace_prefetch_loop(void *arg);
+static uns64 trace_get_addr(uns8 *p, uns width);
+static void  trace_put_addr(uns8 *p, uns64 val, uns width);
+
+
+////////////////////////////////////////////////////////////////////
+// Opens a trace. Flat traces (see trace_convert) are mapped into
+// memory, anything else is inflated in-process with zlib. A plain
+// uncompressed .mtr file is read transparently as well.
+// With prefetch set, a background thread decodes the trace into a
+// ring so that inflate overlaps with the simulation.
+////////////////////////////////////////////////////////////////////
+
+Trace *trace_open(char *fname, Flag prefetch)
+{
+  Trace *t = (Trace *) calloc (1, sizeof (Trace));
+
+  if(!trace_open_flat(t, fname)){
+    trace_open_gz(t, fname);
+  }
+
+  if(prefetch){
+    if(posix_memalign((void **) &t->ring, 64, sizeof(Trace_Ring))){
+      die_message("Unable to allocate the trace prefetch ring");
+    }
+    memset(t->ring, 0, sizeof(Trace_Ring));
+    if(pthread_create(&t->thread, NULL, trace_prefetch_loop, t)){
+      die_message("Unable to start the trace prefetch thread");
+    }
+  }
+
+  return t;
+}
+
+////////////////////////////////////////////////////////////////////
+// Returns the next record, or FALSE at the end of the trace.
+////////////////////////////////////////////////////////////////////
+
+Flag trace_read(Trace *t, Trace_Rec *rec)
+{
+  Flag ok = t->ring ? trace_ring_pop(t->ring, rec) : trace_decode(t, rec);
+
+  t->num_read += ok;
+  return ok;
+}
+
+////////////////////////////////////////////////////////////////////
+// Drop the next num_recs records, returns how many were dropped.
+// Mapped traces just move the cursor, streams decode and discard.
+////////////////////////////////////////////////////////////////////
+
+uns64 trace_skip(Trace *t, uns64 num_recs)
+{
+  Trace_Rec rec;
+  uns64     skipped = 0;
+
+  if(t->map && !t->ring){
+    uns64 left = (t->rec_end - t->rec_ptr) / t->rec_size;
+    skipped = (num_recs < left) ? num_recs : left;
+    t->rec_ptr  += skipped * t->rec_size;
+    t->num_read += skipped;
+    return skipped;
+  }
+
+  while(skipped < num_recs && trace_read(t, &rec)){
+    skipped++;
+  }
+  return skipped;
+}
+
+////////////////////////////////////////////////////////////////////
+// Decode the next record out of the mapped file or inflate buffer.
+////////////////////////////////////////////////////////////////////
+
+static Flag trace_decode(Trace *t, Trace_Rec *rec)
+{
+  uns8 *p;
+
+  if(t->map){
+    if(t->rec_ptr == t->rec_end){
+      return FALSE;
+    }
+    p = t->rec_ptr;
+    t->rec_ptr += t->rec_size;
+  }
+  else{
+    if(t->buf_len - t->buf_pos < t->rec_size){
+      trace_refill(t);
+      if(t->buf_len - t->buf_pos < t->rec_size){
+	return FALSE;
+      }
+    }
+    p = t->buf + t->buf_pos;
+    t->buf_pos += t->rec_size;
+  }
+
+  rec->inst_addr = trace_get_addr(p, t->addr_width);
+  rec->inst_type = p[t->addr_width];
+  rec->ldst_addr = trace_get_addr(p + t->addr_width + 1, t->addr_width);
+
+  return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+void trace_close(Trace *t)
+{
+  if(t->ring){
+    __atomic_store_n(&t->ring->stop, TRUE, __ATOMIC_RELEASE);
+    pthread_join(t->thread, NULL);
+    free(t->ring);
+  }
+
+  if(t->map_kind == TRACE_MAP_FILE){
+    munmap(t->map, t->map_size);
+  }
+  else if(t->map_kind == TRACE_MAP_HEAP){
+    free(t->map);
+  }
+  else if(t->map_kind == TRACE_MAP_NONE){
+    gzclose(t->gz);
+    free(t->buf);
+  }
+  free(t);
+}
+
+////////////////////////////////////////////////////////////////////
+// Flat traces are already in memory once mapped. Anything else is
+// inflated into a heap buffer in the same record layout.
+////////////////////////////////////////////////////////////////////
+
+Trace *trace_load(char *fname)
+{
+  Trace    *t = trace_open(fname, FALSE);
+  Trace_Rec rec;
+  uns64     cap = TRACE_BUF_SIZE;
+  uns64     len = 0;
+  uns8     *buf, *grown;
+
+  if(t->map){
+    return t;
+  }
+
+  if((buf = (uns8 *) malloc (cap)) == NULL){
+    die_message("Unable to hold the decoded trace in memory");
+  }
+  while(trace_read(t, &rec)){
+    if(len + t->rec_size > cap){
+      cap *= 2;
+      if((grown = (uns8 *) realloc (buf, cap)) == NULL){
+	free(buf);
+	die_message("Unable to hold the decoded trace in memory");
+      }
+      buf = grown;
+    }
+    trace_put_addr(buf + len, rec.inst_addr, t->addr_width);
+    buf[len + t->addr_width] = (uns8) rec.inst_type;
+    trace_put_addr(buf + len + t->addr_width + 1, rec.ldst_addr, t->addr_width);
+    len += t->rec_size;
+  }
+
+  gzclose(t->gz);
+  free(t->buf);
+  t->gz  = NULL;
+  t->buf = NULL;
+
+  t->num_read  = 0;
+  t->map_kind  = TRACE_MAP_HEAP;
+  t->map       = buf;
+  t->map_size  = cap;
+  t->rec_begin = buf;
+  t->rec_ptr   = buf;
+  t->rec_end   = buf + len;
+
+  return t;
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+Trace *trace_clone(Trace *t)
+{
+  Trace *clone = (Trace *) calloc (1, sizeof (Trace));
+
+  assert(t->map);
+  clone->addr_width = t->addr_width;
+  clone->rec_size   = t->rec_size;
+  clone->map_kind   = TRACE_MAP_SHARED;
+  clone->map        = t->map;
+  clone->map_size   = t->map_size;
+  clone->rec_begin  = t->rec_begin;
+  clone->rec_ptr    = t->rec_begin;
+  clone->rec_end    = t->rec_end;
+
+  return clone;
+}
+
+////////////////////////////////////////////////////////////////////
+// Convert a trace to the flat format so later runs can mmap it.
+// The record count is patched into the header once it is known.
+////////////////////////////////////////////////////////////////////
+
+uns64 trace_convert(char *fname_in, char *fname_out)
+{
+  Trace    *t = trace_open(fname_in, FALSE);
+  Trace_Rec rec;
+  FILE     *out;
+  uns8      hdr[TRACE_FLAT_HDR_SIZE];
+  uns8      rbuf[2*8+1];
+  uns64     num_recs = 0;
+
+  if ((out = fopen(fname_out, "wb")) == NULL){
+    printf("Output file is %s\n", fname_out);
+    die_message("Unable to create the flat trace file");
+  }
+  setvbuf(out, NULL, _IOFBF, TRACE_BUF_SIZE);
+
+  memset(hdr, 0, sizeof(hdr));
+  if(fwrite(hdr, sizeof(hdr), 1, out) != 1){
+    die_message("Unable to write the flat trace file");
+  }
+
+  while(trace_read(t, &rec)){
+    trace_put_addr(rbuf, rec.inst_addr, t->addr_width);
+    rbuf[t->addr_width] = (uns8) rec.inst_type;
+    trace_put_addr(rbuf + t->addr_width + 1, rec.ldst_addr, t->addr_width);
+    if(fwrite(rbuf, t->rec_size, 1, out) != 1){
+      die_message("Unable to write the flat trace file");
+    }
+    num_recs++;
+  }
+
+  trace_put_addr(hdr,    TRACE_FLAT_MAGIC,   4);
+  trace_put_addr(hdr+4,  TRACE_FLAT_VERSION, 4);
+  trace_put_addr(hdr+8,  num_recs,           8);
+  trace_put_addr(hdr+16, t->addr_width,      4);
+
+  if(fseek(out, 0, SEEK_SET) || fwrite(hdr, sizeof(hdr), 1, out) != 1 || fclose(out)){
+    die_message("Unable to write the flat trace file");
+  }
+
+  trace_close(t);
+  return num_recs;
+}
+
+////////////////////////////////////////////////////////////////////
+// Map the file if it starts with a flat trace header.
+// Returns FALSE (and leaves t untouched) for any other file.
+////////////////////////////////////////////////////////////////////
+
+static Flag trace_open_flat(Trace *t, char *fname)
+{
+  uns8        hdr[TRACE_FLAT_HDR_SIZE];
+  struct stat st;
+  uns64       num_recs;
+  uns         width;
+  int         fd;
+
+  if ((fd = open(fname, O_RDONLY)) < 0){
+    return FALSE;
+  }
+
+  if (read(fd, hdr, sizeof(hdr)) != sizeof(hdr) ||
+      trace_get_addr(hdr, 4) != TRACE_FLAT_MAGIC){
+    close(fd);
+    return FALSE;
+  }
+
+  width    = trace_get_addr(hdr+16, 4);
+  num_recs = trace_get_addr(hdr+8, 8);
+
+  if (trace_get_addr(hdr+4, 4) != TRACE_FLAT_VERSION || (width != 4 && width != 8)){
+    printf("Trace file is %s\n", fname);
+    die_message("Unsupported flat trace version or address width");
+  }
+
+  if (fstat(fd, &st)){
+    printf("Trace file is %s\n", fname);
+    die_message("Unable to read the size of the flat trace file");
+  }
+  if ((uns64) st.st_size != TRACE_FLAT_HDR_SIZE + num_recs*(2*width+1)){
+    printf("Trace file is %s\n", fname);
+    die_message("Flat trace size does not match its header");
+  }
+
+  t->map_size = st.st_size;
+  t->map = (uns8 *) mmap(NULL, t->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (t->map == MAP_FAILED){
+    die_message("Unable to mmap the flat trace file");
+  }
+  madvise(t->map, t->map_size, MADV_SEQUENTIAL);
+
+  t->map_kind   = TRACE_MAP_FILE;
+  t->addr_width = width;
+  t->rec_size   = 2*width+1;
+  t->rec_begin  = t->map + TRACE_FLAT_HDR_SIZE;
+  t->rec_ptr    = t->rec_begin;
+  t->rec_end    = t->map + t->map_size;
+
+  return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////
+
+static void trace_open_gz(Trace *t, char *fname)
+{
+  if ((t->gz = gzopen(fname, "rb")) == NULL){
+    printf("Trace file is %s\n", fname);
+    die_message("Unable to open the trace file");
+  }
+  gzbuffer(t->gz, TRACE_GZ_BUFFER);
+
+  t->addr_width = 4;
+  t->rec_size   = TRACE_REC_SIZE;
+  if((t->buf = (uns8 *) malloc (TRACE_BUF_SIZE)) == NULL){
+    die_message("Unable to allocate the trace decode buffer");
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// Consumer side of the ring. Spins (yielding) while the producer is
+// behind; the end of the trace is only reported once the ring is empty.
+////////////////////////////////////////////////////////////////////
+
+static Flag trace_ring_pop(Trace_Ring *r, Trace_Rec *rec)
+{
+  uns64 tail = r->tail;
+
+  while(tail == r->head_cache){
+    r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if(tail != r->head_cache){
+      break;
+    }
+    if(__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)){
+      r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      if(tail == r->head_cache){
+	return FALSE;
+      }
+      break;
+    }
+    sched_yield();
+  }
+
+  *rec = r->recs[tail & (TRACE_RING_SIZE-1)];
+  __atomic_store_n(&r->tail, tail+1, __ATOMIC_RELEASE);
+
+  return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////
+// Producer side of the ring, runs on the prefetch thread.
+////////////////////////////////////////////////////////////////////
+
+static void *trace_prefetch_loop(void *arg)
+{
+  Trace      *t = (Trace *) arg;
+  Trace_Ring *r = t->ring;
+  uns64       head = 0;
+
+  while(trace_decode(t, &r->recs[head & (TRACE_RING_SIZE-1)])){
+    __atomic_store_n(&r->head, ++head, __ATOMIC_RELEASE);
+
+    while(head - r->tail_cache == TRACE_RING_SIZE){
+      r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+      if(head - r->tail_cache != TRACE_RING_SIZE){
+	break;
+      }
+      if(__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)){
+	return NULL;
+      }
+      sched_yield();
+    }
+  }
+
+  __atomic_store_n(&r->done, TRUE, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+// Move the partial record (if any) to the front of the buffer and
+// inflate as much as fits behind it.
+////////////////////////////////////////////////////////////////////
+
+static void trace_refill(Trace *t)
+{
+  uns64 left = t->buf_len - t->buf_pos;
+  int   got;
+
+  if(t->eof){
+    return;
+  }
+
+  memmove(t->buf, t->buf + t->buf_pos, left);
+  t->buf_pos = 0;
+  t->buf_len = left;
+
+  while(t->buf_len < TRACE_BUF_SIZE){
+    got = gzread(t->gz, t->buf + t->buf_len, TRACE_BUF_SIZE - t->buf_len);
+    if(got < 0){
+      int errnum;
+      printf("zlib error: %s\n", gzerror(t->gz, &errnum));
+      die_message("Unable to decompress the trace file");
+    }
+    if(got == 0){
+      t->eof = TRUE;
+      break;
+    }
+    t->buf_len += got;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+// Traces are stored little-endian
+////////////////////////////////////////////////////////////////////
+
+static uns64 trace_get_addr(uns8 *p, uns width)
+{
+  uns64 val = 0;
+  uns   ii;
+
+  if(width == 4){
+    return (uns64)p[0] | ((uns64)p[1] << 8) | ((uns64)p[2] << 16) | ((uns64)p[3] << 24);
+  }
+
+  for(ii=0; ii<width; ii++){
+    val |= (uns64)p[ii] << (8*ii);
+  }
+  return val;
+}
+
+static void trace_put_addr(uns8 *p, uns64 val, uns width)
+{
+  uns ii;
+
+  for(ii=0; ii<width; ii++){
+    p[ii] = (uns8)(val >> (8*ii));
+  }
+}
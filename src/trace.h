@@ -0,0 +1,83 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+#include <zlib.h>
+
+#include "types.h"
+
+#define TRACE_REC_SIZE    9         // inst_addr(4) + inst_type(1) + ldst_addr(4)
+#define TRACE_BUF_SIZE    (1<<20)   // inflate this much per refill
+#define TRACE_RING_SIZE   (1<<16)   // records buffered by the prefetch thread, power of 2
+
+//---- Flat (uncompressed, mmap-able) trace format ------
+
+#define TRACE_FLAT_MAGIC    0x4652544d  // "MTRF" on disk
+#define TRACE_FLAT_VERSION  1
+#define TRACE_FLAT_HDR_SIZE 24          // magic(4) version(4) num_recs(8) addr_width(4) rsvd(4)
+
+typedef struct Trace     Trace;
+typedef struct Trace_Rec Trace_Rec;
+typedef struct Trace_Ring Trace_Ring;
+
+typedef enum Trace_Map_Enum {
+    TRACE_MAP_NONE=0,   // .mtr.gz stream
+    TRACE_MAP_FILE=1,   // mmap of a flat trace
+    TRACE_MAP_HEAP=2,   // trace decoded into memory by trace_load
+    TRACE_MAP_SHARED=3, // cursor over another trace's records
+} Trace_Map;
+
+//////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+struct Trace_Rec {
+  Addr  inst_addr;
+  uns64 inst_type;
+  Addr  ldst_addr;
+};
+
+
+struct Trace {
+  uns   addr_width; // bytes per address in a record
+  uns   rec_size;   // bytes per record
+  uns64 num_read;   // records handed out by trace_read so far
+
+  // .mtr.gz traces
+  gzFile gz;
+  uns8  *buf;     // inflated bytes, records are decoded in place
+  uns64  buf_pos; // next unread byte in buf
+  uns64  buf_len; // valid bytes in buf
+  Flag   eof;     // gz stream has been drained into buf
+
+  // flat traces and traces held in memory
+  Trace_Map map_kind;
+  uns8  *map;       // whole file or buffer, NULL for .mtr.gz streams
+  uns64  map_size;
+  uns8  *rec_begin; // first record
+  uns8  *rec_ptr;   // next record
+  uns8  *rec_end;   // one past the last record
+
+  // optional prefetch thread that decodes ahead into a ring
+  Trace_Ring *ring;  // NULL when decoding on the caller's thread
+  pthread_t   thread;
+};
+
+//////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+Trace  *trace_open(char *fname, Flag prefetch);
+Flag    trace_read(Trace *t, Trace_Rec *rec);
+uns64   trace_skip(Trace *t, uns64 num_recs);
+void    trace_close(Trace *t);
+
+// Decode a whole trace into memory once, then hand out independent
+// cursors over it. Clones must be closed before the loaded trace.
+Trace  *trace_load(char *fname);
+Trace  *trace_clone(Trace *t);
+
+// Write fname_in (any supported format) as a flat trace to fname_out
+uns64   trace_convert(char *fname_in, char *fname_out);
+
+//////////////////////////////////////////////////////////////////
+
+#endif // TRACE_H
@@ -6,7 +6,7 @@
 #define HIT   1
 #define MISS  0
 
-#define MAX_CORES 2
+#define MAX_CORES 256 // traces on one command line, per-core state is allocated
 
 // Precision for PrintStats
 #define UNS_PREC " %8llu"
@@ -28,23 +28,30 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "gtest/gtest.h"
 #include "../../src/types.h"
 #include "../../src/cache.h"
+#include "../../src/stackdist.h"
 
 Cache* cache;
+Cache_Line evicted;
 
-uns64 cycle = 1;
+SimContext ctx;
 
 Addr mockAddrs[] = {0x6b8b4567, 0x327b23c6, 0x643c9869, 0x66334873,
                     0x74b0dc51, 0x19495cff, 0x2ae8944a, 0x12345678,
                     0x5f00d4ce, 0x1e5c2a58, 0x7aebd230, 0x53cd4764,
                     0x06f21576, 0x7bb31cd7, 0x5b132938};
 
+// Lines that fall in the set of mockAddrs[0] in the 64-set caches below
+#define SAME_SET(i)  (mockAddrs[0] + (Addr)(i) * 64)
+
 // Test initialization of cache
 TEST(CacheInstallTests, InitFunct) {
-    cache = cache_new(32 * 1024, 8, 64, 0);
+    cache = cache_new(&ctx, 32 * 1024, 8, 64, 0);
     EXPECT_FALSE(cache == NULL);
 }
 
@@ -53,68 +60,68 @@ TEST(CacheInstallTests, LineInsert) {
     Addr mockAddr = mockAddrs[0];
     Flag is_write = FALSE;
     uns core_id = 0;
-    cache_install(cache, mockAddr, is_write, core_id);
+    cache_install(cache, mockAddr, is_write, core_id, &evicted);
     int set = mockAddr % cache->num_sets;
     mockAddr /= cache->num_sets;
-    EXPECT_EQ(0, cache->sets[set].line[0].core_id);
-    EXPECT_TRUE(cache->sets[set].line[0].valid);
-    EXPECT_EQ(mockAddr, cache->sets[set].line[0].tag);
+    EXPECT_EQ(0, cache->sets[set].core_id[0]);
+    EXPECT_TRUE(((cache->sets[set].valid >> 0) & 1));
+    EXPECT_EQ(mockAddr, cache->sets[set].tag[0]);
     EXPECT_EQ(0, cache->stat_dirty_evicts);
 }
 
 // Test filling cache to num_sets
 TEST(CacheInstallTests, CacheFill) {
-    Cache_Line* line;
+    Cache_Set* s;
     for(int i = 1; i < cache->num_ways; i++){
-        ++cycle;
-        Addr mockAddr = mockAddrs[i];
+        ++ctx.cycle;
+        Addr mockAddr = SAME_SET(i);
         int set = mockAddr % cache->num_sets;
-        line = &cache->sets[set].line[i];
+        s = &cache->sets[set];
         Flag is_write = FALSE;
         uns core_id = 0;
-        cache_install(cache, mockAddr, is_write, core_id);
+        cache_install(cache, mockAddr, is_write, core_id, &evicted);
         mockAddr /= cache->num_sets;
-        EXPECT_EQ(0, line->core_id);
-        EXPECT_TRUE(line->valid);
-        EXPECT_EQ(mockAddr, line->tag);
+        EXPECT_EQ(0, s->core_id[i]);
+        EXPECT_TRUE((s->valid >> i) & 1);
+        EXPECT_EQ(mockAddr, s->tag[i]);
     }
     EXPECT_EQ(0, cache->stat_dirty_evicts);
 }
 
 // Test adding to full cache with LRU
 TEST(CacheInstallTests, CacheConflict) {
-    ++cycle;
-    Addr mockAddr = mockAddrs[8];
+    ++ctx.cycle;
+    Addr mockAddr = SAME_SET(8);
     Flag is_write = FALSE;
     uns core_id = 0;
-    cache_install(cache, mockAddr, is_write, core_id);
+    cache_install(cache, mockAddr, is_write, core_id, &evicted);
     int set = mockAddr % cache->num_sets;
     mockAddr /= cache->num_sets;
-    Cache_Line* line = &cache->sets[set].line[0];
-    EXPECT_EQ(mockAddrs[0]/cache->num_ways, cache->last_evicted_line.tag);
+    Cache_Set* s = &cache->sets[set];
+    EXPECT_EQ(mockAddrs[0], evicted.tag);  // evicted lines carry the whole line address
     EXPECT_EQ(0, cache->stat_dirty_evicts);
-    EXPECT_EQ(mockAddr, line->tag);
-    EXPECT_TRUE(line->valid);
-    EXPECT_EQ(0, line->core_id);
+    EXPECT_EQ(mockAddr, s->tag[0]);
+    EXPECT_TRUE(s->valid & 1);
+    EXPECT_EQ(0, s->core_id[0]);
 }
 
 // Test initialization of cache
 TEST(CacheAccessTests, InitFunct) {
     delete cache;
-    cache = cache_new(32 * 1024, 8, 64, 0);
-    cycle = 0;
+    cache = cache_new(&ctx, 32 * 1024, 8, 64, 0);
+    ctx.cycle = 0;
     EXPECT_FALSE(cache == NULL);
 }
 
 // Check cache_access when empty
 TEST(CacheAccessTests, CacheAddLineRead) {
-    ++cycle;
-    cache = cache_new(32 * 1024, 8, 64, 0);
+    ++ctx.cycle;
+    cache = cache_new(&ctx, 32 * 1024, 8, 64, 0);
     Addr mockAddr = mockAddrs[0];
     Flag is_write = FALSE;
     uns core_id = 0;
     Flag result = cache_access(cache, mockAddr, is_write, core_id);
-    cache_install(cache, mockAddr, is_write, core_id);
+    cache_install(cache, mockAddr, is_write, core_id, &evicted);
     EXPECT_EQ(MISS, result);
     EXPECT_EQ(1, cache->stat_read_access);
     EXPECT_EQ(1, cache->stat_read_miss);
@@ -122,7 +129,7 @@ TEST(CacheAccessTests, CacheAddLineRead) {
 
 // Test cache_access with one entry
 TEST(CacheAccessTests, LineRetrieve) {
-    ++cycle;
+    ++ctx.cycle;
     Addr mockAddr = mockAddrs[0];
     Flag is_write = FALSE;
     uns core_id = 0;
@@ -134,12 +141,12 @@ TEST(CacheAccessTests, LineRetrieve) {
 
 // Test cache_access with write
 TEST(CacheAccessTests, CacheAddLineWrite) {
-    ++cycle;
-    Addr mockAddr = mockAddrs[1];
+    ++ctx.cycle;
+    Addr mockAddr = SAME_SET(1);
     Flag is_write = TRUE;
     uns core_id = 0;
     Flag result = cache_access(cache, mockAddr, is_write, core_id);
-    cache_install(cache, mockAddr, is_write, core_id);
+    cache_install(cache, mockAddr, is_write, core_id, &evicted);
     EXPECT_EQ(MISS, result);
     EXPECT_EQ(2, cache->stat_read_access);
     EXPECT_EQ(1, cache->stat_read_miss);
@@ -149,33 +156,33 @@ TEST(CacheAccessTests, CacheAddLineWrite) {
 
 // Fill cache
 TEST(CacheAccessTests, CacheFill) {
-    Cache_Line* line;
+    Cache_Set* s;
     for(int i = 2; i < cache->num_ways; i++){
-        ++cycle;
-        Addr mockAddr = mockAddrs[i];
+        ++ctx.cycle;
+        Addr mockAddr = SAME_SET(i);
         Flag is_write = TRUE;
         uns core_id = 0;
         Flag result = cache_access(cache, mockAddr, is_write, core_id);
-        cache_install(cache, mockAddr, is_write, core_id);
+        cache_install(cache, mockAddr, is_write, core_id, &evicted);
         int set = mockAddr % cache->num_sets;
         mockAddr /= cache->num_sets;    
-        line = &cache->sets[set].line[i];
+        s = &cache->sets[set];
         EXPECT_EQ(MISS, result);
-        EXPECT_EQ(0, line->core_id);
-        EXPECT_TRUE(line->valid);
-        EXPECT_EQ(mockAddr, line->tag);
+        EXPECT_EQ(0, s->core_id[i]);
+        EXPECT_TRUE((s->valid >> i) & 1);
+        EXPECT_EQ(mockAddr, s->tag[i]);
     }
     EXPECT_EQ(0, cache->stat_dirty_evicts);
 }
 
 // Test replacement of non-write line
 TEST(CacheAccessTests, CacheReplaceNonWrite) {
-    ++cycle;
-    Addr mockAddr = mockAddrs[9];
+    ++ctx.cycle;
+    Addr mockAddr = SAME_SET(9);
     Flag is_write = TRUE;
     uns core_id = 0;
     Flag result = cache_access(cache, mockAddr, is_write, core_id);
-    cache_install(cache, mockAddr, is_write, core_id);
+    cache_install(cache, mockAddr, is_write, core_id, &evicted);
     EXPECT_EQ(MISS, result);
     EXPECT_EQ(2, cache->stat_read_access);
     EXPECT_EQ(1, cache->stat_read_miss);
@@ -185,12 +192,12 @@ TEST(CacheAccessTests, CacheReplaceNonWrite) {
 
 // Test replacement of write line
 TEST(CacheAccessTests, CacheReplaceWrite) {
-    ++cycle;
-    Addr mockAddr = mockAddrs[10];
+    ++ctx.cycle;
+    Addr mockAddr = SAME_SET(10);
     Flag is_write = TRUE;
     uns core_id = 0;
     Flag result = cache_access(cache, mockAddr, is_write, core_id);
-    cache_install(cache, mockAddr, is_write, core_id);
+    cache_install(cache, mockAddr, is_write, core_id, &evicted);
     EXPECT_EQ(MISS, result);
     EXPECT_EQ(2, cache->stat_read_access);
     EXPECT_EQ(1, cache->stat_read_miss);
@@ -199,8 +206,226 @@ TEST(CacheAccessTests, CacheReplaceWrite) {
     EXPECT_EQ(1, cache->stat_dirty_evicts);
 }
 
+// Fused lookup-or-install hits on a resident line and fills on a miss
+TEST(CacheAccessInstallTests, HitAndMiss) {
+    Cache* c = cache_new(&ctx, 32 * 1024, 8, 64, 0);
+    Addr mockAddr = mockAddrs[2];
+    Flag result = cache_access_install(c, mockAddr, FALSE, 0, &evicted);
+    EXPECT_EQ(MISS, result);
+    EXPECT_FALSE(evicted.valid);
+    result = cache_access_install(c, mockAddr, TRUE, 0, &evicted);
+    EXPECT_EQ(HIT, result);
+    EXPECT_FALSE(evicted.valid);
+    EXPECT_EQ(1, c->stat_read_miss);
+    EXPECT_EQ(0, c->stat_write_miss);
+    // Same line from another core is a different line
+    result = cache_access_install(c, mockAddr, FALSE, 1, &evicted);
+    EXPECT_EQ(MISS, result);
+}
+
+// Resetting the stats after a warmup keeps the lines resident
+TEST(CacheAccessInstallTests, ResetStatsKeepsTags) {
+    Cache* c = cache_new(&ctx, 32 * 1024, 8, 64, 0);
+    cache_access_install(c, mockAddrs[3], TRUE, 0, &evicted);
+    cache_reset_stats(c);
+    EXPECT_EQ(0, c->stat_write_access);
+    EXPECT_EQ(0, c->stat_write_miss);
+    EXPECT_EQ(HIT, cache_access_install(c, mockAddrs[3], FALSE, 0, &evicted));
+    EXPECT_EQ(1, c->stat_read_access);
+    EXPECT_EQ(0, c->stat_read_miss);
+}
+
+// A line in flight merges later misses; with both MSHRs busy the next
+// miss waits for the earliest fill
+TEST(CacheAccessInstallTests, MshrMergeAndFull) {
+    Cache* c = cache_new(&ctx, 32 * 1024, 8, 64, 0);
+    cache_mshr_init(c, 2);
+    EXPECT_EQ(10, cache_mshr_issue(c, 10));
+    cache_mshr_fill(c, mockAddrs[0], 10, 110);
+    cache_mshr_fill(c, mockAddrs[1], 20, 60);
+    EXPECT_EQ(110, cache_mshr_find(c, mockAddrs[0], 30));
+    EXPECT_EQ(0, cache_mshr_find(c, mockAddrs[2], 30));
+    EXPECT_EQ(60, cache_mshr_issue(c, 30));
+    cache_mshr_fill(c, mockAddrs[2], 60, 160);
+    EXPECT_EQ(0, cache_mshr_find(c, mockAddrs[1], 60));
+    EXPECT_EQ(3, c->stat_mshr_alloc);
+    EXPECT_EQ(1, c->stat_mshr_merge);
+    EXPECT_EQ(1, c->stat_mshr_full);
+    EXPECT_EQ(2, c->stat_mshr_occupancy);
+    cache_free(c);
+}
+
+// cache_holds sees the core's own lines only and changes nothing
+TEST(CacheAccessInstallTests, HoldsWithoutSideEffects) {
+    Cache* c = cache_new(&ctx, 8 * 64, 8, 64, REPL_LRU); // one set
+    for(Addr a = 0; a < 8; a++)
+        cache_access_install(c, a, FALSE, 0, &evicted);
+    uns64 reads = c->stat_read_access + c->stat_read_miss;
+    EXPECT_TRUE(cache_holds(c, 0, 0));
+    EXPECT_FALSE(cache_holds(c, 0, 1));
+    EXPECT_FALSE(cache_holds(c, 8, 0));
+    EXPECT_EQ(reads, c->stat_read_access + c->stat_read_miss);
+    cache_access_install(c, 8, FALSE, 0, &evicted); // 0 is still LRU
+    EXPECT_TRUE(evicted.valid);
+    EXPECT_EQ(0, evicted.tag);
+    cache_free(c);
+}
+
+// The functional path leaves the same tags, dirty bits and recency as
+// the timed one, without counting anything
+TEST(CacheAccessInstallTests, FunctionalMatchesTimed) {
+    uns64 policies[] = {REPL_LRU, REPL_TREE_PLRU, REPL_BIT_PLRU};
+    for(int p = 0; p < 3; p++) {
+        Cache* t = cache_new(&ctx, 8 * 64, 8, 64, policies[p]); // one set
+        Cache* f = cache_new(&ctx, 8 * 64, 8, 64, policies[p]);
+        Cache_Line fev;
+        uns32 x = 7;
+        for(int n = 0; n < 2000; n++) {
+            x = x * 1103515245 + 12345;
+            Addr a = (x >> 8) % 12;
+            Flag w = (x >> 4) % 4 == 0;
+            uns core = (x >> 6) % 2;
+            ASSERT_EQ(cache_access_install(t, a, w, core, &evicted),
+                      cache_access_install_functional(f, a, w, core, &fev)) << "access " << n;
+            ASSERT_EQ(evicted.valid, fev.valid) << "access " << n;
+            if(evicted.valid) {
+                ASSERT_EQ(evicted.tag, fev.tag);
+                ASSERT_EQ(evicted.dirty, fev.dirty);
+            }
+        }
+        EXPECT_EQ(t->sets[0].valid, f->sets[0].valid);
+        EXPECT_EQ(t->sets[0].dirty, f->sets[0].dirty);
+        EXPECT_EQ(0, f->stat_read_access + f->stat_write_access);
+        EXPECT_EQ(0, f->stat_read_miss + f->stat_write_miss + f->stat_dirty_evicts);
+        cache_free(t);
+        cache_free(f);
+    }
+}
+
+// LRU follows access order even when every access lands in one cycle
+TEST(ReplPolicyTests, LruSameCycle) {
+    Cache* c = cache_new(&ctx, 8 * 64, 8, 64, REPL_LRU); // one set
+    for(Addr a = 0; a < 8; a++)
+        cache_access_install(c, a, FALSE, 0, &evicted);
+    cache_access_install(c, 0, FALSE, 0, &evicted); // 0 is now MRU
+    cache_access_install(c, 8, FALSE, 0, &evicted);
+    EXPECT_TRUE(evicted.valid);
+    EXPECT_EQ(1, evicted.tag);
+}
+
+// SWP with three cores: a core under quota takes from the one over it
+TEST(ReplPolicyTests, SwpQuotaPerCore) {
+    SimContext swp_ctx = ctx;
+    swp_ctx.num_cores = 3;
+    swp_ctx.swp_num_quota = 3;
+    swp_ctx.swp_quota[0] = 2;
+    swp_ctx.swp_quota[1] = 2;
+    swp_ctx.swp_quota[2] = 4;
+    Cache* c = cache_new(&swp_ctx, 8 * 64, 8, 64, REPL_SWP); // one set
+    for(Addr a = 0; a < 6; a++)
+        cache_access_install(c, a, FALSE, 2, &evicted);      // core 2 over quota
+    cache_access_install(c, 100, FALSE, 0, &evicted);
+    cache_access_install(c, 101, FALSE, 1, &evicted);
+    cache_access_install(c, 102, FALSE, 1, &evicted);       // core 1 under quota
+    EXPECT_TRUE(evicted.valid);
+    EXPECT_EQ(2, evicted.core_id);
+    EXPECT_EQ(0, evicted.tag);
+    cache_access_install(c, 103, FALSE, 1, &evicted);       // core 1 at quota
+    EXPECT_EQ(1, evicted.core_id);
+    EXPECT_EQ(101, evicted.tag);
+}
+
+// The per-way SWP counts kept on each fill match a recount of the set
+TEST(ReplPolicyTests, SwpCountsMatchRecount) {
+    SimContext swp_ctx = ctx;
+    swp_ctx.num_cores = 3;
+    swp_ctx.swp_num_quota = 3;
+    swp_ctx.swp_quota[0] = 3;
+    swp_ctx.swp_quota[1] = 1;
+    swp_ctx.swp_quota[2] = 4;
+    Cache* c = cache_new(&swp_ctx, 8 * 64, 8, 64, REPL_SWP); // one set
+    Cache_Set* s = &c->sets[0];
+    uns32 x = 1;
+    for(int n = 0; n < 2000; n++) {
+        x = x * 1103515245 + 12345;
+        cache_access_install(c, (x >> 8) % 24, FALSE, (x >> 4) % 3, &evicted);
+        for(uns i = 0; i < 8; i++) {
+            if(!((s->valid >> i) & 1))
+                continue;
+            uns8 same = 0;
+            for(uns j = 0; j < 8; j++)
+                same += ((s->valid >> j) & 1) && s->core_id[j] == s->core_id[i];
+            ASSERT_EQ(same, s->owned[i]) << "fill " << n << " way " << i;
+        }
+    }
+    cache_free(c);
+}
+
+// Tree and bit PLRU evict a way that was not touched recently
+TEST(ReplPolicyTests, PseudoLru) {
+    uns64 policies[] = {REPL_TREE_PLRU, REPL_BIT_PLRU};
+    for(int p = 0; p < 2; p++) {
+        Cache* c = cache_new(&ctx, 8 * 64, 8, 64, policies[p]);
+        for(Addr a = 0; a < 8; a++)
+            cache_access_install(c, a, FALSE, 0, &evicted);
+        cache_access_install(c, 0, FALSE, 0, &evicted);
+        cache_access_install(c, 8, FALSE, 0, &evicted);
+        EXPECT_TRUE(evicted.valid);
+        EXPECT_NE(0, evicted.tag);
+        EXPECT_NE(7, evicted.tag);
+    }
+}
+
+// SIMD tag match must agree with the scalar loop for every way count
+TEST(CacheMatchTests, SimdMatchesScalar) {
+    Cache_Set* s;
+    if(posix_memalign((void **) &s, 64, sizeof(Cache_Set)))
+        FAIL();
+    memset(s, 0, sizeof(Cache_Set));
+    for(int i = 0; i < MAX_WAYS; i++)
+        s->tag[i] = mockAddrs[i % 4];
+    s->tag[5] = mockAddrs[0] ^ 0x100000000ULL; // same low half only
+    for(uns ways = 1; ways <= MAX_WAYS; ways++) {
+        for(int a = 0; a < 5; a++) {
+            Addr tag = (a < 4) ? mockAddrs[a] : 0;
+            EXPECT_EQ(cache_match_tags_scalar(s, tag, ways),
+                      cache_match_tags(s, tag, ways));
+        }
+    }
+    free(s);
+}
+
+// Stack distances must predict the misses of an LRU cache of any shape
+TEST(StackdistTests, MatchesLruCache) {
+    uns geo[][2] = {{1, 16}, {64, 4}, {256, 8}, {1024, 2}};
+    uns64 misses[4] = {0};
+    Cache* c[4];
+    Stackdist* sd = stackdist_new();
+    for(int g = 0; g < 4; g++)
+        c[g] = cache_new(&ctx, geo[g][0]*geo[g][1]*64, geo[g][1], 64, REPL_LRU);
+    srand(7);
+    for(int i = 0; i < 200000; i++) {
+        Addr lineaddr = (i % 4) ? rand() % 3000 : rand() % 100000;
+        ctx.cycle++;
+        stackdist_access(sd, lineaddr);
+        for(int g = 0; g < 4; g++)
+            misses[g] += cache_access_install(c[g], lineaddr, FALSE, 0, &evicted) == MISS;
+    }
+    for(int g = 0; g < 4; g++) {
+        uns level = __builtin_ctz(geo[g][0]);
+        uns64 expected = 0;
+        for(uns d = geo[g][1]; d <= SD_MAX_ASSOC; d++)
+            expected += sd->hist[level][d];
+        EXPECT_EQ(expected, misses[g]);
+        cache_free(c[g]);
+    }
+    stackdist_free(sd);
+}
+
 GTEST_API_ int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
+    simctx_init(&ctx);
+    ctx.cycle = 1;
     return RUN_ALL_TESTS();
     delete cache;
 }
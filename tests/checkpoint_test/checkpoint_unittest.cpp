@@ -0,0 +1,117 @@
+// Copyright 2006, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gtest/gtest.h"
+#include "../test_util.h"
+#include "../../src/checkpoint.h"
+
+#define NUM_RECS   200000
+#define CKPT_FILE  "/tmp/checkpoint_unittest.ckpt"
+
+char  trace0[] = "/tmp/checkpoint_unittest0.mtr";
+char  trace1[] = "/tmp/checkpoint_unittest1.mtr";
+char *fnames[] = {trace0, trace1};
+
+// Straight run against a run checkpointed after ckpt_inst and
+// restored into a fresh Sim: every counter must be the same
+void check_round_trip(SimContext *cfg, uns64 ckpt_inst) {
+    Sim_Counters straight, restored;
+    Sim *sim;
+    uns  ii;
+
+    sim = sim_new(cfg, fnames);
+    sim_run(sim);
+    sim_read_counters(sim, &straight);
+    uns64 cycle = sim->ctx.cycle;
+    uns64 done_cycles[2], done_inst[2];
+    for (ii = 0; ii < cfg->num_cores; ii++) {
+        done_cycles[ii] = sim->core[ii]->done_cycle_count;
+        done_inst[ii]   = sim->core[ii]->done_inst_count;
+    }
+    sim_free(sim);
+
+    sim = sim_new(cfg, fnames);
+    while (sim_inst_count(sim) < ckpt_inst && !sim_step(sim)) {
+    }
+    sim_checkpoint(sim, (char *) CKPT_FILE);
+    sim_free(sim);
+
+    sim = sim_new(cfg, fnames);
+    sim_restore(sim, (char *) CKPT_FILE);
+    sim_run(sim);
+    sim_read_counters(sim, &restored);
+
+    EXPECT_EQ(cycle, sim->ctx.cycle);
+    EXPECT_EQ(0, memcmp(&straight, &restored, sizeof(Sim_Counters)));
+    for (ii = 0; ii < cfg->num_cores; ii++) {
+        EXPECT_EQ(done_cycles[ii], sim->core[ii]->done_cycle_count);
+        EXPECT_EQ(done_inst[ii], sim->core[ii]->done_inst_count);
+    }
+    sim_free(sim);
+}
+
+TEST(CheckpointTests, WriteTraces) {
+    test_write_random_trace(trace0, 1, NUM_RECS);
+    test_write_random_trace(trace1, 2, NUM_RECS);
+}
+
+TEST(CheckpointTests, SingleCoreRoundTrip) {
+    SimContext cfg;
+    test_config(&cfg, SIM_MODE_C, 1);
+    check_round_trip(&cfg, NUM_RECS / 2);
+}
+
+TEST(CheckpointTests, MultiCoreDramCtrlRoundTrip) {
+    SimContext cfg;
+    test_config(&cfg, SIM_MODE_D, 2);
+    cfg.dram_ctrl = 1;
+    cfg.l1_mshrs  = 4;
+    cfg.l2_mshrs  = 8;
+    check_round_trip(&cfg, NUM_RECS);
+}
+
+TEST(CheckpointTests, OutOfOrderRoundTrip) {
+    SimContext cfg;
+    test_config(&cfg, SIM_MODE_C, 1);
+    cfg.core_model = 1;
+    cfg.l1_mshrs   = 8;
+    cfg.load_dep   = 2;
+    check_round_trip(&cfg, NUM_RECS / 3);
+}
+
+// Taken once every core is done, the restored Sim must not step again
+TEST(CheckpointTests, RoundTripAtTheEnd) {
+    SimContext cfg;
+    test_config(&cfg, SIM_MODE_D, 2);
+    check_round_trip(&cfg, 2 * NUM_RECS);
+}
@@ -0,0 +1,327 @@
+// Copyright 2006, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gtest/gtest.h"
+#include "../test_util.h"
+
+#define MAX_RECS   100000
+#define MISS_ADDR(i)  (0x10000400 + 1024 * (Addr)(i))  // a new line, next bank each
+
+char  trace0[] = "/tmp/core_unittest0.mtr";
+char *fnames[] = {trace0};
+
+uns8 rec_type[MAX_RECS];
+Addr rec_addr[MAX_RECS];
+
+// Plain .mtr trace of the first num records of rec_type/rec_addr. The
+// code stays in one line, so only the first fetch misses; the tests
+// start with an ALU op so that no load goes out under that miss.
+void write_trace(uns num) {
+    FILE *fp = fopen(trace0, "wb");
+    uns   ii;
+
+    for (ii = 0; ii < num; ii++) {
+        test_put_rec(fp, 0x400000 + 4 * (ii % 16), rec_type[ii], rec_addr[ii]);
+    }
+    fclose(fp);
+}
+
+void set_rec(uns ii, uns8 type, Addr addr) {
+    rec_type[ii] = type;
+    rec_addr[ii] = addr;
+}
+
+// The out-of-order core gets the L1 MSHRs it needs, the in-order
+// core stays blocking
+void config(SimContext *cfg, uns64 core_model) {
+    test_config(cfg, SIM_MODE_C, 1);
+    cfg->core_model = core_model;
+    cfg->l1_mshrs   = core_model ? 16 : 0;
+}
+
+// Runs the trace to the end, returns the core's cycles; the core's
+// stall counts go to stall if given
+uns64 run(SimContext *cfg, uns64 *stall = NULL) {
+    Sim *sim = sim_new(cfg, fnames);
+    sim_run(sim);
+    uns64 cycles = sim->core[0]->done_cycle_count;
+    if (stall) {
+        memcpy(stall, sim->core[0]->stat_stall, sizeof(sim->core[0]->stat_stall));
+    }
+    sim_free(sim);
+    return cycles;
+}
+
+// Finished instructions leave the ROB in order, at most -width a cycle
+TEST(OooCoreTests, RetireCappedAtWidth) {
+    SimContext cfg;
+    uns64 max_retired = 0;
+    uns   ii;
+
+    for (ii = 0; ii < 400; ii++) {
+        set_rec(ii, INST_TYPE_ALU, 0);
+    }
+    write_trace(400);
+    config(&cfg, 1);
+    cfg.core_width       = 3;
+    cfg.skip_idle_cycles = 0;
+
+    Sim *sim = sim_new(&cfg, fnames);
+    while (1) {
+        uns64 before = sim->core[0]->inst_count;
+        if (sim_step(sim)) {
+            break;
+        }
+        uns64 retired = sim->core[0]->inst_count - before;
+        if (retired > max_retired) {
+            max_retired = retired;
+        }
+    }
+    EXPECT_EQ(3, max_retired);
+    EXPECT_EQ(400, sim->core[0]->done_inst_count);
+    EXPECT_GE(sim->core[0]->done_cycle_count, 400 / 3);
+    sim_free(sim);
+}
+
+// A small ROB fills up behind misses; a big one does not
+TEST(OooCoreTests, RobFullStalls) {
+    SimContext cfg;
+    uns64 stall[NUM_CORE_STALLS];
+    uns   ii;
+
+    for (ii = 0; ii < 2000; ii++) {
+        set_rec(ii, (ii % 20 != 10) ? INST_TYPE_ALU : INST_TYPE_LOAD, (ii % 20 != 10) ? 0 : MISS_ADDR(ii));
+    }
+    write_trace(2000);
+    config(&cfg, 1);
+    cfg.rob_size = 8;
+    uns64 small = run(&cfg, stall);
+    EXPECT_GT(stall[CORE_STALL_ROB], small / 2);
+
+    cfg.rob_size = 224;
+    uns64 big = run(&cfg, stall);
+    EXPECT_LT(big, small / 2);
+}
+
+// All loads: the load queue bounds the window
+TEST(OooCoreTests, LqFullStalls) {
+    SimContext cfg;
+    uns64 stall[NUM_CORE_STALLS];
+    uns   ii;
+
+    set_rec(0, INST_TYPE_ALU, 0);
+    for (ii = 1; ii < 500; ii++) {
+        set_rec(ii, INST_TYPE_LOAD, MISS_ADDR(ii));
+    }
+    write_trace(500);
+    config(&cfg, 1);
+    cfg.lq_size = 2;
+    uns64 small = run(&cfg, stall);
+    EXPECT_GT(stall[CORE_STALL_LQ], small / 2);
+    EXPECT_EQ(0, stall[CORE_STALL_ROB]);
+
+    cfg.lq_size = 72;
+    EXPECT_LT(run(&cfg, stall), small / 2);
+}
+
+// Stores wait in the store queue until they retire, which a missing
+// load ahead of them holds up
+TEST(OooCoreTests, SqFullStalls) {
+    SimContext cfg;
+    uns64 stall[NUM_CORE_STALLS];
+    uns   ii;
+
+    for (ii = 0; ii < 2000; ii++) {
+        set_rec(ii, (ii % 20 != 10) ? INST_TYPE_STORE : INST_TYPE_LOAD, (ii % 20 != 10) ? 0x20000000 : MISS_ADDR(ii));
+    }
+    write_trace(2000);
+    config(&cfg, 1);
+    cfg.sq_size = 2;
+    uns64 small = run(&cfg, stall);
+    EXPECT_GT(stall[CORE_STALL_SQ], small / 2);
+
+    cfg.sq_size = 56;
+    EXPECT_LT(run(&cfg, stall), small / 2);
+}
+
+// Misses of independent loads overlap; with -load_dep 1 each load
+// waits for the one before, so they take one latency each
+TEST(OooCoreTests, LoadDepSerialises) {
+    SimContext cfg;
+    uns   ii;
+
+    for (ii = 0; ii < 33; ii++) {
+        set_rec(ii, INST_TYPE_ALU, 0);
+    }
+    write_trace(33);
+    config(&cfg, 1);
+    uns64 base = run(&cfg);
+
+    set_rec(1, INST_TYPE_LOAD, MISS_ADDR(0));
+    write_trace(33);
+    uns64 latency = run(&cfg) - base;
+    EXPECT_GT(latency, 50);
+
+    for (ii = 1; ii < 33; ii++) {
+        set_rec(ii, INST_TYPE_LOAD, MISS_ADDR(ii));
+    }
+    write_trace(33);
+    uns64 independent = run(&cfg) - base;
+    cfg.load_dep = 1;
+    uns64 dependent = run(&cfg) - base;
+
+    EXPECT_LT(independent, 3 * latency);
+    EXPECT_GT(dependent, 24 * latency);
+}
+
+// Two independent misses take less than the sum of their latencies,
+// the blocking core pays both
+TEST(OooCoreTests, IndependentMissesOverlap) {
+    SimContext cfg;
+    uns64 base[2], one[2], two[2];
+    uns   model;
+
+    for (model = 0; model < 2; model++) {
+        config(&cfg, model);
+        set_rec(0, INST_TYPE_ALU, 0);
+        set_rec(1, INST_TYPE_ALU, 0);
+        set_rec(2, INST_TYPE_ALU, 0);
+        set_rec(3, INST_TYPE_ALU, 0);
+        write_trace(4);
+        base[model] = run(&cfg);
+
+        set_rec(1, INST_TYPE_LOAD, MISS_ADDR(0));
+        write_trace(4);
+        one[model] = run(&cfg) - base[model];
+
+        set_rec(2, INST_TYPE_LOAD, MISS_ADDR(1));
+        write_trace(4);
+        two[model] = run(&cfg) - base[model];
+    }
+
+    EXPECT_GT(one[1], 50);
+    EXPECT_LT(two[1], 2 * one[1]);
+    EXPECT_LE(two[1], one[1] + 2);
+    EXPECT_GE(two[0], 2 * one[0]);
+}
+
+// A one entry, one wide window behaves like the blocking core
+TEST(OooCoreTests, Rob1Width1ApproximatesBlocking) {
+    SimContext cfg;
+    test_write_random_trace(trace0, 1, MAX_RECS);
+    config(&cfg, 0);
+    uns64 blocking = run(&cfg);
+
+    config(&cfg, 1);
+    cfg.rob_size   = 1;
+    cfg.core_width = 1;
+    uns64 ooo = run(&cfg);
+
+    EXPECT_NEAR(blocking, ooo, blocking / 20);
+
+    cfg.rob_size   = 224;
+    cfg.core_width = 4;
+    EXPECT_LT(run(&cfg), blocking / 2);
+}
+
+// Without L1 MSHRs a load would hit a line still on its way
+TEST(OooCoreTests, NeedsL1Mshrs) {
+    SimContext cfg;
+    test_write_random_trace(trace0, 1, 100);
+    config(&cfg, 1);
+    cfg.l1_mshrs = 0;
+    EXPECT_EXIT(sim_new(&cfg, fnames), ::testing::ExitedWithCode(1), "");
+}
+
+// A region of n instructions ends after exactly n, whatever the width
+TEST(OooCoreTests, StepInstExact) {
+    SimContext cfg;
+    test_write_random_trace(trace0, 1, MAX_RECS);
+    config(&cfg, 1);
+    cfg.core_width = 4;
+
+    Sim *sim = sim_new(&cfg, fnames);
+    sim_step_inst(sim, 1001);
+    EXPECT_EQ(1001, sim_inst_count(sim));
+    sim_step_inst(sim, 2);
+    EXPECT_EQ(1003, sim_inst_count(sim));
+    EXPECT_EQ(CORE_NEVER, sim->core[0]->retire_limit);
+    sim_free(sim);
+}
+
+// The same with several cores, which share the region between them
+TEST(OooCoreTests, StepInstExactMultiCore) {
+    SimContext cfg;
+    char  trace1[] = "/tmp/core_unittest1.mtr";
+    char *two[]    = {trace0, trace1};
+    test_write_random_trace(trace0, 1, MAX_RECS);
+    test_write_random_trace(trace1, 2, MAX_RECS);
+    test_config(&cfg, SIM_MODE_D, 2);
+    cfg.core_model = 1;
+    cfg.core_width = 4;
+    cfg.l1_mshrs   = 16;
+
+    Sim  *sim = sim_new(&cfg, two);
+    uns64 ii;
+    for (ii = 1; ii <= 500; ii++) {
+        sim_step_inst(sim, 7);
+        ASSERT_EQ(7 * ii, sim_inst_count(sim));
+    }
+    EXPECT_GT(sim->core[0]->inst_count, 1000);
+    EXPECT_GT(sim->core[1]->inst_count, 1000);
+    sim_free(sim);
+    remove(trace1);
+}
+
+// A fast-forward first retires what is in the window, counting it
+TEST(OooCoreTests, FfwdRetiresWindowFirst) {
+    SimContext cfg;
+    test_write_random_trace(trace0, 1, MAX_RECS);
+    config(&cfg, 1);
+
+    Sim  *sim = sim_new(&cfg, fnames);
+    Core *c   = sim->core[0];
+    sim_step_inst(sim, 5000);
+    ASSERT_GT(c->rob_count, 10);
+    uns64 window = c->rob_count;
+    uns64 read   = c->trace->num_read;
+
+    sim_ffwd(sim, window + 10);
+    EXPECT_EQ(0, c->rob_count);
+    EXPECT_EQ(0, c->lq_count);
+    EXPECT_EQ(0, c->sq_count);
+    EXPECT_EQ(0, c->pending_loads);
+    EXPECT_EQ(5000 + window + 10, c->inst_count);
+    EXPECT_EQ(read + 10, c->trace->num_read);
+    sim_free(sim);
+}
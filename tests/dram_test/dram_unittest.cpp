@@ -28,6 +28,7 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
+#include <string.h>
 
 #include "gtest/gtest.h"
 #include "../../src/types.h"
@@ -41,25 +42,7 @@
 
 Memsys* sys;
 
-uns64 cycle = 1;
-
-MODE        SIM_MODE        = SIM_MODE_B;
-uns64       CACHE_LINESIZE  = 64;
-uns64       REPL_POLICY     = 0; // 0:LRU 1:RAND
-
-uns64       DCACHE_SIZE     = 32*1024; 
-uns64       DCACHE_ASSOC    = 8; 
-
-uns64       ICACHE_SIZE     = 32*1024; 
-uns64       ICACHE_ASSOC    = 8; 
-
-uns64       L2CACHE_SIZE    = 1024*1024; 
-uns64       L2CACHE_ASSOC   = 16;
-uns64       L2CACHE_REPL    = 0;
-
-uns64       SWP_CORE0_WAYS  = 0;
-
-uns64       NUM_CORES       = 1;
+SimContext ctx;
 
 Addr mockAddrs[] = {0x6b8b4567, 0x327b23c6, 0x643c9869, 0x66334873,
                     0x74b0dc51, 0x19495cff, 0x2ae8944a, 0x12345678,
@@ -68,7 +51,7 @@ Addr mockAddrs[] = {0x6b8b4567, 0x327b23c6, 0x643c9869, 0x66334873,
 
 // Test initialization of cache
 TEST(MemsysTests, InitFunct) {
-    sys = memsys_new();
+    sys = memsys_new(&ctx);
     EXPECT_FALSE(sys == NULL);
 }
 
@@ -79,26 +62,31 @@ TEST(MemsysTests, InstructionCacheEmpty) {
     uns core_id = 0;
     Cache* cache = sys->icache;
     uns64 delay = memsys_access_modeBC(sys, mockAddr, type, core_id);
-    EXPECT_EQ(0, cache->sets[0].line[0].core_id);
-    EXPECT_TRUE(cache->sets[0].line[0].valid);
-    EXPECT_EQ(mockAddr, cache->sets[0].line[0].tag);
+    Cache_Set* s = &cache->sets[mockAddr % cache->num_sets];
+    mockAddr /= cache->num_sets;
+    EXPECT_EQ(0, s->core_id[0]);
+    EXPECT_TRUE(((s->valid >> 0) & 1));
+    EXPECT_EQ(mockAddr, s->tag[0]);
     EXPECT_EQ(0, cache->stat_dirty_evicts);
     EXPECT_EQ(ICACHE_HIT_LATENCY + L2CACHE_HIT_LATENCY + DRAM_LATENCY_FIXED, delay);
 }
 
-// Test access of empty data cache with no write
+// Test access of empty data cache with no write, the instruction
+// fetch above already brought the line into the L2
 TEST(MemsysTests, DataCacheEmptyNoWrite) {
     Addr mockAddr = mockAddrs[0];
     Access_Type type = ACCESS_TYPE_LOAD;
     uns core_id = 0;
     Cache* cache = sys->dcache;
     uns64 delay = memsys_access_modeBC(sys, mockAddr, type, core_id);
-    EXPECT_EQ(0, cache->sets[0].line[0].core_id);
-    EXPECT_TRUE(cache->sets[0].line[0].valid);
-    EXPECT_EQ(mockAddr, cache->sets[0].line[0].tag);
-    EXPECT_FALSE(cache->sets[0].line[0].dirty);
+    Cache_Set* s = &cache->sets[mockAddr % cache->num_sets];
+    mockAddr /= cache->num_sets;
+    EXPECT_EQ(0, s->core_id[0]);
+    EXPECT_TRUE(((s->valid >> 0) & 1));
+    EXPECT_EQ(mockAddr, s->tag[0]);
+    EXPECT_FALSE(((s->dirty >> 0) & 1));
     EXPECT_EQ(0, cache->stat_dirty_evicts);
-    EXPECT_EQ(DCACHE_HIT_LATENCY + L2CACHE_HIT_LATENCY + DRAM_LATENCY_FIXED, delay);
+    EXPECT_EQ(DCACHE_HIT_LATENCY + L2CACHE_HIT_LATENCY, delay);
 }
 
 // Test access of single line data cache with hit and write
@@ -108,16 +96,132 @@ TEST(MemsysTests, DataCacheHitWrite) {
     uns core_id = 0;
     Cache* cache = sys->dcache;
     uns64 delay = memsys_access_modeBC(sys, mockAddr, type, core_id);
-    EXPECT_EQ(0, cache->sets[0].line[0].core_id);
-    EXPECT_TRUE(cache->sets[0].line[0].valid);
-    EXPECT_EQ(mockAddr, cache->sets[0].line[0].tag);
-    EXPECT_TRUE(cache->sets[0].line[0].dirty);
+    Cache_Set* s = &cache->sets[mockAddr % cache->num_sets];
+    mockAddr /= cache->num_sets;
+    EXPECT_EQ(0, s->core_id[0]);
+    EXPECT_TRUE(((s->valid >> 0) & 1));
+    EXPECT_EQ(mockAddr, s->tag[0]);
+    EXPECT_TRUE(((s->dirty >> 0) & 1));
     EXPECT_EQ(0, cache->stat_dirty_evicts);
     EXPECT_EQ(DCACHE_HIT_LATENCY, delay);
 }
 
+// With the memory controller, reads at the same cycle wait for their
+// bank (row hit after an empty-bank access) and for the data bus
+TEST(MemsysTests, ControllerBankAndBusQueues) {
+    SimContext ctrl_ctx = ctx;
+    ctrl_ctx.sim_mode = SIM_MODE_C;
+    ctrl_ctx.dram_ctrl = 1;
+    DRAM* dram = dram_new(&ctrl_ctx);
+    EXPECT_EQ(100, dram_access_at(dram, 0, FALSE, 0));   // ACT+CAS+BUS
+    EXPECT_EQ(145, dram_access_at(dram, 1, FALSE, 0));   // bank ready at 90, CAS+BUS
+    EXPECT_EQ(110, dram_access_at(dram, 16, FALSE, 0));  // other bank, bus free from 100 to 135
+    EXPECT_EQ(0, dram_access_at(dram, 32, TRUE, 0));     // writebacks are posted
+    EXPECT_EQ(1, dram->ctrl.wq_total);
+    dram_free(dram);
+}
+
+// A read handed over after one that arrives later still finds the
+// bank idle at its own arrival, and precharges in time for the later
+// read to find the bank empty as it was timed
+TEST(MemsysTests, ControllerOutOfOrderArrival) {
+    SimContext ctrl_ctx = ctx;
+    ctrl_ctx.sim_mode = SIM_MODE_C;
+    ctrl_ctx.dram_ctrl = 1;
+    DRAM* dram = dram_new(&ctrl_ctx);
+    EXPECT_EQ(100, dram_access_at(dram, 0, FALSE, 1000));  // ACT+CAS+BUS
+    EXPECT_EQ(100, dram_access_at(dram, 256, FALSE, 0));   // same bank, other row, first
+    EXPECT_EQ(2, dram->stat_row_state[0][DRAM_ROW_EMPTY]);
+    EXPECT_EQ(145, dram_access_at(dram, 1, FALSE, 1000));  // row of the first read open
+    dram_free(dram);
+}
+
+// FR-FCFS: a read to the open row goes ahead of an older read that
+// waits for tRAS to close that row
+TEST(MemsysTests, ControllerRowHitFirst) {
+    SimContext ctrl_ctx = ctx;
+    FILE *fp = fopen("tras.dram", "w");
+    fprintf(fp, "tRAS 100\n");
+    fclose(fp);
+    ctrl_ctx.sim_mode = SIM_MODE_C;
+    ctrl_ctx.dram_ctrl = 1;
+    strcpy(ctrl_ctx.dram_timing, "tras.dram");
+    DRAM* dram = dram_new(&ctrl_ctx);
+    remove("tras.dram");
+    EXPECT_EQ(100, dram_access_at(dram, 0, FALSE, 0));     // ACT+CAS+BUS
+    EXPECT_EQ(455, dram_access_at(dram, 256, FALSE, 10));  // PRE at 320 for tRAS, then tRP+ACT+CAS+BUS
+    EXPECT_EQ(125, dram_access_at(dram, 1, FALSE, 20));    // CAS at 90, burst after the first
+    EXPECT_EQ(1, dram->stat_row_state[0][DRAM_ROW_HIT]);
+    EXPECT_EQ(1, dram->stat_row_state[0][DRAM_ROW_CONFLICT]);
+    dram_free(dram);
+}
+
+// Rows 16 banks apart all land in bank 0, unless the bank index is
+// XORed with the row
+TEST(MemsysTests, XorBankHashSpreadsPowerOfTwoStride) {
+    SimContext map_ctx = ctx;
+    map_ctx.sim_mode = SIM_MODE_C;
+    for (uns xor_hash = 0; xor_hash < 2; xor_hash++) {
+        map_ctx.dram_xor = xor_hash;
+        DRAM* dram = dram_new(&map_ctx);
+        for (Addr line = 0; line < 16*256; line += 256) {
+            dram_access(dram, line, FALSE);
+        }
+        for (uns bank = 0; bank < 16; bank++) {
+            EXPECT_EQ(xor_hash ? 1 : (bank == 0 ? 16 : 0), dram->ctrl.bank[bank].stat_access);
+        }
+        dram_free(dram);
+    }
+}
+
+// Reads and writes alike: an empty bank costs ACT+CAS+BUS, the open
+// row CAS+BUS and another row PRE+ACT+CAS+BUS. The closed page policy
+// finds every bank empty.
+TEST(MemsysTests, RowHitEmptyConflictForReadsAndWrites) {
+    SimContext page_ctx = ctx;
+    page_ctx.sim_mode = SIM_MODE_C;
+    DRAM* dram = dram_new(&page_ctx);
+    EXPECT_EQ(100, dram_access(dram, 0, FALSE));
+    EXPECT_EQ(55, dram_access(dram, 1, TRUE));
+    EXPECT_EQ(145, dram_access(dram, 256, TRUE));
+    EXPECT_EQ(1, dram->stat_row_state[0][DRAM_ROW_EMPTY]);
+    EXPECT_EQ(1, dram->stat_row_state[1][DRAM_ROW_HIT]);
+    EXPECT_EQ(1, dram->stat_row_state[1][DRAM_ROW_CONFLICT]);
+    dram_free(dram);
+
+    page_ctx.dram_page_policy = DRAM_PAGE_CLOSED;
+    dram = dram_new(&page_ctx);
+    EXPECT_EQ(100, dram_access(dram, 0, FALSE));
+    EXPECT_EQ(100, dram_access(dram, 1, TRUE));
+    dram_free(dram);
+}
+
+// DDR4-3200 at 2 GHz: 13.75 ns tCL/tRCD is 28 cycles, a 2.5 ns burst
+// 5. The refresh at tREFI closes the open row and holds the rank for
+// tRFC, the next access waits it out and activates again.
+TEST(MemsysTests, PresetTimingAndRefreshBlackout) {
+    SimContext ddr_ctx = ctx;
+    ddr_ctx.sim_mode = SIM_MODE_C;
+    ddr_ctx.dram_ctrl = 1;
+    strcpy(ddr_ctx.dram_timing, "DDR4-3200");
+    ddr_ctx.core_ghz = 2.0;
+    DRAM* dram = dram_new(&ddr_ctx);
+    EXPECT_EQ(28, dram->timing.t_cl);
+    EXPECT_EQ(28, dram->timing.t_rcd);
+    EXPECT_EQ(5, dram->timing.t_burst);
+    EXPECT_EQ(15600, dram->timing.t_refi);
+    EXPECT_EQ(700, dram->timing.t_rfc);
+    EXPECT_EQ(61, dram_access_at(dram, 0, FALSE, 0));          // ACT+CAS+BURST
+    EXPECT_EQ(751, dram_access_at(dram, 1, FALSE, 15610));     // until 16300, then ACT again
+    EXPECT_EQ(2, dram->stat_row_state[0][DRAM_ROW_EMPTY]);
+    EXPECT_EQ(690, dram->ctrl.stat_refresh_stall);
+    dram_free(dram);
+}
+
 GTEST_API_ int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
+    simctx_init(&ctx);
+    ctx.sim_mode = SIM_MODE_B;
     return RUN_ALL_TESTS();
     delete sys;
 }
@@ -41,25 +41,7 @@
 
 Memsys* sys;
 
-uns64 cycle = 1;
-
-MODE        SIM_MODE        = SIM_MODE_B;
-uns64       CACHE_LINESIZE  = 64;
-uns64       REPL_POLICY     = 0; // 0:LRU 1:RAND
-
-uns64       DCACHE_SIZE     = 32*1024; 
-uns64       DCACHE_ASSOC    = 8; 
-
-uns64       ICACHE_SIZE     = 32*1024; 
-uns64       ICACHE_ASSOC    = 8; 
-
-uns64       L2CACHE_SIZE    = 1024*1024; 
-uns64       L2CACHE_ASSOC   = 16;
-uns64       L2CACHE_REPL    = 0;
-
-uns64       SWP_CORE0_WAYS  = 0;
-
-uns64       NUM_CORES       = 1;
+SimContext ctx;
 
 Addr mockAddrs[] = {0x6b8b4567, 0x327b23c6, 0x643c9869, 0x66334873,
                     0x74b0dc51, 0x19495cff, 0x2ae8944a, 0x12345678,
@@ -68,7 +50,7 @@ Addr mockAddrs[] = {0x6b8b4567, 0x327b23c6, 0x643c9869, 0x66334873,
 
 // Test initialization of cache
 TEST(MemsysTests, InitFunct) {
-    sys = memsys_new();
+    sys = memsys_new(&ctx);
     EXPECT_FALSE(sys == NULL);
 }
 
@@ -79,26 +61,31 @@ TEST(MemsysTests, InstructionCacheEmpty) {
     uns core_id = 0;
     Cache* cache = sys->icache;
     uns64 delay = memsys_access_modeBC(sys, mockAddr, type, core_id);
-    EXPECT_EQ(0, cache->sets[0].line[0].core_id);
-    EXPECT_TRUE(cache->sets[0].line[0].valid);
-    EXPECT_EQ(mockAddr, cache->sets[0].line[0].tag);
+    Cache_Set* s = &cache->sets[mockAddr % cache->num_sets];
+    mockAddr /= cache->num_sets;
+    EXPECT_EQ(0, s->core_id[0]);
+    EXPECT_TRUE(((s->valid >> 0) & 1));
+    EXPECT_EQ(mockAddr, s->tag[0]);
     EXPECT_EQ(0, cache->stat_dirty_evicts);
     EXPECT_EQ(ICACHE_HIT_LATENCY + L2CACHE_HIT_LATENCY + DRAM_LATENCY_FIXED, delay);
 }
 
-// Test access of empty data cache with no write
+// Test access of empty data cache with no write, the instruction
+// fetch above already brought the line into the L2
 TEST(MemsysTests, DataCacheEmptyNoWrite) {
     Addr mockAddr = mockAddrs[0];
     Access_Type type = ACCESS_TYPE_LOAD;
     uns core_id = 0;
     Cache* cache = sys->dcache;
     uns64 delay = memsys_access_modeBC(sys, mockAddr, type, core_id);
-    EXPECT_EQ(0, cache->sets[0].line[0].core_id);
-    EXPECT_TRUE(cache->sets[0].line[0].valid);
-    EXPECT_EQ(mockAddr, cache->sets[0].line[0].tag);
-    EXPECT_FALSE(cache->sets[0].line[0].dirty);
+    Cache_Set* s = &cache->sets[mockAddr % cache->num_sets];
+    mockAddr /= cache->num_sets;
+    EXPECT_EQ(0, s->core_id[0]);
+    EXPECT_TRUE(((s->valid >> 0) & 1));
+    EXPECT_EQ(mockAddr, s->tag[0]);
+    EXPECT_FALSE(((s->dirty >> 0) & 1));
     EXPECT_EQ(0, cache->stat_dirty_evicts);
-    EXPECT_EQ(DCACHE_HIT_LATENCY + L2CACHE_HIT_LATENCY + DRAM_LATENCY_FIXED, delay);
+    EXPECT_EQ(DCACHE_HIT_LATENCY + L2CACHE_HIT_LATENCY, delay);
 }
 
 // Test access of single line data cache with hit and write
@@ -108,16 +95,40 @@ TEST(MemsysTests, DataCacheHitWrite) {
     uns core_id = 0;
     Cache* cache = sys->dcache;
     uns64 delay = memsys_access_modeBC(sys, mockAddr, type, core_id);
-    EXPECT_EQ(0, cache->sets[0].line[0].core_id);
-    EXPECT_TRUE(cache->sets[0].line[0].valid);
-    EXPECT_EQ(mockAddr, cache->sets[0].line[0].tag);
-    EXPECT_TRUE(cache->sets[0].line[0].dirty);
+    Cache_Set* s = &cache->sets[mockAddr % cache->num_sets];
+    mockAddr /= cache->num_sets;
+    EXPECT_EQ(0, s->core_id[0]);
+    EXPECT_TRUE(((s->valid >> 0) & 1));
+    EXPECT_EQ(mockAddr, s->tag[0]);
+    EXPECT_TRUE(((s->dirty >> 0) & 1));
     EXPECT_EQ(0, cache->stat_dirty_evicts);
     EXPECT_EQ(DCACHE_HIT_LATENCY, delay);
 }
 
+// A 1MB L2 in 4 slices still holds 1MB of consecutive lines, spread
+// evenly over the slices
+TEST(MemsysTests, SlicedL2KeepsCapacity) {
+    SimContext sliced_ctx = ctx;
+    sliced_ctx.l2_slices = 4;
+    Memsys* sliced = memsys_new(&sliced_ctx);
+    uns64 num_lines = sliced_ctx.l2cache_size / sliced_ctx.cache_linesize;
+    uns64 misses = 0;
+    ASSERT_EQ(4, sliced->num_l2_slices);
+    for (Addr line = 0; line < 2*num_lines; line++) {
+        memsys_L2_access(sliced, line % num_lines, FALSE, 0);
+    }
+    for (uns ii = 0; ii < sliced->num_l2_slices; ii++) {
+        EXPECT_EQ(2*num_lines/4, sliced->l2slice[ii].cache->stat_read_access);
+        misses += sliced->l2slice[ii].cache->stat_read_miss;
+    }
+    EXPECT_EQ(num_lines, misses);
+    memsys_free(sliced);
+}
+
 GTEST_API_ int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
+    simctx_init(&ctx);
+    ctx.sim_mode = SIM_MODE_B;
     return RUN_ALL_TESTS();
     delete sys;
 }
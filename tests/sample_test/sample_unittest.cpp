@@ -0,0 +1,142 @@
+// Copyright 2006, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gtest/gtest.h"
+#include "../test_util.h"
+#include "../../src/sample.h"
+
+#define NUM_RECS  200000
+
+char  trace0[] = "/tmp/sample_unittest0.mtr";
+char *fnames[] = {trace0};
+
+// No units, or all of x zero: no estimate and no interval
+TEST(SampleRatioTests, Empty) {
+    Sample_Ratio r;
+    memset(&r, 0, sizeof(r));
+    EXPECT_EQ(0, sample_estimate(&r));
+    EXPECT_EQ(0, sample_ci95(&r));
+
+    sample_add(&r, 5, 0);
+    EXPECT_EQ(0, sample_estimate(&r));
+}
+
+// The estimate is sum(y)/sum(x), not the mean of the unit ratios
+TEST(SampleRatioTests, RatioOfSums) {
+    Sample_Ratio r;
+    memset(&r, 0, sizeof(r));
+    sample_add(&r, 10, 10);
+    sample_add(&r, 10, 30);
+    EXPECT_DOUBLE_EQ(0.5, sample_estimate(&r));
+    EXPECT_EQ(2, r.n);
+}
+
+// A single unit gives no spread to build an interval from
+TEST(SampleRatioTests, OneUnitNoInterval) {
+    Sample_Ratio r;
+    memset(&r, 0, sizeof(r));
+    sample_add(&r, 7, 3);
+    EXPECT_EQ(0, sample_ci95(&r));
+}
+
+// Every unit at the same ratio: the residuals are all zero
+TEST(SampleRatioTests, SameRatioZeroInterval) {
+    Sample_Ratio r;
+    uns ii;
+    memset(&r, 0, sizeof(r));
+    for (ii = 1; ii <= 10; ii++) {
+        sample_add(&r, 0.3 * ii * 1000, ii * 1000);
+    }
+    EXPECT_NEAR(0.3, sample_estimate(&r), 1e-12);
+    EXPECT_NEAR(0, sample_ci95(&r), 1e-9);
+}
+
+// Residuals y - 2x of -10, 0, 10: s^2 = 100, mean(x) = 10, so the
+// half width is 1.96 * sqrt(100/3) / 10
+TEST(SampleRatioTests, IntervalByHand) {
+    Sample_Ratio r;
+    memset(&r, 0, sizeof(r));
+    sample_add(&r, 10, 10);
+    sample_add(&r, 20, 10);
+    sample_add(&r, 30, 10);
+    EXPECT_DOUBLE_EQ(2.0, sample_estimate(&r));
+    EXPECT_NEAR(1.96 * sqrt(100.0 / 3) / 10, sample_ci95(&r), 1e-12);
+}
+
+// Four times the units with the same spread about halve the interval:
+// s^2 has n-1 below, so the ratio is 2 * sqrt((1000/9) / (4000/39))
+TEST(SampleRatioTests, IntervalShrinksWithUnits) {
+    Sample_Ratio few, many;
+    uns ii;
+    memset(&few, 0, sizeof(few));
+    memset(&many, 0, sizeof(many));
+    for (ii = 0; ii < 40; ii++) {
+        double y = (ii % 2) ? 30 : 10;
+        if (ii < 10) {
+            sample_add(&few, y, 10);
+        }
+        sample_add(&many, y, 10);
+    }
+    EXPECT_DOUBLE_EQ(sample_estimate(&few), sample_estimate(&many));
+    EXPECT_NEAR(2 * sqrt(39.0 / 36), sample_ci95(&few) / sample_ci95(&many), 1e-9);
+}
+
+// A sampled run measures sample_unit instructions per period and its
+// IPC lands within the interval of the full detailed run
+TEST(SampledRunTests, MatchesDetailedRun) {
+    SimContext cfg;
+    Sim *sim;
+
+    test_write_random_trace(trace0, 1, NUM_RECS);
+    test_config(&cfg, SIM_MODE_C, 1);
+
+    sim = sim_new(&cfg, fnames);
+    sim_run(sim);
+    double ipc = (double) sim->core[0]->done_inst_count / sim->core[0]->done_cycle_count;
+    sim_free(sim);
+
+    cfg.sample_period = 10000;
+    sim = sim_new(&cfg, fnames);
+    sim_run(sim);
+    EXPECT_EQ(NUM_RECS / cfg.sample_period, sim->sample.units);
+    EXPECT_EQ(sim->sample.units * cfg.sample_unit, sim->sample.inst);
+    EXPECT_GT(sample_ci95(&sim->sample.ipc), 0);
+    EXPECT_NEAR(ipc, sample_estimate(&sim->sample.ipc), sample_ci95(&sim->sample.ipc));
+    // the regular stats cover the detailed instructions only
+    uns64 detailed = sim->sample.units * (cfg.sample_warmup + cfg.sample_unit);
+    EXPECT_EQ(detailed, sim->core[0]->done_inst_count);
+    EXPECT_EQ(detailed, sim->memsys->stat_ifetch_access);
+    EXPECT_EQ(detailed, sim->memsys->icache->stat_read_access);
+    sim_free(sim);
+}
@@ -0,0 +1,173 @@
+// Copyright 2006, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gtest/gtest.h"
+#include "../test_util.h"
+#include "../../src/simpoint.h"
+
+#define INTERVAL       1000
+#define NUM_INTERVALS  40
+#define PHASE_B_BEGIN  10  // intervals 10..39 run the second phase
+
+char  trace0[]   = "/tmp/simpoint_unittest0.mtr";
+char  points[]   = "/tmp/simpoint_unittest.pts";
+char *fnames[]   = {trace0};
+
+// Two phases with different code: 8 blocks of 8 instructions, then
+// 13 blocks of 5 instructions elsewhere. Every 4th instruction loads.
+void write_trace(char *fname) {
+    FILE *fp = fopen(fname, "wb");
+    uns   ii;
+
+    for (ii = 0; ii < NUM_INTERVALS * INTERVAL; ii++) {
+        uns32 inst, addr = 0x10000000 + 64 * (ii % 20000);
+        if (ii / INTERVAL < PHASE_B_BEGIN) {
+            inst = 0x400000 + 0x100 * (ii / 8 % 8) + 4 * (ii % 8);
+        } else {
+            inst = 0x900000 + 0x340 * (ii / 5 % 13) + 4 * (ii % 5);
+        }
+        uns8 type = (ii % 4 == 0) ? INST_TYPE_LOAD : INST_TYPE_ALU;
+        test_put_rec(fp, inst, type, type == INST_TYPE_ALU ? 0 : addr);
+    }
+    fclose(fp);
+}
+
+// Reads the points back, returns how many
+uns read_points(uns64 *interval, double *weight, uns max) {
+    FILE *fp = fopen(points, "r");
+    uns64 size, num;
+    uns   cluster, n = 0;
+
+    EXPECT_EQ(2, fscanf(fp, "# interval_size %llu intervals %llu", &size, &num));
+    EXPECT_EQ(INTERVAL, size);
+    EXPECT_EQ(NUM_INTERVALS, num);
+    while (n < max && fscanf(fp, "%llu %lf %u", &interval[n], &weight[n], &cluster) == 3) {
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+TEST(SimpointProfileTests, WriteTrace) {
+    write_trace(trace0);
+}
+
+// k-means splits the two phases, weighted by their share of the
+// intervals. Interval 0 (cold caches) is not picked for phase A.
+TEST(SimpointProfileTests, FindsPhases) {
+    uns64  interval[8];
+    double weight[8];
+
+    EXPECT_EQ(2, simpoint_profile(trace0, INTERVAL, 2, points));
+    ASSERT_EQ(2, read_points(interval, weight, 8));
+
+    EXPECT_GT(interval[0], 0);
+    EXPECT_LT(interval[0], PHASE_B_BEGIN);
+    EXPECT_GE(interval[1], PHASE_B_BEGIN);
+    EXPECT_NEAR(0.25, weight[0], 1e-6);
+    EXPECT_NEAR(0.75, weight[1], 1e-6);
+}
+
+// More clusters than phases: still one point per non-empty cluster,
+// in increasing order, with the weights adding up to one
+TEST(SimpointProfileTests, MoreClustersThanPhases) {
+    uns64  interval[64];
+    double weight[64], sum = 0;
+    uns    num, ii;
+
+    num = simpoint_profile(trace0, INTERVAL, 64, points);
+    EXPECT_LE(num, NUM_INTERVALS);
+    ASSERT_EQ(num, read_points(interval, weight, 64));
+    for (ii = 0; ii < num; ii++) {
+        sum += weight[ii];
+        if (ii) {
+            EXPECT_LT(interval[ii - 1], interval[ii]);
+        }
+    }
+    EXPECT_NEAR(1.0, sum, 1e-4);
+    EXPECT_LT(interval[0], PHASE_B_BEGIN);
+    EXPECT_GE(interval[num - 1], PHASE_B_BEGIN);
+}
+
+// One point of weight 1 measures exactly that interval
+TEST(SimpointReplayTests, OnePointIsTheInterval) {
+    SimContext   cfg;
+    Simpoint_Est est;
+    Sim_Counters cnt;
+    Sim *sim;
+    FILE *fp = fopen(points, "w");
+
+    fprintf(fp, "# interval_size %d intervals %d\n7 1.000000 0\n", INTERVAL, NUM_INTERVALS);
+    fclose(fp);
+
+    test_config(&cfg, SIM_MODE_C, 1);
+    sim = sim_new(&cfg, fnames);
+    sim_run_simpoints(sim, points, &est);
+    sim_free(sim);
+
+    sim = sim_new(&cfg, fnames);
+    sim_ffwd(sim, 7 * INTERVAL);
+    sim_read_counters(sim, &cnt);
+    sim_step_inst(sim, INTERVAL);
+    sim_counters_delta(sim, &cnt);
+    sim_free(sim);
+
+    EXPECT_EQ(1, est.num_points);
+    EXPECT_EQ(INTERVAL, est.inst);
+    EXPECT_DOUBLE_EQ(cnt.cycles, est.cycles_w);
+    EXPECT_DOUBLE_EQ(cnt.load_access, est.load_access_w);
+    EXPECT_DOUBLE_EQ(cnt.load_delay, est.load_delay_w);
+}
+
+// Every point adds its counters times its weight
+TEST(SimpointReplayTests, WeightsThePoints) {
+    SimContext   cfg;
+    Simpoint_Est est;
+    Sim *sim;
+    FILE *fp = fopen(points, "w");
+
+    fprintf(fp, "# interval_size %d intervals %d\n3 0.250000 0\n20 0.750000 1\n", INTERVAL, NUM_INTERVALS);
+    fclose(fp);
+
+    test_config(&cfg, SIM_MODE_C, 1);
+    cfg.warmup_inst = 500;
+    sim = sim_new(&cfg, fnames);
+    sim_run_simpoints(sim, points, &est);
+    sim_free(sim);
+
+    EXPECT_EQ(2, est.num_points);
+    EXPECT_EQ(2 * INTERVAL, est.inst);
+    EXPECT_DOUBLE_EQ(INTERVAL, est.inst_w);
+    EXPECT_DOUBLE_EQ(INTERVAL / 4, est.load_access_w);
+    EXPECT_GT(est.cycles_w, est.inst_w);
+}
@@ -0,0 +1,50 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+// Helpers for the unit tests that run whole traces: writers for plain
+// .mtr traces and a quiet SimContext.
+
+#include <stdio.h>
+
+#include "../src/types.h"
+#include "../src/memsim.h"
+
+// One plain .mtr record: instruction address, type, data address, the
+// addresses 4 bytes little endian
+static inline void test_put_rec(FILE *fp, uns32 inst, uns8 type, uns32 addr) {
+    uns8 rec[9];
+    uns  jj;
+
+    for (jj = 0; jj < 4; jj++) {
+        rec[jj]     = inst >> (8 * jj);
+        rec[5 + jj] = addr >> (8 * jj);
+    }
+    rec[4] = type;
+    fwrite(rec, sizeof(rec), 1, fp);
+}
+
+// num records of a loop over 16KB of code, with loads and stores
+// spread over a few MB, different per seed
+static inline void test_write_random_trace(const char *fname, uns seed, uns num) {
+    FILE *fp = fopen(fname, "wb");
+    uns32 x = seed;
+    uns   ii;
+
+    for (ii = 0; ii < num; ii++) {
+        x = x * 1103515245 + 12345;
+        uns32 addr = 0x10000000 + ((x >> 8) & 0x3FFFC0);
+        uns8  type = (x >> 4) % 4 == 0 ? INST_TYPE_LOAD : (x >> 4) % 8 == 1 ? INST_TYPE_STORE : INST_TYPE_ALU;
+        test_put_rec(fp, 0x400000 + 4 * (ii % 4096), type, type == INST_TYPE_ALU ? 0 : addr);
+    }
+    fclose(fp);
+}
+
+// Defaults, without the progress dots
+static inline void test_config(SimContext *cfg, MODE mode, uns64 num_cores) {
+    simctx_init(cfg);
+    cfg->sim_mode   = mode;
+    cfg->num_cores  = num_cores;
+    cfg->print_dots = FALSE;
+}
+
+#endif
@@ -0,0 +1,179 @@
+// Copyright 2006, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "gtest/gtest.h"
+#include "../test_util.h"
+#include "../../src/trace.h"
+
+// More records than one inflate refill and than the prefetch ring
+#define NUM_RECS  (2 * TRACE_BUF_SIZE / TRACE_REC_SIZE + 1000)
+
+char plain[] = "/tmp/trace_unittest.mtr";
+char gz[]    = "/tmp/trace_unittest.mtr.gz";
+char flat[]  = "/tmp/trace_unittest.mtrf";
+
+// Record ii of the test traces, every field different per record
+void expected_rec(uns ii, Trace_Rec *rec) {
+    rec->inst_addr = 0x400000 + 4 * ii;
+    rec->inst_type = ii % 3;
+    rec->ldst_addr = 0x80000000u + 64 * ii + ii % 7;
+}
+
+// Reads t to the end against expected_rec, from record first on;
+// num_read counts the records skipped before first too
+void check_recs(Trace *t, uns first) {
+    Trace_Rec rec, want;
+    uns       ii;
+
+    for (ii = first; ii < NUM_RECS; ii++) {
+        ASSERT_TRUE(trace_read(t, &rec)) << "record " << ii;
+        expected_rec(ii, &want);
+        ASSERT_EQ(want.inst_addr, rec.inst_addr) << "record " << ii;
+        ASSERT_EQ(want.inst_type, rec.inst_type) << "record " << ii;
+        ASSERT_EQ(want.ldst_addr, rec.ldst_addr) << "record " << ii;
+    }
+    EXPECT_FALSE(trace_read(t, &rec));
+    EXPECT_EQ(NUM_RECS, t->num_read);
+}
+
+// The same records as a plain .mtr, gzipped, and converted to flat
+TEST(TraceReadTests, WriteTraces) {
+    FILE     *fp = fopen(plain, "wb");
+    gzFile    gzf = gzopen(gz, "wb");
+    Trace_Rec rec;
+    uns       ii;
+
+    for (ii = 0; ii < NUM_RECS; ii++) {
+        expected_rec(ii, &rec);
+        test_put_rec(fp, rec.inst_addr, rec.inst_type, rec.ldst_addr);
+    }
+    fclose(fp);
+
+    fp = fopen(plain, "rb");
+    uns8 buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        ASSERT_EQ((int) len, gzwrite(gzf, buf, len));
+    }
+    fclose(fp);
+    gzclose(gzf);
+
+    EXPECT_EQ(NUM_RECS, trace_convert(gz, flat));
+}
+
+TEST(TraceReadTests, Gzip) {
+    Trace *t = trace_open(gz, FALSE);
+    EXPECT_EQ(TRACE_MAP_NONE, t->map_kind);
+    check_recs(t, 0);
+    trace_close(t);
+}
+
+TEST(TraceReadTests, Plain) {
+    Trace *t = trace_open(plain, FALSE);
+    check_recs(t, 0);
+    trace_close(t);
+}
+
+TEST(TraceReadTests, Flat) {
+    Trace *t = trace_open(flat, FALSE);
+    EXPECT_EQ(TRACE_MAP_FILE, t->map_kind);
+    check_recs(t, 0);
+    trace_close(t);
+}
+
+TEST(TraceReadTests, GzipPrefetch) {
+    Trace *t = trace_open(gz, TRUE);
+    ASSERT_TRUE(t->ring != NULL);
+    check_recs(t, 0);
+    trace_close(t);
+}
+
+TEST(TraceReadTests, FlatPrefetch) {
+    Trace *t = trace_open(flat, TRUE);
+    ASSERT_TRUE(t->ring != NULL);
+    check_recs(t, 0);
+    trace_close(t);
+}
+
+// Closing with the producer still ahead must stop the thread
+TEST(TraceReadTests, PrefetchCloseEarly) {
+    Trace    *t = trace_open(gz, TRUE);
+    Trace_Rec rec;
+    EXPECT_TRUE(trace_read(t, &rec));
+    trace_close(t);
+}
+
+// Skipping moves the cursor of a mapped trace, streams decode
+TEST(TraceReadTests, Skip) {
+    char  *fnames[] = {gz, flat};
+    Flag   prefetch;
+    uns    ii;
+
+    for (ii = 0; ii < 2; ii++) {
+        for (prefetch = FALSE; prefetch <= TRUE; prefetch++) {
+            Trace *t = trace_open(fnames[ii], prefetch);
+            EXPECT_EQ(NUM_RECS / 2, trace_skip(t, NUM_RECS / 2));
+            check_recs(t, NUM_RECS / 2);
+            EXPECT_EQ(0, trace_skip(t, 1));
+            trace_close(t);
+        }
+    }
+}
+
+// A loaded trace hands out the records to each of its clones
+TEST(TraceReadTests, LoadAndClone) {
+    Trace *t = trace_load(gz);
+    EXPECT_EQ(TRACE_MAP_HEAP, t->map_kind);
+    Trace *c1 = trace_clone(t);
+    Trace *c2 = trace_clone(t);
+    check_recs(c1, 0);
+    check_recs(c2, 0);
+    trace_close(c2);
+    trace_close(c1);
+    trace_close(t);
+}
+
+// A flat file whose size disagrees with its header is refused
+TEST(TraceReadTests, TruncatedFlatDies) {
+    char  cut[] = "/tmp/trace_unittest_cut.mtrf";
+    FILE *in  = fopen(flat, "rb");
+    FILE *out = fopen(cut, "wb");
+    uns8  buf[TRACE_FLAT_HDR_SIZE + 10 * TRACE_REC_SIZE];
+
+    ASSERT_EQ(1, fread(buf, sizeof(buf), 1, in));
+    fwrite(buf, sizeof(buf), 1, out);
+    fclose(in);
+    fclose(out);
+    EXPECT_EXIT(trace_open(cut, FALSE), ::testing::ExitedWithCode(1), "");
+}